@@ -0,0 +1,123 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "hash.h"
+#include "limiter.h"
+
+/**
+ * Batch benchmark: runs N instances of one ROM on a thread pool (see
+ * batch.h) and reports aggregate throughput. All instances get the same
+ * input, so they must all end on the same framebuffer.
+ *
+ * -S sweeps the thread count in powers of two up to -j, to check scaling.
+ */
+
+static void usage(char *name) {
+  fprintf(stderr, "usage: %s [-n instances] [-j threads] [-f frames] [-c cycles] [-S] rom.gb\n", name);
+  fprintf(stderr, "  -c  step in cycle budgets of this size instead of whole frames\n");
+  fprintf(stderr, "  -S  sweep thread counts 1, 2, 4... up to -j\n");
+  exit(1);
+}
+
+static uint64_t framebuffer_hash(GPU *gpu) {
+  return hash64(gpu->framebuffer, sizeof(gpu->framebuffer), 0);
+}
+
+static double run(const uint8_t *image, size_t size, int count, int threads,
+                  int frames, int cycles) {
+  Batch batch;
+  if (batch_init(&batch, image, size, count, threads) != 0) {
+    fprintf(stderr, "Could not start %d instances on %d threads\n", count, threads);
+    exit(1);
+  }
+
+  uint64_t start = limiter_now();
+  int errors = 0;
+
+  if (cycles > 0) {
+    int64_t total = (int64_t)frames * FRAME_CYCLES;
+    for (int64_t done = 0; done < total; done += cycles) {
+      errors = batch_run_cycles(&batch, cycles);
+    }
+  } else {
+    errors = batch_run_frames(&batch, frames);
+  }
+
+  double elapsed = (limiter_now() - start) / 1e9;
+
+  int mismatched = 0;
+  uint64_t hash = framebuffer_hash(&batch_emulator(&batch, 0)->gpu);
+  for (int i = 1; i < count; i++) {
+    mismatched += framebuffer_hash(&batch_emulator(&batch, i)->gpu) != hash;
+  }
+
+  printf("threads %3d: %.3f s, %.0f frames/s, %.0f frames/s per thread",
+         batch.threads, elapsed, (double)count * frames / elapsed,
+         (double)count * frames / elapsed / batch.threads);
+  if (errors || mismatched)
+    printf(", %d errors, %d mismatched", errors, mismatched);
+  printf("\n");
+
+  batch_free(&batch);
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  int count = 64, threads = sysconf(_SC_NPROCESSORS_ONLN), frames = 600, cycles = 0;
+  int sweep = 0, opt;
+
+  while ((opt = getopt(argc, argv, "n:j:f:c:S")) != -1) {
+    switch (opt) {
+    case 'n':
+      count = atoi(optarg);
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'f':
+      frames = atoi(optarg);
+      break;
+    case 'c':
+      cycles = atoi(optarg);
+      break;
+    case 'S':
+      sweep = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (optind >= argc || count <= 0 || threads <= 0 || frames <= 0)
+    usage(argv[0]);
+
+  size_t size;
+  uint8_t *image = emulator_rom_load(argv[optind], &size);
+  if (image == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  printf("instances: %d, frames: %d, %s\n", count, frames,
+         cycles > 0 ? "cycle budgets" : "whole frames");
+
+  if (sweep) {
+    for (int n = 1; n < threads; n *= 2) {
+      run(image, size, count, n, frames, cycles);
+    }
+  }
+  run(image, size, count, threads, frames, cycles);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("peak rss: %ld KB (%zu KB ROM, shared)\n", usage.ru_maxrss, size / 1024);
+
+  free(image);
+  return 0;
+}
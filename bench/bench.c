@@ -0,0 +1,378 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "emulator.h"
+#include "hash.h"
+#include "link.h"
+#include "limiter.h"
+#include "movie.h"
+#include "profiler.h"
+#include "trace.h"
+
+// records kept in the trace ring, 24 bytes each
+#define TRACE_CAPACITY (1 << 20)
+
+/**
+ * Headless benchmark: runs a ROM for a number of frames as fast as possible
+ * and reports throughput. The framebuffer hash at the end lets a run be
+ * checked against a known-good one, so a faster build that renders the
+ * wrong thing doesn't go unnoticed.
+ *
+ * With -t, every instruction is also recorded into a binary trace ring
+ * file (see trace.h) for bin/trace to decode or compare. With -p, the guest
+ * profiler runs and writes <name>.folded and <name>.txt at the end. With -c
+ * (COUNTERS=1 builds only), the hot path counters are written once per
+ * frame, as JSON lines when the file name ends in .json and CSV otherwise.
+ *
+ * Input scripts are text, one "frame mask" pair per line (mask in hex, see
+ * INPUT_* in ram.h); each mask holds from its frame until the next line.
+ * With -R, the run is recorded as a movie (see movie.h). With -m, a movie
+ * is played back instead, for all its frames, and the run stops at the
+ * first frame whose state doesn't match the recording. With -s, the state
+ * hash after every frame is written one per line, to diff two builds' runs.
+ * With -A, sound is synthesised too, into the null sink, to time the APU.
+ * With -o, every byte sent over the serial port is written to a file ("-"
+ * for stdout), which is where test ROMs print. With -L, a second instance
+ * of the ROM runs on its own thread with a link cable between the two;
+ * movies hold one instance's inputs only, so it takes neither -R nor -m.
+ */
+
+typedef struct {
+  int frame;
+  uint8_t mask;
+} ScriptEntry;
+
+static ScriptEntry *load_script(char *filename, int *count) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    perror(filename);
+    exit(1);
+  }
+
+  int capacity = 64;
+  ScriptEntry *script = malloc(capacity * sizeof(ScriptEntry));
+  *count = 0;
+
+  int frame;
+  unsigned int mask;
+  while (fscanf(f, "%d %x", &frame, &mask) == 2) {
+    if (*count == capacity) {
+      capacity *= 2;
+      script = realloc(script, capacity * sizeof(ScriptEntry));
+    }
+
+    script[*count].frame = frame;
+    script[*count].mask = mask;
+    (*count)++;
+  }
+
+  fclose(f);
+  return script;
+}
+
+static uint64_t framebuffer_hash(GPU *gpu) {
+  return hash64(gpu->framebuffer, sizeof(gpu->framebuffer), 0);
+}
+
+typedef struct {
+  Link *link;
+  int frames;
+} LinkPartner;
+
+/** the other end of the cable, frame for frame with the main instance */
+static void *run_partner(void *data) {
+  LinkPartner *partner = data;
+  for (int frame = 0; frame < partner->frames; frame++)
+    link_run_side(partner->link, 1, FRAME_CYCLES);
+  return NULL;
+}
+
+static void usage(char *name) {
+  fprintf(stderr, "usage: %s [-f frames] [-i script] [-t trace] [-p profile] [-c counters]\n"
+                  "       [-s hashes] [-R movie | -m movie | -L] [-A] [-o serial] rom.gb\n",
+          name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static Emulator emulator;
+
+  int frames = 3600, opt;
+  char *script_file = NULL, *trace_file = NULL, *profile_name = NULL;
+  char *counters_file = NULL, *record_file = NULL, *movie_file = NULL;
+  char *hashes_file = NULL;
+  char *serial_file = NULL;
+  int audio = 0, linked = 0;
+
+  while ((opt = getopt(argc, argv, "f:i:t:p:c:R:m:s:Ao:L")) != -1) {
+    switch (opt) {
+    case 'f':
+      frames = atoi(optarg);
+      break;
+    case 'i':
+      script_file = optarg;
+      break;
+    case 't':
+      trace_file = optarg;
+      break;
+    case 'p':
+      profile_name = optarg;
+      break;
+    case 'c':
+      counters_file = optarg;
+      break;
+    case 'R':
+      record_file = optarg;
+      break;
+    case 'm':
+      movie_file = optarg;
+      break;
+    case 's':
+      hashes_file = optarg;
+      break;
+    case 'A':
+      audio = 1;
+      break;
+    case 'o':
+      serial_file = optarg;
+      break;
+    case 'L':
+      linked = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (optind >= argc || frames <= 0 || (movie_file && (record_file || script_file)) ||
+      (linked && (movie_file || record_file)))
+    usage(argv[0]);
+
+  int script_count = 0, script_next = 0;
+  ScriptEntry *script = script_file ? load_script(script_file, &script_count) : NULL;
+
+  if (emulator_init(&emulator, argv[optind]) != 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  FILE *serial = NULL;
+  if (serial_file) {
+    serial = strcmp(serial_file, "-") == 0 ? stdout : fopen(serial_file, "wb");
+    if (serial == NULL) {
+      perror(serial_file);
+      return 1;
+    }
+    emulator.serial.capture = serial;
+  }
+
+  static Emulator partner;
+  static Link link;
+  static LinkPartner partner_data;
+  pthread_t partner_thread;
+  if (linked) {
+    if (emulator_init_rom(&partner, emulator.rom, emulator.rom_size) != 0) {
+      fprintf(stderr, "Could not start the second instance\n");
+      return 1;
+    }
+    link_init(&link, &emulator, &partner, LINK_WINDOW);
+
+    partner_data = (LinkPartner){&link, frames};
+    if (pthread_create(&partner_thread, NULL, run_partner, &partner_data) != 0) {
+      fprintf(stderr, "Could not start the second instance\n");
+      return 1;
+    }
+  }
+
+  static APUSynth synth;
+  if (audio) {
+    apu_synth_init(&synth, NULL);
+    emulator.apu.synth = &synth;
+  }
+
+  Trace trace = {NULL, NULL, 0};
+  if (trace_file) {
+    if (trace_open(&trace, trace_file, TRACE_CAPACITY) != 0) {
+      perror(trace_file);
+      return 1;
+    }
+    emulator.cpu.trace = &trace;
+  }
+
+  static Profiler profiler;
+  if (profile_name) {
+    if (profiler_init(&profiler, emulator.rom, emulator.rom_size) != 0) {
+      fprintf(stderr, "Could not allocate profiler\n");
+      return 1;
+    }
+    emulator.cpu.profiler = &profiler;
+  }
+
+  Movie movie;
+  if (movie_file) {
+    if (movie_load(&movie, &emulator, movie_file) != 0) {
+      perror(movie_file);
+      return 1;
+    }
+    frames = movie.frame_count;
+    if (frames == 0) {
+      fprintf(stderr, "%s: empty movie\n", movie_file);
+      return 1;
+    }
+  } else if (record_file) {
+    movie_init(&movie, &emulator);
+  }
+
+  FILE *hashes = NULL;
+  if (hashes_file) {
+    hashes = fopen(hashes_file, "w");
+    if (hashes == NULL) {
+      perror(hashes_file);
+      return 1;
+    }
+  }
+
+  FILE *counters = NULL;
+#ifdef LEEKBOY_COUNTERS
+  int counters_json = 0;
+#endif
+  if (counters_file) {
+#ifdef LEEKBOY_COUNTERS
+    counters = fopen(counters_file, "w");
+    if (counters == NULL) {
+      perror(counters_file);
+      return 1;
+    }
+
+    size_t length = strlen(counters_file);
+    counters_json = length >= 5 && strcmp(counters_file + length - 5, ".json") == 0;
+    if (!counters_json)
+      counters_write_csv_header(counters);
+#else
+    fprintf(stderr, "Built without counters, rebuild with make COUNTERS=1\n");
+    return 1;
+#endif
+  }
+
+  uint64_t start = limiter_now();
+
+  MovieStatus status = MOVIE_OK;
+  int linked_frames = 0;
+
+  for (int frame = 0; frame < frames; frame++) {
+    if (movie_file) {
+      status = movie_play_frame(&movie, &emulator);
+      if (status != MOVIE_OK)
+        break;
+    } else {
+      while (script_next < script_count && script[script_next].frame <= frame) {
+        uint8_t mask = script[script_next++].mask;
+        if (record_file)
+          movie_record_input(&movie, &emulator, mask);
+        else
+          emulator_set_input(&emulator, mask);
+      }
+
+      if (linked) {
+        link_run_side(&link, 0, FRAME_CYCLES);
+        linked_frames++;
+      } else {
+        emulator_step(&emulator);
+      }
+      if (emulator.cpu.error)
+        break;
+
+      if (record_file && movie_record_frame(&movie, &emulator) != 0) {
+        fprintf(stderr, "Could not allocate movie\n");
+        return 1;
+      }
+    }
+
+    if (hashes)
+      fprintf(hashes, "%d %016llx\n", frame,
+              (unsigned long long)emulator_state_hash(&emulator));
+
+#ifdef LEEKBOY_COUNTERS
+    if (counters) {
+      if (counters_json)
+        counters_write_json(&emulator.ram.counters, frame, counters);
+      else
+        counters_write_csv(&emulator.ram.counters, frame, counters);
+      memset(&emulator.ram.counters, 0, sizeof(Counters));
+    }
+#endif
+  }
+
+  if (linked) {
+    // a stopped CPU still has to meet the partner at every window
+    for (; linked_frames < frames; linked_frames++)
+      link_run_side(&link, 0, FRAME_CYCLES);
+    pthread_join(partner_thread, NULL);
+  }
+
+  if (emulator.cpu.error) {
+    fprintf(stderr, "Unknown opcode: 0x%02X at 0x%04X\n", emulator.cpu.error_opcode,
+            emulator.cpu.error_pc);
+    return 1;
+  }
+
+  if (status == MOVIE_DESYNC) {
+    fprintf(stderr, "Movie desync at frame %zu, cycle %llu\n", movie.frame,
+            (unsigned long long)emulator.cycles);
+    return 1;
+  }
+
+  double elapsed = (limiter_now() - start) / 1e9;
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  double realtime = (double)CLOCKSPEED / FRAME_CYCLES;
+
+  printf("frames:      %d\n", frames);
+  printf("time:        %.3f s\n", elapsed);
+  printf("fps:         %.1f (%.1fx realtime)\n", frames / elapsed,
+         frames / elapsed / realtime);
+  printf("mips:        %.2f\n", emulator.instructions / elapsed / 1e6);
+  printf("cycles/s:    %.0f\n", emulator.cycles / elapsed);
+  printf("ns/frame:    %.0f\n", elapsed * 1e9 / frames);
+  printf("peak rss:    %ld KB\n", usage.ru_maxrss);
+  printf("framebuffer: %016llx\n", (unsigned long long)framebuffer_hash(&emulator.gpu));
+  printf("state:       %016llx\n", (unsigned long long)emulator_state_hash(&emulator));
+  if (audio)
+    printf("samples:     %llu\n", (unsigned long long)synth.samples);
+  if (linked)
+    printf("partner:     %016llx\n", (unsigned long long)emulator_state_hash(&partner));
+
+  if (profile_name) {
+    if (profiler_save(&profiler, profile_name) != 0)
+      perror(profile_name);
+    profiler_free(&profiler);
+  }
+
+  if (record_file && movie_save(&movie, record_file) != 0)
+    perror(record_file);
+  if (movie_file || record_file)
+    movie_free(&movie);
+
+  if (hashes)
+    fclose(hashes);
+  if (counters)
+    fclose(counters);
+  if (serial && serial != stdout)
+    fclose(serial);
+  if (linked) {
+    link_free(&link);
+    emulator_free(&partner);
+  }
+  trace_close(&trace);
+  emulator_free(&emulator);
+  free(script);
+  return 0;
+}
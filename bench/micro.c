@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator.h"
+#include "limiter.h"
+#include "roms.h"
+
+/**
+ * Microbenchmarks for the emulator hot paths, on synthetic inputs.
+ *
+ * Each benchmark runs REPEATS times and reports the median and minimum
+ * ns per operation. Output is JSON with a fixed key order and one result per
+ * line, so two runs can be diffed directly.
+ */
+
+#define REPEATS 7
+
+typedef struct {
+  const char *name;
+  void (*setup)(const void *arg);
+  void (*run)(const void *arg, int iterations);
+  const void *arg;
+  int iterations;
+} Benchmark;
+
+static Emulator emulator;
+static uint8_t rom[SYNTHETIC_ROM_SIZE];
+
+// keeps reads from being optimised away
+static volatile uint8_t sink;
+
+/* cpu_step */
+
+typedef struct {
+  const uint8_t *code;
+  int size;
+} Pattern;
+
+static void setup_cpu(const void *arg) {
+  const Pattern *pattern = arg;
+
+  // ROM filled with the pattern, executed from 0000 onwards
+  for (int i = 0; i + pattern->size <= SYNTHETIC_ROM_SIZE; i += pattern->size) {
+    memcpy(rom + i, pattern->code, pattern->size);
+  }
+  rom[0x147] = 0x00;
+  rom[0x149] = 0x00;
+
+  emulator_free(&emulator);
+  emulator_init_rom(&emulator, rom, sizeof(rom));
+  emulator.cpu.pc = 0;
+  emulator.cpu.sp = 0xDFFE;
+  emulator.cpu.hl = 0xC000;
+}
+
+static void run_cpu(const void *arg, int iterations) {
+  CPU *cpu = &emulator.cpu;
+
+  for (int i = 0; i < iterations; i++) {
+    if (cpu->pc >= 0x7F00)
+      cpu->pc = 0;
+    cpu_step(cpu, INT_MAX);
+  }
+}
+
+#define PATTERN(...) &(const Pattern){(const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__})}
+
+/* ram_get / ram_set */
+
+static void setup_ram(const void *arg) {
+  memset(rom, 0, sizeof(rom));
+  emulator_free(&emulator);
+  emulator_init_rom(&emulator, rom, sizeof(rom));
+}
+
+static void run_ram_get(const void *arg, int iterations) {
+  uint16_t base = *(const uint16_t *)arg;
+  uint8_t sum = 0;
+
+  for (int i = 0; i < iterations; i++) {
+    sum += ram_get(&emulator.ram, base + (i & 0x03));
+  }
+
+  sink = sum;
+}
+
+static void run_ram_set(const void *arg, int iterations) {
+  uint16_t base = *(const uint16_t *)arg;
+
+  for (int i = 0; i < iterations; i++) {
+    ram_set(&emulator.ram, base + (i & 0x03), i);
+  }
+}
+
+#define ADDRESS(x) &(const uint16_t){x}
+
+/* gpu_render_scanline */
+
+static void setup_gpu(const void *arg) {
+  uint8_t lcdc = *(const uint8_t *)arg;
+
+  setup_ram(NULL);
+  RAM *ram = &emulator.ram;
+
+  // non-trivial tiles and maps
+  for (int i = 0; i < 0x2000; i++) {
+    ram->vram[i] = (0x8000 + i) * 37;
+  }
+
+  // 40 sprites on the first lines, all visible
+  for (int sprite = 0; sprite < 40; sprite++) {
+    ram->oam[sprite * 4] = 16;
+    ram->oam[sprite * 4 + 1] = 8 + sprite * 4;
+    ram->oam[sprite * 4 + 2] = sprite;
+    ram->oam[sprite * 4 + 3] = (sprite & 3) << 5;
+  }
+
+  ram->io[LCDC - RAM_IO] = lcdc;
+  ram->io[WY - RAM_IO] = 0;
+  ram->io[WX - RAM_IO] = 7;
+  ram->io[PAL_BGP - RAM_IO] = 0xE4;
+  ram->io[0xFF48 - RAM_IO] = 0xE4;
+  ram->io[0xFF49 - RAM_IO] = 0x1B;
+}
+
+static void run_gpu(const void *arg, int iterations) {
+  for (int i = 0; i < iterations; i++) {
+    emulator.ram.io[LY - RAM_IO] = i & 7;
+    gpu_render_scanline(&emulator.gpu);
+  }
+}
+
+#define LCDC_VALUE(x) &(const uint8_t){x}
+
+/* timers and DMA */
+
+static void setup_timers(const void *arg) {
+  setup_ram(NULL);
+  emulator.ram.io[MEM_TAC - RAM_IO] = 0x05;
+}
+
+static void run_timers(const void *arg, int iterations) {
+  for (int i = 0; i < iterations; i++) {
+    emulator_update_timers(&emulator, 4);
+  }
+}
+
+static void run_dma(const void *arg, int iterations) {
+  for (int i = 0; i < iterations; i++) {
+    ram_set(&emulator.ram, RAM_DMA, 0xC1);
+  }
+}
+
+static void run_state_hash(const void *arg, int iterations) {
+  int dirty = arg ? *(const int *)arg : 0;
+
+  for (int i = 0; i < iterations; i++) {
+    // a frame's worth of writes spread over `dirty` WRAM blocks
+    for (int block = 0; block < dirty; block++)
+      ram_set(&emulator.ram, 0xC000 + block * RAM_HASH_BLOCK, i);
+    sink = emulator_state_hash(&emulator);
+  }
+}
+
+/* whole frames of the synthetic ROMs */
+
+static void setup_frame(const void *arg) {
+  synthetic_rom_build(arg, rom);
+  emulator_free(&emulator);
+  emulator_init_rom(&emulator, rom, sizeof(rom));
+}
+
+static void run_frame(const void *arg, int iterations) {
+  for (int i = 0; i < iterations; i++) {
+    emulator_step(&emulator);
+  }
+}
+
+static const Benchmark benchmarks[] = {
+    {"cpu_step/nop", setup_cpu, run_cpu, PATTERN(0x00), 2000000},
+    {"cpu_step/ld_r_r", setup_cpu, run_cpu, PATTERN(0x41), 2000000},
+    {"cpu_step/ld_r_d8", setup_cpu, run_cpu, PATTERN(0x06, 0x12), 2000000},
+    {"cpu_step/ld_r16_d16", setup_cpu, run_cpu, PATTERN(0x01, 0x34, 0x12), 2000000},
+    {"cpu_step/ld_a_hl", setup_cpu, run_cpu, PATTERN(0x7E), 2000000},
+    {"cpu_step/ld_hl_a", setup_cpu, run_cpu, PATTERN(0x77), 2000000},
+    {"cpu_step/alu_r", setup_cpu, run_cpu, PATTERN(0x80), 2000000},
+    {"cpu_step/alu_d8", setup_cpu, run_cpu, PATTERN(0xC6, 0x01), 2000000},
+    {"cpu_step/inc_dec_r8", setup_cpu, run_cpu, PATTERN(0x04, 0x05), 2000000},
+    {"cpu_step/inc_r16", setup_cpu, run_cpu, PATTERN(0x03), 2000000},
+    {"cpu_step/push_pop", setup_cpu, run_cpu, PATTERN(0xC5, 0xC1), 2000000},
+    {"cpu_step/jr", setup_cpu, run_cpu, PATTERN(0x18, 0x00), 2000000},
+    {"cpu_step/cb_swap", setup_cpu, run_cpu, PATTERN(0xCB, 0x37), 2000000},
+    {"cpu_step/cb_bit", setup_cpu, run_cpu, PATTERN(0xCB, 0x7F), 2000000},
+
+    {"ram_get/rom0", setup_ram, run_ram_get, ADDRESS(0x0100), 4000000},
+    {"ram_get/romx", setup_ram, run_ram_get, ADDRESS(0x4100), 4000000},
+    {"ram_get/vram", setup_ram, run_ram_get, ADDRESS(0x8100), 4000000},
+    {"ram_get/sram", setup_ram, run_ram_get, ADDRESS(0xA100), 4000000},
+    {"ram_get/wram", setup_ram, run_ram_get, ADDRESS(0xC100), 4000000},
+    {"ram_get/echo", setup_ram, run_ram_get, ADDRESS(0xE100), 4000000},
+    {"ram_get/oam", setup_ram, run_ram_get, ADDRESS(0xFE10), 4000000},
+    {"ram_get/io", setup_ram, run_ram_get, ADDRESS(0xFF42), 4000000},
+    {"ram_get/hram", setup_ram, run_ram_get, ADDRESS(0xFF90), 4000000},
+
+    {"ram_set/rom0", setup_ram, run_ram_set, ADDRESS(0x0100), 4000000},
+    {"ram_set/romx", setup_ram, run_ram_set, ADDRESS(0x4100), 4000000},
+    {"ram_set/vram", setup_ram, run_ram_set, ADDRESS(0x8100), 4000000},
+    {"ram_set/sram", setup_ram, run_ram_set, ADDRESS(0xA100), 4000000},
+    {"ram_set/wram", setup_ram, run_ram_set, ADDRESS(0xC100), 4000000},
+    {"ram_set/echo", setup_ram, run_ram_set, ADDRESS(0xE100), 4000000},
+    {"ram_set/oam", setup_ram, run_ram_set, ADDRESS(0xFE10), 4000000},
+    {"ram_set/io", setup_ram, run_ram_set, ADDRESS(0xFF42), 4000000},
+    {"ram_set/hram", setup_ram, run_ram_set, ADDRESS(0xFF90), 4000000},
+
+    {"gpu_render_scanline/bg", setup_gpu, run_gpu, LCDC_VALUE(0x91), 20000},
+    {"gpu_render_scanline/window", setup_gpu, run_gpu, LCDC_VALUE(0xB1), 20000},
+    {"gpu_render_scanline/sprites", setup_gpu, run_gpu, LCDC_VALUE(0x97), 20000},
+
+    {"emulator_update_timers", setup_timers, run_timers, NULL, 4000000},
+    {"oam_dma", setup_ram, run_dma, NULL, 100000},
+    {"emulator_state_hash", setup_ram, run_state_hash, NULL, 20000},
+    {"emulator_state_hash/8_dirty", setup_ram, run_state_hash, &(const int){8}, 20000},
+
+    {"frame/alu", setup_frame, run_frame, &synthetic_roms[0], 30},
+    {"frame/memcpy", setup_frame, run_frame, &synthetic_roms[1], 30},
+    {"frame/sprites", setup_frame, run_frame, &synthetic_roms[2], 30},
+    {"frame/window", setup_frame, run_frame, &synthetic_roms[3], 30},
+};
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  int count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+  const char *filter = argc > 1 ? argv[1] : NULL;
+
+  printf("{\n  \"suite\": \"leekboy-micro\",\n  \"version\": 1,\n");
+  printf("  \"repeats\": %d,\n  \"results\": [", REPEATS);
+
+  int first = 1;
+  for (int b = 0; b < count; b++) {
+    const Benchmark *benchmark = &benchmarks[b];
+    if (filter && strstr(benchmark->name, filter) == NULL)
+      continue;
+
+    double times[REPEATS];
+    for (int r = 0; r < REPEATS; r++) {
+      benchmark->setup(benchmark->arg);
+
+      uint64_t start = limiter_now();
+      benchmark->run(benchmark->arg, benchmark->iterations);
+      times[r] = (double)(limiter_now() - start) / benchmark->iterations;
+    }
+
+    qsort(times, REPEATS, sizeof(double), compare_double);
+
+    printf("%s\n    {\"name\": \"%s\", \"iterations\": %d, \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f}",
+           first ? "" : ",", benchmark->name, benchmark->iterations,
+           times[REPEATS / 2], times[0]);
+    first = 0;
+  }
+
+  printf("\n  ]\n}\n");
+  return 0;
+}
@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+#include "roms.h"
+
+/** writes every synthetic ROM as <dir>/<name>.gb */
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s directory\n", argv[0]);
+    return 1;
+  }
+
+  uint8_t rom[SYNTHETIC_ROM_SIZE];
+
+  for (int i = 0; i < synthetic_rom_count; i++) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.gb", argv[1], synthetic_roms[i].name);
+
+    synthetic_rom_build(&synthetic_roms[i], rom);
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+      perror(path);
+      return 1;
+    }
+
+    fwrite(rom, 1, sizeof(rom), f);
+    fclose(f);
+    printf("%s\n", path);
+  }
+
+  return 0;
+}
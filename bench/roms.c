@@ -0,0 +1,167 @@
+#include <string.h>
+
+#include "roms.h"
+
+#define ENTRY 0x150
+
+#define EMIT(rom, address, ...)                                                \
+  do {                                                                         \
+    const uint8_t bytes[] = {__VA_ARGS__};                                     \
+    memcpy((rom) + (address), bytes, sizeof(bytes));                           \
+  } while (0)
+
+/** ALU and register ops in a tight loop */
+static void rom_alu(uint8_t *rom) {
+  EMIT(rom, ENTRY,
+       0x3E, 0x01,       // 0150 LD A, 1
+       0x06, 0x03,       // 0152 LD B, 3
+       0x80,             // 0154 ADD A, B
+       0x88,             // 0155 ADC A, B
+       0x90,             // 0156 SUB B
+       0xA0,             // 0157 AND B
+       0xB0,             // 0158 OR B
+       0xA8,             // 0159 XOR B
+       0xB8,             // 015A CP B
+       0x3C,             // 015B INC A
+       0x05,             // 015C DEC B
+       0xCB, 0x37,       // 015D SWAP A
+       0x18, 0xF3);      // 015F JR 0154
+}
+
+/** fills 4K of WRAM and copies it over the other 4K, forever */
+static void rom_memcpy(uint8_t *rom) {
+  EMIT(rom, ENTRY,
+       0x1C,             // 0150 INC E
+       0x21, 0x00, 0xC0, // 0151 LD HL, C000
+       0x01, 0x00, 0x10, // 0154 LD BC, 1000
+       0x7B,             // 0157 LD A, E
+       0x22,             // 0158 LD (HL+), A
+       0x0B,             // 0159 DEC BC
+       0x78,             // 015A LD A, B
+       0xB1,             // 015B OR C
+       0x20, 0xF9,       // 015C JR NZ, 0157
+       0x21, 0x00, 0xC0, // 015E LD HL, C000
+       0x11, 0x00, 0xD0, // 0161 LD DE, D000
+       0x01, 0x00, 0x10, // 0164 LD BC, 1000
+       0x2A,             // 0167 LD A, (HL+)
+       0x12,             // 0168 LD (DE), A
+       0x13,             // 0169 INC DE
+       0x0B,             // 016A DEC BC
+       0x78,             // 016B LD A, B
+       0xB1,             // 016C OR C
+       0x20, 0xF8,       // 016D JR NZ, 0167
+       0x18, 0xDF);      // 016F JR 0150
+}
+
+/** 40 sprites spread over the screen, OAM DMA on every vblank */
+static void rom_sprites(uint8_t *rom) {
+  EMIT(rom, 0x0040,
+       0xC3, 0x00, 0x02); // 0040 JP 0200
+
+  EMIT(rom, 0x0200,
+       0x3E, 0xC1,       // 0200 LD A, C1
+       0xE0, 0x46,       // 0202 LDH (46), A
+       0xD9);            // 0204 RETI
+
+  EMIT(rom, ENTRY,
+       0x31, 0xFE, 0xFF, // 0150 LD SP, FFFE
+       0x21, 0x00, 0x80, // 0153 LD HL, 8000
+       0x01, 0x00, 0x10, // 0156 LD BC, 1000
+       0x3E, 0x5A,       // 0159 LD A, 5A
+       0x22,             // 015B LD (HL+), A
+       0x0B,             // 015C DEC BC
+       0x78,             // 015D LD A, B
+       0xB1,             // 015E OR C
+       0x20, 0xF8,       // 015F JR NZ, 0159
+       0x21, 0x00, 0xC1, // 0161 LD HL, C100
+       0x06, 0x28,       // 0164 LD B, 40
+       0x0E, 0x10,       // 0166 LD C, 16
+       0x16, 0x08,       // 0168 LD D, 8
+       0x71,             // 016A LD (HL), C
+       0x23,             // 016B INC HL
+       0x72,             // 016C LD (HL), D
+       0x23,             // 016D INC HL
+       0x78,             // 016E LD A, B
+       0x22,             // 016F LD (HL+), A
+       0xAF,             // 0170 XOR A
+       0x22,             // 0171 LD (HL+), A
+       0x0C, 0x0C, 0x0C, // 0172 INC C x3
+       0x14, 0x14, 0x14, // 0175 INC D x4
+       0x14,
+       0x05,             // 0179 DEC B
+       0x20, 0xEE,       // 017A JR NZ, 016A
+       0x3E, 0xE4,       // 017C LD A, E4
+       0xE0, 0x47,       // 017E LDH (47), A
+       0xE0, 0x48,       // 0180 LDH (48), A
+       0xE0, 0x49,       // 0182 LDH (49), A
+       0x3E, 0x93,       // 0184 LD A, 93
+       0xE0, 0x40,       // 0186 LDH (40), A
+       0x3E, 0x01,       // 0188 LD A, 1
+       0xE0, 0xFF,       // 018A LDH (FF), A
+       0xFB,             // 018C EI
+       0x76,             // 018D HALT
+       0x18, 0xFD);      // 018E JR 018D
+}
+
+/** full-screen window from the 9C00 map over the background, CPU halted */
+static void rom_window(uint8_t *rom) {
+  EMIT(rom, ENTRY,
+       0xAF,             // 0150 XOR A
+       0xE0, 0x40,       // 0151 LDH (40), A
+       0x21, 0x00, 0x80, // 0153 LD HL, 8000
+       0x01, 0x00, 0x10, // 0156 LD BC, 1000
+       0x7D,             // 0159 LD A, L
+       0x22,             // 015A LD (HL+), A
+       0x0B,             // 015B DEC BC
+       0x78,             // 015C LD A, B
+       0xB1,             // 015D OR C
+       0x20, 0xF9,       // 015E JR NZ, 0159
+       0x21, 0x00, 0x9C, // 0160 LD HL, 9C00
+       0x01, 0x00, 0x04, // 0163 LD BC, 0400
+       0x7D,             // 0166 LD A, L
+       0x22,             // 0167 LD (HL+), A
+       0x0B,             // 0168 DEC BC
+       0x78,             // 0169 LD A, B
+       0xB1,             // 016A OR C
+       0x20, 0xF9,       // 016B JR NZ, 0166
+       0x3E, 0xE4,       // 016D LD A, E4
+       0xE0, 0x47,       // 016F LDH (47), A
+       0xAF,             // 0171 XOR A
+       0xE0, 0x4A,       // 0172 LDH (4A), A
+       0x3E, 0x07,       // 0174 LD A, 7
+       0xE0, 0x4B,       // 0176 LDH (4B), A
+       0x3E, 0xF1,       // 0178 LD A, F1
+       0xE0, 0x40,       // 017A LDH (40), A
+       0x76,             // 017C HALT
+       0x18, 0xFD);      // 017D JR 017C
+}
+
+const SyntheticRom synthetic_roms[] = {
+    {"alu", rom_alu},
+    {"memcpy", rom_memcpy},
+    {"sprites", rom_sprites},
+    {"window", rom_window},
+};
+
+const int synthetic_rom_count = sizeof(synthetic_roms) / sizeof(synthetic_roms[0]);
+
+void synthetic_rom_build(const SyntheticRom *synthetic, uint8_t *rom) {
+  memset(rom, 0, SYNTHETIC_ROM_SIZE);
+
+  // entry point: NOP; JP 0150
+  EMIT(rom, 0x100, 0x00, 0xC3, 0x50, 0x01);
+
+  // title, ROM only, 32K, no RAM
+  strncpy((char *)rom + 0x134, synthetic->name, 15);
+  rom[0x147] = 0x00;
+  rom[0x148] = 0x00;
+  rom[0x149] = 0x00;
+
+  synthetic->build(rom);
+
+  uint8_t checksum = 0;
+  for (int i = 0x134; i <= 0x14C; i++) {
+    checksum = checksum - rom[i] - 1;
+  }
+  rom[0x14D] = checksum;
+}
@@ -0,0 +1,25 @@
+#ifndef __ROMS_H__
+#define __ROMS_H__
+
+#include <stdint.h>
+
+#define SYNTHETIC_ROM_SIZE 0x8000
+
+/**
+ * Synthetic ROMs
+ *
+ * Small hand-assembled programs that exercise one part of the emulator
+ * each, so benchmarks don't depend on commercial ROMs. They only run on
+ * this emulator: the header has no boot logo.
+ */
+typedef struct {
+  const char *name;
+  void (*build)(uint8_t *rom);
+} SyntheticRom;
+
+extern const SyntheticRom synthetic_roms[];
+extern const int synthetic_rom_count;
+
+void synthetic_rom_build(const SyntheticRom *synthetic, uint8_t *rom);
+
+#endif // __ROMS_H__
@@ -0,0 +1,108 @@
+#ifndef __APU_H__
+#define __APU_H__
+
+#include <stdint.h>
+
+#include "ring.h"
+
+#define NR10 0xFF10
+#define NR14 0xFF14
+#define NR24 0xFF19
+#define NR34 0xFF1E
+#define NR44 0xFF23
+#define NR50 0xFF24
+#define NR51 0xFF25
+#define NR52 0xFF26
+#define WAVE_RAM 0xFF30
+#define APU_LAST 0xFF3F
+
+#define APU_SAMPLE_RATE 48000
+// cycles per frame sequencer step, 512Hz
+#define APU_SEQUENCER_CYCLES 8192
+
+// band-limited step: taps per step, sub-sample phases
+#define SYNTH_TAPS 16
+#define SYNTH_PHASES 32
+// samples a batch can produce, a frame is about 804
+#define SYNTH_BUFFER 1024
+// rate control skews the output rate by at most 1/100, 1%: a display paced
+// frame rate up to 0.5% off plus the sound card's own drift
+#define SYNTH_MAX_SKEW 100
+
+/**
+ * Audio processing unit
+ *
+ * Two square channels (the first with sweep), the wave channel and the
+ * noise channel, with lengths, envelopes and the frame sequencer. The CPU
+ * only adds to `pending` as it runs. apu_sync catches up on a register
+ * write, a read of NR52 and at the end of each run of the emulator, so
+ * channels are stepped in batches, from one change to the next, rather than
+ * every instruction.
+ *
+ * Samples are only made with a synth attached (`synth`). It places every
+ * change of a channel's level as a band-limited step at its exact cycle,
+ * resampling 4MHz to 48kHz, and hands whole samples to an AudioRing, or
+ * drops them when the ring is NULL (the null sink, for headless runs).
+ * What the synth alone needs (waveform positions, the noise LFSR) is not
+ * part of save states, since the CPU can never see it.
+ *
+ * The emulator runs on the host's clock, or the display's, and the ring is
+ * drained on the sound card's, and they never quite agree. With a `target`
+ * set, apu_synth_steer, called after each frame, nudges the output rate by
+ * up to 1% in proportion to how far the ring is from holding `target`
+ * frames. The latency stays put without dropped or repeated frames; on a
+ * 60Hz display the pitch ends up about 0.5% (8 cents) low.
+ */
+typedef struct {
+  uint8_t enabled; // NR52 status bit
+  uint16_t length; // counts down while length is enabled
+  uint8_t volume;
+  uint8_t envelope_timer;
+  uint16_t frequency;
+
+  // sweep, first square channel only
+  uint8_t sweep_enabled;
+  uint8_t sweep_timer;
+  uint16_t sweep_shadow;
+
+  // waveform, only stepped for the synth
+  int timer; // cycles until the next step
+  uint8_t position;
+  uint16_t lfsr;
+  int8_t level; // last level handed to the synth
+} APUChannel;
+
+typedef struct APUSynth {
+  // level differences per sample, integrated on the way out
+  int32_t buffer[2][SYNTH_BUFFER + SYNTH_TAPS];
+  int32_t sum[2];
+  uint64_t factor; // samples per cycle, 32.32 fixed point
+  uint64_t offset; // sample position of the batch start, 32.32
+  uint64_t rate;   // the factor at exactly APU_SAMPLE_RATE
+
+  AudioRing *ring; // NULL drops the samples
+  uint32_t target; // ring frames to hold after a frame, 0 for a fixed rate
+  uint64_t samples;
+} APUSynth;
+
+typedef struct APU {
+  uint8_t *io; // the register file, ram->io
+  APUChannel channels[4];
+
+  uint8_t sequencer_step;
+  uint16_t sequencer_timer; // cycles to the next step
+
+  int pending; // run by the CPU since the last sync
+  int time;    // cycles into the synth's current batch
+
+  APUSynth *synth;
+} APU;
+
+void apu_init(APU *apu, uint8_t *io);
+void apu_sync(APU *apu);
+void apu_write(APU *apu, uint16_t address, uint8_t value);
+
+void apu_synth_init(APUSynth *synth, AudioRing *ring);
+void apu_synth_steer(APUSynth *synth);
+
+#endif // __APU_H__
@@ -0,0 +1,62 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "emulator.h"
+
+/**
+ * Batch runner
+ *
+ * Hosts many emulators sharing one read-only ROM image and steps them all
+ * in lockstep on a pool of threads. Each thread starts on its own slice of
+ * instances and steals single instances from the others once its slice is
+ * done. Instances and slice cursors are cache line aligned, so threads
+ * never write to the same line.
+ */
+#define BATCH_CACHE_LINE 64
+
+typedef struct {
+  Emulator emulator;
+  // cycles run past the last cycle budget
+  int overshoot;
+} __attribute__((aligned(BATCH_CACHE_LINE))) BatchInstance;
+
+typedef struct {
+  uint32_t next; // claimed with an atomic add
+  uint32_t end;
+} __attribute__((aligned(BATCH_CACHE_LINE))) BatchSlice;
+
+typedef struct Batch {
+  BatchInstance *instances;
+  int count;
+
+  int threads;
+  pthread_t *workers;
+  BatchSlice *slices;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  uint64_t generation;
+  int busy;
+  int quit;
+
+  // current round: whole frames, or a cycle budget when frames is 0
+  int frames;
+  int cycles;
+} Batch;
+
+int batch_init(Batch *batch, const uint8_t *image, size_t size, int count, int threads);
+void batch_free(Batch *batch);
+
+static inline Emulator *batch_emulator(Batch *batch, int index) {
+  return &batch->instances[index].emulator;
+}
+
+// both return how many instances have a CPU error
+int batch_run_frames(Batch *batch, int frames);
+int batch_run_cycles(Batch *batch, int cycles);
+
+#endif // __BATCH_H__
@@ -0,0 +1,61 @@
+#ifndef __CHEATS_H__
+#define __CHEATS_H__
+
+#include <stdint.h>
+
+#include "ram.h"
+
+#define CHEATS_MAX 64
+#define CHEATS_MAX_BANKS (0x200000 / 0x4000)
+
+/**
+ * Cheat codes
+ *
+ * Game Genie codes (ABC-DEF or ABC-DEF-GHI) patch a ROM byte, and the 9
+ * digit form only does so where the original byte matches the compare byte.
+ * Patched banks are private 16KB copies, mapped in place of the shared
+ * image by ram_map_banks, so reading ROM stays a plain load. A code for
+ * 4000-7FFF applies to every bank from 1 up, but a bank is only copied the
+ * first time it is mapped in, and only when a code actually changes it.
+ *
+ * GameShark codes (ttvvaaaa, address low byte first) write a byte to RAM
+ * once per VBlank. A type of 80-87 selects a cartridge RAM bank.
+ *
+ * Attached to an emulator through ram->cheats by cheats_add.
+ */
+typedef enum {
+  CHEAT_GAME_GENIE,
+  CHEAT_GAMESHARK,
+} CheatType;
+
+typedef struct {
+  CheatType type;
+  uint16_t address;
+  uint8_t value;
+  uint8_t compare;
+  uint8_t has_compare;
+  uint8_t bank; // GameShark type byte
+} Cheat;
+
+typedef struct Cheats {
+  Cheat cheats[CHEATS_MAX];
+  int count;
+
+  // patched copies of the ROM banks once `checked`, NULL where the image is untouched
+  uint8_t *banks[CHEATS_MAX_BANKS];
+  uint8_t checked[CHEATS_MAX_BANKS];
+  // a bank mapped in since the last change of codes could not be copied
+  int failed;
+} Cheats;
+
+int cheats_parse(Cheat *cheat, const char *code);
+
+const uint8_t *cheats_bank(Cheats *cheats, RAM *ram, uint32_t bank);
+
+int cheats_add(Cheats *cheats, RAM *ram, const char *code);
+int cheats_remove(Cheats *cheats, RAM *ram, const char *code);
+void cheats_clear(Cheats *cheats, RAM *ram);
+
+void cheats_apply(Cheats *cheats, RAM *ram);
+
+#endif // __CHEATS_H__
@@ -0,0 +1,74 @@
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Hot path counters
+ *
+ * Built with -DLEEKBOY_COUNTERS (make COUNTERS=1), each emulator instance
+ * keeps a Counters block in its RAM and COUNT() is a plain increment on it.
+ * Otherwise the block does not exist and COUNT() expands to nothing.
+ */
+typedef enum {
+  REGION_ROM0,
+  REGION_ROMX,
+  REGION_VRAM,
+  REGION_SRAM,
+  REGION_WRAM,
+  REGION_ECHO,
+  REGION_OAM,
+  REGION_IO,
+  REGION_HRAM,
+  REGION_COUNT,
+} Region;
+
+// interrupt sources, in IF bit order
+#define COUNTER_INTERRUPTS 5
+
+typedef struct {
+  uint64_t reads[REGION_COUNT];
+  uint64_t writes[REGION_COUNT];
+  uint64_t bank_switches;
+  uint64_t dma_transfers;
+  uint64_t interrupts_raised[COUNTER_INTERRUPTS];
+  uint64_t interrupts_serviced[COUNTER_INTERRUPTS];
+  uint64_t halt_cycles;
+  uint64_t mode_changes[4]; // by the mode entered
+  uint64_t scanlines;
+} Counters;
+
+#ifdef LEEKBOY_COUNTERS
+#define COUNT(ram, field) ((ram)->counters.field++)
+#define COUNT_ADD(ram, field, n) ((ram)->counters.field += (n))
+#define COUNT_INTERRUPTS(ram, field, mask) counters_interrupts((ram)->counters.field, (mask))
+#else
+#define COUNT(ram, field) ((void)0)
+#define COUNT_ADD(ram, field, n) ((void)0)
+#define COUNT_INTERRUPTS(ram, field, mask) ((void)0)
+#endif
+
+static inline Region counters_region(uint16_t address) {
+  if (address < 0x4000) return REGION_ROM0;
+  if (address < 0x8000) return REGION_ROMX;
+  if (address < 0xA000) return REGION_VRAM;
+  if (address < 0xC000) return REGION_SRAM;
+  if (address < 0xE000) return REGION_WRAM;
+  if (address < 0xFE00) return REGION_ECHO;
+  if (address < 0xFF00) return REGION_OAM;
+  if (address < 0xFF80 || address == 0xFFFF) return REGION_IO;
+  return REGION_HRAM;
+}
+
+static inline void counters_interrupts(uint64_t *counts, uint8_t mask) {
+  for (int i = 0; i < COUNTER_INTERRUPTS; i++) {
+    counts[i] += (mask >> i) & 1;
+  }
+}
+
+void counters_write_csv_header(FILE *file);
+void counters_write_csv(const Counters *counters, uint64_t frame, FILE *file);
+void counters_write_json(const Counters *counters, uint64_t frame, FILE *file);
+
+#endif // __COUNTERS_H__
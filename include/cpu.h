@@ -18,6 +18,15 @@
 #define MEM_TMA 0xFF06
 #define MEM_TAC 0xFF07
 
+struct Trace;
+struct Profiler;
+struct Debugger;
+
+typedef enum {
+  CPU_OK,
+  CPU_UNKNOWN_OPCODE,
+} CPUError;
+
 typedef struct {
   RAM *ram;
 
@@ -60,10 +69,27 @@ typedef struct {
 
   int cycles;
   uint8_t halted;
+
+  // an unknown opcode locks the CPU up until reset, as on hardware
+  CPUError error;
+  uint16_t error_pc;
+  uint8_t error_opcode;
+
+  // binary instruction trace, off when NULL
+  struct Trace *trace;
+  // guest profiler, off when NULL
+  struct Profiler *profiler;
+  // breakpoints and watchpoints, see debugger.h
+  struct Debugger *debugger;
 } CPU;
 
 void cpu_init(CPU *cpu, RAM *ram);
-int cpu_step(CPU *cpu);
+// one instruction, or a fast path block of at most `budget` cycles
+int cpu_step(CPU *cpu, int budget);
+// cpu_step without fast paths, the reference they must agree with
+int cpu_step_reference(CPU *cpu);
+// cpu_step_reference reporting to cpu->debugger, 0 cycles when it stops
+int cpu_step_debug(CPU *cpu);
 void cpu_interrupt(CPU *cpu, uint8_t interrupt);
 
 extern void cpu_memory_set(CPU *cpu, uint16_t address, uint8_t value);
@@ -0,0 +1,102 @@
+#ifndef __DEBUGGER_H__
+#define __DEBUGGER_H__
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define DEBUGGER_MAX_CONDITIONS 32
+#define DEBUGGER_MAX_WATCHPOINTS 32
+
+// watchpoint access, either or both
+#define DEBUGGER_READ 0x01
+#define DEBUGGER_WRITE 0x02
+
+/**
+ * Debugger
+ *
+ * PC breakpoints live in a 64K-bit bitmap, optionally with a condition
+ * checked when the PC gets there. Watchpoints cover any address range, IO
+ * included, for reads, writes or both. Attached with cpu->debugger, it only
+ * costs anything while armed: the emulator then runs cpu_step_debug, the
+ * interpreter with every data access checked against a per-address table.
+ * Instruction fetches and operands are not data accesses. With nothing
+ * armed, the emulator keeps running cpu_step.
+ *
+ * Breakpoints stop before the instruction runs, watchpoints and steps after
+ * it. A stopped debugger holds the emulator (it runs 0 cycles) until
+ * debugger_continue, debugger_step or debugger_step_over.
+ */
+typedef int (*DebuggerCondition)(CPU *cpu, void *data);
+
+typedef enum {
+  DEBUGGER_RUNNING,
+  DEBUGGER_BREAKPOINT,
+  DEBUGGER_WATCHPOINT,
+  DEBUGGER_STEPPED,
+} DebuggerStop;
+
+typedef enum {
+  DEBUGGER_CONTINUE,
+  DEBUGGER_STEP,
+  DEBUGGER_STEP_OVER,
+} DebuggerMode;
+
+typedef struct {
+  uint16_t address;
+  DebuggerCondition condition;
+  void *data;
+} DebuggerBreakpoint;
+
+typedef struct {
+  uint16_t start;
+  uint16_t end; // inclusive
+  uint8_t access;
+} DebuggerWatchpoint;
+
+typedef struct Debugger {
+  // a bit per PC, in `conditional` when it has conditions instead
+  uint64_t breakpoints[0x10000 / 64];
+  uint64_t conditional[0x10000 / 64];
+  int breakpoint_count;
+
+  DebuggerBreakpoint conditions[DEBUGGER_MAX_CONDITIONS];
+  int condition_count;
+
+  // DEBUGGER_READ/WRITE per address, built from the ranges
+  uint8_t watched[0x10000];
+  DebuggerWatchpoint watchpoints[DEBUGGER_MAX_WATCHPOINTS];
+  int watchpoint_count;
+
+  DebuggerMode mode;
+  uint8_t resuming; // the first instruction after resuming ignores breakpoints
+  uint16_t return_pc, return_sp; // where a step over ends
+
+  // why it stopped: the instruction, and the access for a watchpoint
+  DebuggerStop stop;
+  uint16_t pc;
+  uint16_t address;
+  uint8_t value;
+  uint8_t access;
+} Debugger;
+
+void debugger_init(Debugger *debugger);
+int debugger_armed(Debugger *debugger);
+
+void debugger_break(Debugger *debugger, uint16_t address);
+int debugger_break_if(Debugger *debugger, uint16_t address, DebuggerCondition condition,
+                      void *data);
+void debugger_clear_break(Debugger *debugger, uint16_t address);
+
+int debugger_watch(Debugger *debugger, uint16_t start, uint16_t end, uint8_t access);
+void debugger_unwatch(Debugger *debugger, uint16_t start, uint16_t end);
+
+void debugger_continue(Debugger *debugger);
+void debugger_step(Debugger *debugger);
+void debugger_step_over(Debugger *debugger, CPU *cpu);
+
+// called by cpu_step_debug
+int debugger_check(Debugger *debugger, CPU *cpu);
+void debugger_hit(Debugger *debugger, uint16_t address, uint8_t value, uint8_t access);
+
+#endif // __DEBUGGER_H__
@@ -1,29 +1,81 @@
 #ifndef __EMULATOR_H__
 #define __EMULATOR_H__
 
+#include "apu.h"
 #include "cpu.h"
 #include "gpu.h"
 #include "ram.h"
+#include "serial.h"
+
+#include <stddef.h>
 
 #define CLOCKSPEED 4194304
+#define FRAME_CYCLES 70224
 
 
 typedef struct {
   CPU cpu;
   GPU gpu;
   RAM ram;
+  APU apu;
+  Serial serial;
 
   Input input;
-  uint8_t rom[0x200000];
+
+  // read-only image, shared between instances (see emulator_rom_image)
+  const uint8_t *rom;
+  size_t rom_size;
+  // set when emulator_init loaded the image itself
+  uint8_t *rom_owned;
 
   // timer
   int div;
   int tima;
+
+  // totals since power on
+  uint64_t cycles;
+  uint64_t instructions;
+
+  // run cpu_step_reference instead of cpu_step
+  uint8_t reference_core;
 } Emulator;
 
-void emulator_init(Emulator *emulator, char *filename);
-void emulator_step(Emulator *emulator);
+/**
+ * Save states
+ *
+ * Compact little-endian binary format holding only mutable state: CPU
+ * registers, mapper registers, VRAM, WRAM, OAM, IO, HRAM, IE, cartridge RAM
+ * (sized from the header, often none), GPU and timer counters, the total
+ * cycle count, the APU's counters and the serial transfer. The ROM and framebuffer are
+ * not saved, so a frame must run before the screen reflects a loaded state.
+ *
+ * Layout: "LKBS", u16 version, u16 reserved, u32 total size, then fields.
+ * Bump STATE_VERSION whenever the layout changes.
+ */
+#define STATE_MAGIC "LKBS"
+#define STATE_VERSION 5
+// about 16.5KB of memory plus at most 32KB of cartridge RAM
+#define STATE_MAX_SIZE 0xC400
+
+int emulator_init(Emulator *emulator, char *filename);
+int emulator_init_rom(Emulator *emulator, const uint8_t *image, size_t size);
+void emulator_free(Emulator *emulator);
+
+uint8_t *emulator_rom_image(const uint8_t *data, size_t size, size_t *image_size);
+uint8_t *emulator_rom_load(const char *filename, size_t *image_size);
+
+int emulator_step(Emulator *emulator);
+int emulator_run_cycles(Emulator *emulator, int budget);
+int emulator_run_instruction(Emulator *emulator);
 void emulator_update_timers(Emulator *emulator, int cycles);
+void emulator_set_input(Emulator *emulator, uint8_t mask);
+
+void emulator_run_ahead(Emulator *emulator, uint8_t *state, int frames);
+
+size_t emulator_state_size(Emulator *emulator);
+size_t emulator_save_state(Emulator *emulator, uint8_t *buffer);
+int emulator_load_state(Emulator *emulator, const uint8_t *buffer, size_t size);
+uint64_t emulator_state_hash(Emulator *emulator);
 
 #endif // __EMULATOR_H__
 
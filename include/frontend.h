@@ -2,11 +2,81 @@
 #define __FRONTEND_H__
 
 #include <stdint.h>
+#include "apu.h"
 #include "emulator.h"
+#include "limiter.h"
+#include "movie.h"
+#include "rewind.h"
+#include "ring.h"
+#include "trace.h"
+#include "viewer.h"
+
+#define FRAME_PIXELS (160 * 144)
+
+/**
+ * Lock-free triple buffer between the emulation thread (producer) and the
+ * presentation thread (consumer). Each side owns one slot, the third is the
+ * shared "middle" slot. `state` holds the middle slot index plus a fresh bit
+ * and is only ever swapped atomically. A slot also carries the video memory
+ * of its frame while the debug viewers are open.
+ */
+typedef struct {
+  uint32_t frames[3][FRAME_PIXELS];
+  ViewerMemory memory[3];
+  int state;
+  int back;
+  int front;
+} TripleBuffer;
 
 typedef struct {
+  void *window;
   void *renderer;
   void *texture;
+
+  // F2 toggles the debug viewers, created on first use
+  void *viewer_window;
+  void *viewer_renderer;
+  void *viewer_texture;
+
+  // sound, 0 when no device could be opened; the synth writes the ring
+  // on the emulation thread and the device callback drains it
+  uint32_t audio;
+  AudioRing audio_ring;
+  APUSynth synth;
+
+  Emulator *emulator;
+  TripleBuffer buffer;
+  Limiter limiter;
+
+  // emulation follows vsync instead of the limiter while set: the display
+  // thread posts the `vsync` semaphore after every present
+  int display_synced;
+  void *vsync;
+  uint64_t sync_start;
+  int sync_frames;
+
+  // print frame timing once a second
+  int stats;
+
+  // frames to emulate ahead of the displayed one
+  int run_ahead;
+  uint8_t state[STATE_MAX_SIZE];
+
+  // rewinds while the rewind key is held, if rewind.arena is set up
+  Rewind rewind;
+
+  // F1 toggles instruction tracing, if trace.header is set up
+  Trace trace;
+
+  // records the session when set
+  Movie *movie;
+
+  // shared between threads, accessed atomically
+  int input;
+  int running;
+  int rewinding;
+  int tracing;
+  int viewing;
 } Frontend;
 
 void frontend_init(Frontend *frontend);
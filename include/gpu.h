@@ -77,18 +77,50 @@ typedef enum {
   MODE_VRAM   = 3
 } Mode;
 
+typedef enum {
+  OUTPUT_INDEX, // one byte per pixel, shade 0-3 as in the framebuffer
+  OUTPUT_GRAY,  // one byte per pixel, 0xFF white to 0x00 black
+  OUTPUT_RGBA,  // four bytes per pixel, R G B 0xFF
+} OutputFormat;
+
+/**
+ * A caller-owned buffer the GPU writes each scanline into as soon as it is
+ * drawn, already cropped, scaled and in the caller's format, so observations
+ * need no per-frame copy or conversion pass.
+ */
+typedef struct {
+  uint8_t *buffer; // NULL to only draw into the framebuffer
+  OutputFormat format;
+  uint8_t scale;   // 1, or 2 to average each 2x2 block into one pixel
+  // crop rectangle in screen pixels, even sized when scaling
+  uint8_t x, y, width, height;
+  uint32_t stride; // bytes from one output row to the next
+} Output;
+
 typedef struct {
   RAM *ram;
   CPU *cpu;
   Mode mode;
 
-  int framebuffer[160 * 144];
+  // shades 0-3, lightest first, see gpu_colors
+  uint8_t framebuffer[160 * 144];
   int cycles;
   int scanline;
+
+  Output output;
+  // even row shade sums of each 2x2 block, while scaling
+  uint8_t pending[80];
 } GPU;
 
+// 0xRRGGBB for each shade
+extern const int gpu_colors[4];
+
 void gpu_init(GPU *gpu, CPU *cpu, RAM *ram);
 void gpu_step(GPU *gpu, int cycles);
 void gpu_render_scanline(GPU *gpu);
 
+// a zero stride means rows are packed; -1 if the output is invalid
+int gpu_set_output(GPU *gpu, const Output *output);
+size_t gpu_output_size(const Output *output);
+
 #endif // __GPU_H__
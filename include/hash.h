@@ -0,0 +1,15 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * XXH64: four independent multiply-rotate lanes over 32-byte stripes, so
+ * the compiler keeps them in registers and the CPU overlaps them, several
+ * GB/s on any 64-bit host. Reads are little-endian, so hashes compare
+ * across builds and machines. Not cryptographic.
+ */
+uint64_t hash64(const void *data, size_t size, uint64_t seed);
+
+#endif // __HASH_H__
@@ -0,0 +1,29 @@
+#ifndef __IDIOM_H__
+#define __IDIOM_H__
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/**
+ * Idiom recognition
+ *
+ * Copy and fill loops in ROM are matched by their exact bytes when cpu_step
+ * is about to run their first instruction, and run as one host copy or fill
+ * of up to IDIOM_MAX_BYTES, cut to the whole iterations that fit in the
+ * caller's cycle budget. Registers, flags, memory and the cycles charged
+ * come out exactly as if the loop had run that many times, one instruction
+ * at a time, and a budgeted run stops at the same instruction it would
+ * have stopped at without idioms. Loops run this way only when nothing can observe the middle:
+ * both ranges are plain memory (VRAM and OAM only with the LCD off) and no
+ * interrupt can be taken, i.e. IME or IE is clear.
+ */
+#define IDIOM_MAX_BYTES 256
+
+// the opcodes a recognised loop can start with
+extern const uint8_t idiom_starts[256];
+
+// cycles run, at most `budget`, 0 if there is no idiom at PC or not one whole iteration fits
+int idiom_run(CPU *cpu, uint8_t opcode, int budget);
+
+#endif // __IDIOM_H__
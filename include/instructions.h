@@ -10,7 +10,7 @@ typedef struct {
   uint8_t cycles;
 } Instruction;
 
-extern Instruction instructions[256];
-extern Instruction prefixed[256];
+extern const Instruction instructions[256];
+extern const Instruction prefixed[256];
 
 #endif // __INSTRUCTIONS_H__
@@ -0,0 +1,132 @@
+#ifndef __LEEKBOY_H__
+#define __LEEKBOY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Embedding API (lib/libleekboy.so)
+ *
+ * Each LeekBoy is an independent, heap-allocated emulator behind an opaque
+ * handle. There is no global mutable state, so any number of instances can
+ * run in one process, each driven by one thread at a time. Nothing here
+ * prints or exits; failures come back as LB_ERROR_* codes.
+ */
+#define LB_API __attribute__((visibility("default")))
+
+#define LB_WIDTH 160
+#define LB_HEIGHT 144
+#define LB_FRAME_CYCLES 70224
+
+// lb_set_input mask bits
+#define LB_BUTTON_RIGHT  0x01
+#define LB_BUTTON_LEFT   0x02
+#define LB_BUTTON_UP     0x04
+#define LB_BUTTON_DOWN   0x08
+#define LB_BUTTON_A      0x10
+#define LB_BUTTON_B      0x20
+#define LB_BUTTON_SELECT 0x40
+#define LB_BUTTON_START  0x80
+
+typedef enum {
+  LB_OK = 0,
+  LB_ERROR_MEMORY = -1,
+  LB_ERROR_ROM = -2,
+  LB_ERROR_OPCODE = -3, // the guest ran an unknown opcode, the CPU is locked
+  LB_ERROR_STATE = -4,
+  LB_ERROR_ARGUMENT = -5,
+  LB_STOPPED = 1, // not an error: the debugger stopped the run, see lb_stopped
+} LBError;
+
+// lb_set_output formats
+#define LB_FORMAT_INDEX 0 // uint8 shade, 0 white to 3 black
+#define LB_FORMAT_GRAY  1 // uint8 luminance, 255 white to 0 black
+#define LB_FORMAT_RGBA  2 // 4 x uint8 per pixel
+
+typedef struct LeekBoy LeekBoy;
+
+// NULL when the ROM is not a valid image (LB_ERROR_ROM) or memory runs out
+// (LB_ERROR_MEMORY), with the reason in `error` unless that is NULL
+LB_API LeekBoy *lb_create(const uint8_t *rom, size_t size, int *error);
+LB_API void lb_destroy(LeekBoy *lb);
+
+LB_API int lb_run_frames(LeekBoy *lb, int frames);
+// runs exactly `cycles` on average: overshoot is taken out of the next call
+LB_API int lb_run_cycles(LeekBoy *lb, long cycles);
+
+LB_API void lb_set_input(LeekBoy *lb, uint8_t mask);
+// LB_WIDTH * LB_HEIGHT pixels, 0x00RRGGBB
+LB_API const uint32_t *lb_framebuffer(LeekBoy *lb);
+LB_API uint64_t lb_cycles(LeekBoy *lb);
+
+/**
+ * Has the emulator draw every scanline straight into `buffer` (e.g. a NumPy
+ * array), cropped to the width x height rectangle at x, y and optionally
+ * averaged down 2x, in place of converting frames afterwards. `stride` is the
+ * bytes between rows, 0 for packed. A NULL buffer turns the output off.
+ */
+LB_API int lb_set_output(LeekBoy *lb, void *buffer, int format, int scale,
+                         int x, int y, int width, int height, size_t stride);
+// bytes lb_set_output writes to with a packed stride
+LB_API size_t lb_output_size(int format, int scale, int width, int height);
+
+LB_API size_t lb_state_size(LeekBoy *lb);
+// returns the bytes written or an error
+LB_API long lb_save_state(LeekBoy *lb, void *buffer, size_t size);
+LB_API int lb_load_state(LeekBoy *lb, const void *buffer, size_t size);
+
+// hash64 of everything a save state holds, for comparing runs frame by frame
+LB_API uint64_t lb_state_hash(LeekBoy *lb);
+
+/**
+ * Game Genie (ABC-DEF, ABC-DEF-GHI) and GameShark (01VVAAAA) codes, added
+ * and removed while running. LB_ERROR_ARGUMENT for a code that doesn't
+ * parse, one too many or, on removal, one that isn't active, and
+ * LB_ERROR_MEMORY when a patched ROM bank can't be allocated. Other banks
+ * are only copied when first switched in; if that fails, the bank stays
+ * unpatched and runs return LB_ERROR_MEMORY until the codes next change.
+ */
+LB_API int lb_add_cheat(LeekBoy *lb, const char *code);
+LB_API int lb_remove_cheat(LeekBoy *lb, const char *code);
+LB_API void lb_clear_cheats(LeekBoy *lb);
+
+/**
+ * Debugger: PC breakpoints and read/write watchpoints (see debugger.h),
+ * which only slow the emulator down while any are set. Once one hits,
+ * lb_run_frames and lb_run_cycles return LB_STOPPED without running
+ * anything until lb_continue, lb_step or lb_step_over. Breakpoints stop
+ * before the instruction, watchpoints and steps after it.
+ */
+#define LB_STOP_NONE       0
+#define LB_STOP_BREAKPOINT 1
+#define LB_STOP_WATCHPOINT 2
+#define LB_STOP_STEPPED    3
+
+// lb_watch access, either or both
+#define LB_WATCH_READ  0x01
+#define LB_WATCH_WRITE 0x02
+
+typedef struct {
+  int reason;       // LB_STOP_*
+  uint16_t pc;      // the instruction checked last, the one that hit a watchpoint
+  uint16_t address; // for a watchpoint, the access that hit it
+  uint8_t value;
+  uint8_t access;
+} LBStop;
+
+LB_API void lb_break(LeekBoy *lb, uint16_t address);
+LB_API void lb_clear_break(LeekBoy *lb, uint16_t address);
+// `start` to `end` inclusive; LB_ERROR_ARGUMENT for an empty range or too many
+LB_API int lb_watch(LeekBoy *lb, uint16_t start, uint16_t end, int access);
+LB_API void lb_unwatch(LeekBoy *lb, uint16_t start, uint16_t end);
+
+// resume on the next run: freely, for one instruction, or past a CALL/RST
+LB_API void lb_continue(LeekBoy *lb);
+LB_API void lb_step(LeekBoy *lb);
+LB_API void lb_step_over(LeekBoy *lb);
+// why the emulator is stopped, LB_STOP_NONE while it isn't; `stop` may be NULL
+LB_API int lb_stopped(LeekBoy *lb, LBStop *stop);
+
+LB_API const char *lb_error_string(int error);
+
+#endif // __LEEKBOY_H__
@@ -0,0 +1,46 @@
+#ifndef __LIMITER_H__
+#define __LIMITER_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Frame limiter
+ *
+ * Deadlines are absolute and advance by an exact rational period
+ * (cycles / clock seconds), so oversleeping one frame shortens the wait of
+ * the next one instead of accumulating drift. Waits sleep until shortly
+ * before the deadline and spin for the rest; the spin margin adapts to how
+ * much the host oversleeps.
+ */
+typedef struct {
+  // period in ns, plus the fractional part as remainder / clock
+  uint64_t period;
+  uint64_t remainder;
+  uint64_t clock;
+  uint64_t error;
+
+  uint64_t deadline;
+  uint64_t frame_start;
+  uint64_t spin;
+
+  // last frame
+  uint64_t emulation_time;
+  uint64_t wait_time;
+  int64_t jitter;
+
+  // since the last report
+  uint64_t frames;
+  uint64_t emulation_total;
+  uint64_t wait_total;
+  int64_t worst_jitter;
+  uint64_t resyncs;
+} Limiter;
+
+uint64_t limiter_now(void);
+void limiter_init(Limiter *limiter, uint64_t cycles, uint64_t clock);
+void limiter_wait(Limiter *limiter);
+void limiter_follow(Limiter *limiter, uint64_t produced);
+void limiter_report(Limiter *limiter, FILE *file);
+
+#endif // __LIMITER_H__
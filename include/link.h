@@ -0,0 +1,48 @@
+#ifndef __LINK_H__
+#define __LINK_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "emulator.h"
+
+// a quarter of a byte on the internal clock
+#define LINK_WINDOW 1024
+
+/**
+ * Link cable
+ *
+ * Joins the serial ports of two emulators in one process. Both run in
+ * windows of `window` cycles. At each window boundary, both stand at the
+ * same cycle, and transfers that finished during the window swap their
+ * bytes there. A transfer can end up to one window late, but nothing
+ * crosses between the instances mid-window. The outcome is the same
+ * whether both run on one thread (link_run_cycles) or each on its own
+ * (link_run_side), and the threads only meet once per window.
+ */
+typedef struct Link {
+  Emulator *emulators[2];
+  int window;
+
+  // where each side's current window ends, and the cycles it still owes
+  // (whole windows run, so a call can run ahead of what it was asked)
+  uint64_t targets[2];
+  int64_t owed[2];
+
+  // window boundary between threads: the last to arrive swaps
+  pthread_mutex_t lock;
+  pthread_cond_t boundary;
+  uint64_t generation;
+  int arrived;
+} Link;
+
+void link_init(Link *link, Emulator *a, Emulator *b, int window);
+void link_free(Link *link);
+
+// runs both sides for `cycles` on the calling thread
+void link_run_cycles(Link *link, int cycles);
+// runs one side for `cycles`, for a thread per side; both sides must be
+// given the same cycles in total
+void link_run_side(Link *link, int side, int cycles);
+
+#endif // __LINK_H__
@@ -0,0 +1,57 @@
+#ifndef __LOCKSTEP_H__
+#define __LOCKSTEP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "emulator.h"
+
+/**
+ * Lockstep checker
+ *
+ * Runs two instances of one ROM side by side, one on cpu_step and one on
+ * cpu_step_reference. After every step of the fast core (an instruction, or
+ * a whole fast path block) the reference catches up to the same cycle
+ * count. The register files, mapper registers and every address either side
+ * wrote since the last check are then compared. Once a frame the full state
+ * hashes are compared too, and the state becomes the new checkpoint.
+ *
+ * On the first divergence lockstep_reproduce replays both from the
+ * checkpoint up to the step before it, so the reproducer is a save state
+ * one step away from the bug.
+ */
+typedef enum {
+  LOCKSTEP_OK,
+  LOCKSTEP_DIVERGED,
+  LOCKSTEP_ERROR, // both cores hit the same unknown opcode
+} LockstepStatus;
+
+typedef struct {
+  Emulator fast;
+  Emulator reference;
+  RAMWriteLog fast_writes;
+  RAMWriteLog reference_writes;
+
+  // state at the start of the current frame
+  uint8_t checkpoint[STATE_MAX_SIZE];
+  size_t checkpoint_size;
+  uint64_t checkpoint_cycles;
+  uint64_t steps; // fast core steps since the checkpoint
+
+  // the diverging step
+  uint16_t pc;
+  const char *reason;
+} Lockstep;
+
+int lockstep_init(Lockstep *lockstep, const uint8_t *image, size_t size);
+void lockstep_free(Lockstep *lockstep);
+int lockstep_load_state(Lockstep *lockstep, const uint8_t *state, size_t size);
+
+LockstepStatus lockstep_step(Lockstep *lockstep);
+LockstepStatus lockstep_run_frame(Lockstep *lockstep);
+
+void lockstep_report(Lockstep *lockstep, FILE *out);
+size_t lockstep_reproduce(Lockstep *lockstep, uint8_t *state);
+
+#endif // __LOCKSTEP_H__
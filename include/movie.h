@@ -0,0 +1,73 @@
+#ifndef __MOVIE_H__
+#define __MOVIE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "emulator.h"
+
+/**
+ * Input movies
+ *
+ * A movie replays a session from power on: every input change with the
+ * total cycle count it was applied at, and for every frame the cycle count
+ * it ended on and the emulator state hash at that point. Playback applies
+ * each change before the first instruction at or after its cycle, so the
+ * run is identical, and checks the hash at the end of each frame to catch
+ * the first one that drifts.
+ *
+ * File layout, little-endian: "LKBM", u16 version, u16 reserved, u64 hash64
+ * of the ROM image, u32 input count, u32 frame count, then each input as u64
+ * cycle and u8 mask, then each frame as u64 cycle and u64 state hash.
+ */
+#define MOVIE_MAGIC "LKBM"
+#define MOVIE_VERSION 3
+
+typedef enum {
+  MOVIE_OK,
+  MOVIE_END,     // every recorded frame has been played
+  MOVIE_DESYNC,  // the state after `frame` doesn't match the recording
+  MOVIE_ERROR,   // the CPU hit an unknown opcode
+  MOVIE_STOPPED, // an armed debugger stopped the run partway through the frame
+} MovieStatus;
+
+typedef struct {
+  uint64_t cycle;
+  uint8_t mask;
+} MovieInput;
+
+typedef struct {
+  uint64_t cycle;
+  uint64_t hash;
+} MovieFrame;
+
+typedef struct {
+  uint64_t rom_hash;
+
+  MovieInput *inputs;
+  size_t input_count;
+  size_t input_capacity;
+
+  MovieFrame *frames;
+  size_t frame_count;
+  size_t frame_capacity;
+
+  // playback position
+  size_t next_input;
+  size_t frame;
+} Movie;
+
+void movie_init(Movie *movie, Emulator *emulator);
+void movie_free(Movie *movie);
+
+// recording, -1 when out of memory
+int movie_record_input(Movie *movie, Emulator *emulator, uint8_t mask);
+int movie_record_frame(Movie *movie, Emulator *emulator);
+void movie_truncate(Movie *movie, uint64_t cycle);
+int movie_save(Movie *movie, const char *filename);
+
+// playback, -1 with errno set, or EINVAL if it's not a movie for this ROM
+int movie_load(Movie *movie, Emulator *emulator, const char *filename);
+MovieStatus movie_play_frame(Movie *movie, Emulator *emulator);
+
+#endif // __MOVIE_H__
@@ -0,0 +1,77 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cpu.h"
+
+#define PROFILER_MAX_DEPTH 256
+
+/**
+ * Guest profiler
+ *
+ * While cpu->profiler is set, cpu_step reports every instruction here.
+ * Code addresses are linearised so (rom_bank, pc) pairs get one slot each:
+ * ROM addresses map to their offset in the ROM image, anything from 0x8000
+ * up follows the ROM. Call/return edges come from CALL, RST, interrupts and
+ * RET/RETI, and feed a call tree for the flame graph.
+ */
+typedef struct {
+  uint32_t parent;
+  uint32_t function; // linear address of the callee
+  uint64_t cycles;   // spent in this frame itself
+} ProfileNode;
+
+typedef struct {
+  uint32_t from;
+  uint32_t to;
+  uint64_t count;
+} ProfileEdge;
+
+typedef struct Profiler {
+  const uint8_t *rom;
+  uint32_t rom_size;
+
+  // per linear address
+  uint64_t *counts;
+  uint64_t *cycles;
+
+  // per opcode, CB-prefixed ones at 0x100 + opcode
+  uint64_t opcodes[0x200];
+
+  // spent waiting in HALT, kept out of the per-address tables
+  uint64_t halted;
+
+  // call tree, node 0 is the root; hashed by (parent, function)
+  ProfileNode *nodes;
+  uint32_t node_count;
+  uint32_t node_capacity;
+  uint32_t *node_table;
+  uint32_t node_table_size;
+
+  // call edges, hashed by (from, to)
+  ProfileEdge *edges;
+  uint32_t edge_count;
+  uint32_t edge_table_size;
+
+  uint32_t stack[PROFILER_MAX_DEPTH];
+  int depth;
+  uint32_t current;
+} Profiler;
+
+int profiler_init(Profiler *profiler, const uint8_t *rom, size_t rom_size);
+void profiler_free(Profiler *profiler);
+
+void profiler_record(Profiler *profiler, CPU *cpu, uint16_t pc, uint16_t sp,
+                     uint8_t opcode, int cycles);
+void profiler_interrupt(Profiler *profiler, CPU *cpu, uint16_t pc, uint16_t vector);
+
+void profiler_write_folded(Profiler *profiler, FILE *file);
+void profiler_write_report(Profiler *profiler, FILE *file, int top);
+
+// writes <name>.folded and <name>.txt
+int profiler_save(Profiler *profiler, const char *name);
+
+#endif // __PROFILER_H__
@@ -1,8 +1,11 @@
 #ifndef __MEMORY_H__
 #define __MEMORY_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "counters.h"
+
 // TODO: move this and use MEM_
 #define RAM_DMA  0xFF46
 #define RAM_OAM  0xFE00
@@ -21,6 +24,16 @@ typedef struct Input {
   uint8_t select;
 } Input;
 
+// packed input, same bit order as the joypad register
+#define INPUT_RIGHT  0x01
+#define INPUT_LEFT   0x02
+#define INPUT_UP     0x04
+#define INPUT_DOWN   0x08
+#define INPUT_A      0x10
+#define INPUT_B      0x20
+#define INPUT_SELECT 0x40
+#define INPUT_START  0x80
+
 typedef enum Mapper {
   MAP_NONE,
   MAP_MBC1,
@@ -31,9 +44,36 @@ typedef enum {
   BANK_RAM,
 } BankMode;
 
+// addresses kept by a RAMWriteLog, writes past this are only counted
+#define RAM_WRITE_LOG_SIZE 4096
+
+typedef struct {
+  uint16_t addresses[RAM_WRITE_LOG_SIZE];
+  int count;
+} RAMWriteLog;
+
 #define RAM_BANK_SIZE 0x2000
+// MBC1 addresses at most four banks of cartridge RAM
+#define RAM_SRAM_MAX 0x8000
 
+// VRAM, WRAM and cartridge RAM are hashed in blocks, see ram_hash
+#define RAM_HASH_BLOCK 256
+#define RAM_HASH_WRAM (0x2000 / RAM_HASH_BLOCK)
+#define RAM_HASH_SRAM (0x4000 / RAM_HASH_BLOCK)
+#define RAM_HASH_BLOCKS ((0x4000 + RAM_SRAM_MAX) / RAM_HASH_BLOCK)
+
+/**
+ * Only the memory a DMG has is kept per instance: VRAM, WRAM, OAM, IO, HRAM
+ * and IE, plus cartridge RAM sized from the header (allocated by ram_init,
+ * NULL when the cartridge has none). The ROM image is shared and read-only;
+ * `rom0` and `romx` point at the fixed and switchable banks, or at cheat
+ * patched copies of them, and follow every bank switch.
+ */
 // TODO: move input out of here
+struct Cheats;
+struct APU;
+struct Serial;
+
 typedef struct {
   Input *input;
 
@@ -43,15 +83,61 @@ typedef struct {
   uint8_t ram_enable;
   BankMode bank_mode;
 
-  uint8_t data[0x10000];
-  uint8_t banks[0x8000];
-  uint8_t *rom;
+  uint8_t vram[0x2000];
+  uint8_t wram[0x2000];
+  uint8_t oam[0xA0];
+  uint8_t io[0x80];
+  uint8_t hram[0x7F];
+  uint8_t ie;
+
+  uint8_t *sram;
+  uint32_t sram_size;
+
+  const uint8_t *rom;
+  const uint8_t *rom0;
+  const uint8_t *romx;
+  uint32_t rom_mask; // image size - 1, the image is a power of two
+
+  // every written address goes here when set, for lockstep checking
+  RAMWriteLog *writes;
+
+  // hash64 of every block, valid unless the block is marked dirty
+  uint64_t block_hashes[RAM_HASH_BLOCKS];
+  uint8_t dirty[RAM_HASH_BLOCKS];
+
+  // Game Genie banks mapped in, GameShark writes at VBlank; see cheats.h
+  struct Cheats *cheats;
+
+  // takes the sound registers, FF10-FF3F, when set
+  struct APU *apu;
+  // SC writes start serial transfers, when set
+  struct Serial *serial;
+
+#ifdef LEEKBOY_COUNTERS
+  Counters counters;
+#endif
 } RAM;
 
-void ram_init(RAM *ram, Input *input, uint8_t *rom);
+void input_set(Input *input, uint8_t mask);
+uint8_t input_mask(Input *input);
+
+int ram_init(RAM *ram, Input *input, const uint8_t *rom, size_t rom_size);
+void ram_free(RAM *ram);
+void ram_map_banks(RAM *ram);
 void ram_set(RAM *ram, uint16_t address, uint8_t value);
 void ram_set_word(RAM *ram, uint16_t address, uint16_t value);
 uint8_t ram_get(RAM *ram, uint16_t address);
 
+/** marks the block of a cartridge RAM byte as written */
+static inline void ram_dirty_sram(RAM *ram, uint32_t offset) {
+  ram->dirty[RAM_HASH_SRAM + offset / RAM_HASH_BLOCK] = 1;
+}
+
+void ram_dirty_all(RAM *ram);
+uint64_t ram_hash(RAM *ram, uint64_t seed);
+
+const uint8_t *ram_read_span(RAM *ram, uint16_t address, uint32_t size);
+uint8_t *ram_write_span(RAM *ram, uint16_t address, uint32_t size);
+
 #endif // __MEMORY_H__
 
@@ -0,0 +1,50 @@
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "emulator.h"
+
+/**
+ * Rewind buffer
+ *
+ * One save state per frame in a fixed-size byte arena used as a ring.
+ * Every `interval` frames a keyframe is stored; the frames in between are
+ * stored as the XOR against their keyframe. Both are run-length encoded, and
+ * since most of memory doesn't change between frames a delta is usually a
+ * few hundred bytes. When the arena or the entry ring is full, the oldest
+ * keyframe is dropped together with the deltas that depend on it.
+ */
+typedef struct {
+  size_t offset;
+  size_t size;
+  uint8_t keyframe;
+} RewindEntry;
+
+typedef struct {
+  uint8_t *arena;
+  size_t capacity;
+  size_t head;
+
+  RewindEntry *entries;
+  int max_entries;
+  int first;
+  int count;
+
+  int interval;
+  int since_key;
+
+  size_t state_size;
+  uint8_t *key;     // decoded keyframe of the newest group
+  uint8_t *state;   // scratch: current state / delta
+  uint8_t *encoded; // scratch: encoded entry
+} Rewind;
+
+int rewind_init(Rewind *rewind, Emulator *emulator, size_t capacity,
+                int max_frames, int interval);
+void rewind_free(Rewind *rewind);
+void rewind_push(Rewind *rewind, Emulator *emulator);
+int rewind_pop(Rewind *rewind, Emulator *emulator);
+
+#endif // __REWIND_H__
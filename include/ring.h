@@ -0,0 +1,30 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Lock-free single-producer/single-consumer ring of interleaved stereo
+ * int16 frames, between the emulation thread (writer) and the audio
+ * callback (reader). `head` is only written by the producer and `tail`
+ * only by the consumer; both count frames forever and wrap through the
+ * power of two capacity.
+ */
+typedef struct {
+  int16_t *samples;
+  uint32_t capacity; // frames, a power of two
+  uint32_t head;
+  uint32_t tail;
+} AudioRing;
+
+int ring_init(AudioRing *ring, uint32_t frames);
+void ring_free(AudioRing *ring);
+
+// both return how many frames they moved
+size_t ring_write(AudioRing *ring, const int16_t *frames, size_t count);
+size_t ring_read(AudioRing *ring, int16_t *frames, size_t count);
+// frames waiting to be read
+size_t ring_level(AudioRing *ring);
+
+#endif // __RING_H__
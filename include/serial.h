@@ -0,0 +1,56 @@
+#ifndef __SERIAL_H__
+#define __SERIAL_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cpu.h"
+
+#define SERIAL_SB 0xFF01
+#define SERIAL_SC 0xFF02
+
+// SC bits
+#define SERIAL_START    0x80
+#define SERIAL_INTERNAL 0x01
+
+// 8 bits at 8192Hz
+#define SERIAL_BYTE_CYCLES 4096
+
+/**
+ * Serial port
+ *
+ * A transfer on the internal clock runs for SERIAL_BYTE_CYCLES and then
+ * swaps SB with whatever is on the other end. With nothing plugged in, it
+ * reads 0xFF. A transfer on the external clock waits for a partner that
+ * drives the clock.
+ *
+ * With a `link`, the finished transfer is not swapped straight away. It
+ * waits in `finished` until the link's next window boundary, where both
+ * instances stand at the same cycle (see link.h).
+ *
+ * Every byte sent on the internal clock is also written to `capture` when
+ * it is set. Test ROMs print their results this way.
+ */
+struct Link;
+
+typedef struct Serial {
+  uint8_t *io; // the register file, ram->io
+  CPU *cpu;
+
+  int timer;        // cycles left in an internal clock transfer, 0 when idle
+  uint8_t finished; // clocked out, waiting for the link
+
+  FILE *capture;
+  struct Link *link;
+} Serial;
+
+void serial_init(Serial *serial, uint8_t *io, CPU *cpu);
+void serial_control(Serial *serial, uint8_t value);
+void serial_step(Serial *serial, int cycles);
+
+// ends a transfer with `received` in SB and raises the interrupt
+void serial_finish(Serial *serial, uint8_t received);
+// on the external clock, waiting for a partner to drive it
+int serial_listening(Serial *serial);
+
+#endif // __SERIAL_H__
@@ -0,0 +1,51 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/**
+ * Binary instruction trace
+ *
+ * Fixed-size records in a memory-mapped ring file, one per executed
+ * instruction, written from cpu_step while cpu->trace is set. `count` in
+ * the header is the total number of records ever written, so the oldest
+ * record is at count % capacity once the ring has wrapped. Fields are
+ * little-endian with no padding; bin/trace decodes them into the Gameboy
+ * Doctor text format or compares them against a reference log.
+ */
+#define TRACE_MAGIC "LKBT"
+#define TRACE_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t capacity;
+  uint64_t count;
+} TraceHeader;
+
+typedef struct {
+  uint8_t a, f, b, c, d, e, h, l;
+  uint16_t sp;
+  uint16_t pc;
+  uint8_t pcmem[4];
+  uint8_t bank;
+  uint8_t reserved[3];
+  uint32_t cycles;
+} TraceRecord;
+
+typedef struct Trace {
+  TraceHeader *header;
+  TraceRecord *records;
+  size_t size;
+} Trace;
+
+int trace_open(Trace *trace, const char *path, uint32_t capacity);
+int trace_map(Trace *trace, const char *path);
+void trace_close(Trace *trace);
+void trace_record(Trace *trace, CPU *cpu);
+
+#endif // __TRACE_H__
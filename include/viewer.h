@@ -0,0 +1,33 @@
+#ifndef __VIEWER_H__
+#define __VIEWER_H__
+
+#include <stdint.h>
+
+#include "ram.h"
+
+/**
+ * Debug viewers
+ *
+ * Decodes a snapshot of video memory into one 0xAARRGGBB image, laid out
+ * as four panels: the 384 tiles of VRAM (raw shades), the BG maps at 9800
+ * and 9C00 (through BGP, the screen's scroll rectangle outlined on the one
+ * LCDC selects) and the 40 OAM entries, each sprite drawn with its palette
+ * and flips next to its Y, X, tile and attributes in hex.
+ *
+ * The snapshot is taken on the emulation thread and decoded wherever it is
+ * shown, so viewing costs the emulator one small copy per frame.
+ */
+#define VIEWER_WIDTH 656
+#define VIEWER_HEIGHT 354
+
+typedef struct {
+  uint8_t vram[0x2000];
+  uint8_t oam[0xA0];
+  uint8_t io[0x80];
+} ViewerMemory;
+
+void viewer_capture(ViewerMemory *memory, const RAM *ram);
+// `stride` is in pixels
+void viewer_draw(const ViewerMemory *memory, uint32_t *pixels, int stride);
+
+#endif // __VIEWER_H__
@@ -0,0 +1,443 @@
+#include <string.h>
+
+#include "apu.h"
+
+#define IO(address) apu->io[(address) - 0xFF00]
+// NRx0 of channel `index`, the others follow it
+#define NRX(index, n) apu->io[0x10 + (index) * 5 + (n)]
+
+// a full batch stays well inside SYNTH_BUFFER samples
+#define SYNTH_BATCH_CYCLES 65536
+// per channel per volume step, 4 channels at 15 x 8 stay in range
+#define SYNTH_AMPLITUDE 64
+#define SYNTH_SHIFT 14
+
+// bits always read back as 1, FF10 to FF2F
+static const uint8_t read_masks[0x20] = {
+  0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+  0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR20-NR24
+  0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+  0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR40-NR44
+  0x00, 0x00, 0x70,             // NR50-NR52
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// registers after the boot ROM, FF10 to FF26
+static const uint8_t boot_values[0x17] = {
+  0x80, 0xBF, 0xF3, 0xFF, 0xBF, //
+  0xFF, 0x3F, 0x00, 0xFF, 0xBF, //
+  0x7F, 0xFF, 0x9F, 0xFF, 0xBF, //
+  0xFF, 0xFF, 0x00, 0x00, 0xBF, //
+  0x77, 0xF3, 0xF1,
+};
+
+static const uint8_t duties[4] = {0x01, 0x81, 0x87, 0x7E};
+static const uint8_t noise_divisors[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+
+// Blackman windowed sinc steps (cutoff 0.9 of Nyquist), one row per
+// sub-sample phase, each row summing to 1 << SYNTH_SHIFT
+static const int16_t synth_kernel[SYNTH_PHASES][SYNTH_TAPS] = {
+  {9, -55, 180, -422, 780, -1186, 1513, 14746, 1513, -1186, 780, -422, 180, -55, 9, 0},
+  {9, -54, 173, -397, 711, -1013, 1058, 14725, 1987, -1357, 847, -443, 184, -55, 9, 0},
+  {8, -53, 166, -371, 638, -840, 626, 14666, 2480, -1525, 909, -462, 188, -55, 9, 0},
+  {8, -51, 158, -343, 564, -668, 217, 14567, 2990, -1689, 966, -478, 190, -55, 8, 0},
+  {8, -49, 148, -314, 488, -498, -168, 14428, 3515, -1846, 1018, -491, 190, -53, 8, 0},
+  {7, -46, 139, -283, 412, -333, -527, 14250, 4053, -1996, 1063, -500, 189, -51, 7, 0},
+  {7, -44, 128, -252, 336, -172, -861, 14036, 4602, -2136, 1102, -505, 186, -49, 6, 0},
+  {6, -41, 117, -220, 261, -17, -1167, 13783, 5159, -2266, 1133, -505, 181, -45, 5, 0},
+  {6, -38, 106, -188, 187, 131, -1446, 13495, 5722, -2382, 1156, -502, 174, -41, 4, 0},
+  {5, -35, 94, -156, 115, 272, -1697, 13176, 6288, -2485, 1170, -494, 165, -37, 3, 0},
+  {5, -31, 82, -124, 45, 403, -1920, 12823, 6856, -2572, 1174, -481, 154, -31, 1, 0},
+  {4, -28, 71, -93, -22, 526, -2115, 12439, 7423, -2642, 1169, -463, 141, -25, -1, 0},
+  {4, -25, 59, -63, -86, 639, -2283, 12027, 7985, -2693, 1154, -440, 126, -18, -3, 1},
+  {3, -22, 48, -34, -145, 741, -2423, 11591, 8540, -2724, 1128, -413, 108, -10, -5, 1},
+  {3, -19, 37, -6, -201, 833, -2536, 11128, 9087, -2734, 1091, -380, 89, -2, -7, 1},
+  {2, -16, 27, 20, -253, 914, -2623, 10647, 9621, -2721, 1043, -343, 68, 7, -10, 1},
+  {2, -13, 17, 45, -300, 984, -2684, 10141, 10141, -2684, 984, -300, 45, 17, -13, 2},
+  {1, -10, 7, 68, -343, 1043, -2721, 9621, 10647, -2623, 914, -253, 20, 27, -16, 2},
+  {1, -7, -2, 89, -380, 1091, -2734, 9087, 11128, -2536, 833, -201, -6, 37, -19, 3},
+  {1, -5, -10, 108, -413, 1128, -2724, 8540, 11591, -2423, 741, -145, -34, 48, -22, 3},
+  {1, -3, -18, 126, -440, 1154, -2693, 7985, 12027, -2283, 639, -86, -63, 59, -25, 4},
+  {0, -1, -25, 141, -463, 1169, -2642, 7423, 12439, -2115, 526, -22, -93, 71, -28, 4},
+  {0, 1, -31, 154, -481, 1174, -2572, 6856, 12823, -1920, 403, 45, -124, 82, -31, 5},
+  {0, 3, -37, 165, -494, 1170, -2485, 6288, 13176, -1697, 272, 115, -156, 94, -35, 5},
+  {0, 4, -41, 174, -502, 1156, -2382, 5722, 13495, -1446, 131, 187, -188, 106, -38, 6},
+  {0, 5, -45, 181, -505, 1133, -2266, 5159, 13783, -1167, -17, 261, -220, 117, -41, 6},
+  {0, 6, -49, 186, -505, 1102, -2136, 4602, 14036, -861, -172, 336, -252, 128, -44, 7},
+  {0, 7, -51, 189, -500, 1063, -1996, 4053, 14250, -527, -333, 412, -283, 139, -46, 7},
+  {0, 8, -53, 190, -491, 1018, -1846, 3515, 14428, -168, -498, 488, -314, 148, -49, 8},
+  {0, 8, -55, 190, -478, 966, -1689, 2990, 14567, 217, -668, 564, -343, 158, -51, 8},
+  {0, 9, -55, 188, -462, 909, -1525, 2480, 14666, 626, -840, 638, -371, 166, -53, 8},
+  {0, 9, -55, 184, -443, 847, -1357, 1987, 14725, 1058, -1013, 711, -397, 173, -54, 9},
+};
+
+void apu_synth_init(APUSynth *synth, AudioRing *ring) {
+  memset(synth, 0, sizeof(APUSynth));
+  synth->rate = ((uint64_t)APU_SAMPLE_RATE << 32) / 4194304;
+  synth->factor = synth->rate;
+  synth->ring = ring;
+}
+
+/** a level change of `left`, `right` at `time` cycles into the batch */
+static void synth_add(APUSynth *synth, int time, int left, int right) {
+  uint64_t position = synth->offset + (uint64_t)time * synth->factor;
+  uint32_t index = position >> 32;
+  const int16_t *kernel = synth_kernel[(position >> 27) & (SYNTH_PHASES - 1)];
+  int32_t *l = &synth->buffer[0][index], *r = &synth->buffer[1][index];
+
+  for (int i = 0; i < SYNTH_TAPS; i++) {
+    l[i] += kernel[i] * left;
+    r[i] += kernel[i] * right;
+  }
+}
+
+/**
+ * Sets the rate from how full the ring is. Call it once per emulated frame,
+ * after the frame's samples are in, which is where `target` is measured.
+ */
+void apu_synth_steer(APUSynth *synth) {
+  if (!synth->ring || !synth->target)
+    return;
+
+  // the full skew half the target away, in proportion closer to it
+  int64_t range = synth->target / 2;
+  int64_t error = (int64_t)synth->target - (int64_t)ring_level(synth->ring);
+  if (error > range)
+    error = range;
+  if (error < -range)
+    error = -range;
+
+  // short of the target makes more samples per cycle, over it fewer
+  int64_t skew = (int64_t)(synth->rate / SYNTH_MAX_SKEW) * error / range;
+  synth->factor = synth->rate + skew;
+}
+
+/** hands out the whole samples of a batch of `time` cycles */
+static void synth_end(APUSynth *synth, int time) {
+  int16_t out[SYNTH_BUFFER * 2];
+  synth->offset += (uint64_t)time * synth->factor;
+  uint32_t count = synth->offset >> 32;
+  synth->offset &= 0xFFFFFFFF;
+
+  for (int side = 0; side < 2; side++) {
+    int32_t *buffer = synth->buffer[side];
+    int32_t sum = synth->sum[side];
+
+    for (uint32_t i = 0; i < count; i++) {
+      sum += buffer[i];
+      int32_t sample = sum >> SYNTH_SHIFT;
+      out[i * 2 + side] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample;
+      // leaks the DC offset away, a high-pass around 15Hz
+      sum -= sum >> 9;
+    }
+    synth->sum[side] = sum;
+
+    // the tails of the last steps start the next batch
+    memmove(buffer, &buffer[count], SYNTH_TAPS * sizeof(int32_t));
+    memset(&buffer[SYNTH_TAPS], 0, count * sizeof(int32_t));
+  }
+
+  if (synth->ring)
+    ring_write(synth->ring, out, count);
+  synth->samples += count;
+}
+
+static inline int apu_powered(APU *apu) {
+  return IO(NR52) & 0x80;
+}
+
+static inline int apu_dac(APU *apu, int index) {
+  return index == 2 ? NRX(2, 0) & 0x80 : NRX(index, 2) & 0xF8;
+}
+
+static int apu_period(APU *apu, int index) {
+  APUChannel *channel = &apu->channels[index];
+
+  switch (index) {
+  case 2:
+    return (2048 - channel->frequency) * 2;
+  case 3: {
+    uint8_t nr43 = NRX(3, 3);
+    return noise_divisors[nr43 & 7] << (nr43 >> 4);
+  }
+  default:
+    return (2048 - channel->frequency) * 4;
+  }
+}
+
+/** the digital output of a channel, 0 to 15 */
+static int apu_level(APU *apu, int index) {
+  APUChannel *channel = &apu->channels[index];
+  if (!channel->enabled || !apu_dac(apu, index))
+    return 0;
+
+  switch (index) {
+  case 2: {
+    uint8_t shift = (NRX(2, 2) >> 5) & 3;
+    uint8_t byte = IO(WAVE_RAM + channel->position / 2);
+    uint8_t sample = channel->position & 1 ? byte & 0x0F : byte >> 4;
+    return shift ? sample >> (shift - 1) : 0;
+  }
+  case 3:
+    return channel->lfsr & 1 ? 0 : channel->volume;
+  default:
+    return (duties[NRX(index, 1) >> 6] >> channel->position) & 1 ? channel->volume : 0;
+  }
+}
+
+/** hands a channel's change of level to the synth, through NR50 and NR51 */
+static void apu_set_level(APU *apu, int index, int level, int time) {
+  APUChannel *channel = &apu->channels[index];
+  int delta = level - channel->level;
+  if (!delta)
+    return;
+  channel->level = level;
+
+  uint8_t nr50 = IO(NR50), nr51 = IO(NR51);
+  int left = nr51 & (0x10 << index) ? delta * (((nr50 >> 4) & 7) + 1) : 0;
+  int right = nr51 & (0x01 << index) ? delta * ((nr50 & 7) + 1) : 0;
+  if (left || right)
+    synth_add(apu->synth, time, left * SYNTH_AMPLITUDE, right * SYNTH_AMPLITUDE);
+}
+
+static void apu_update(APU *apu) {
+  if (apu->synth)
+    for (int i = 0; i < 4; i++)
+      apu_set_level(apu, i, apu_level(apu, i), apu->time);
+}
+
+static void apu_silence(APU *apu) {
+  if (apu->synth)
+    for (int i = 0; i < 4; i++)
+      apu_set_level(apu, i, 0, apu->time);
+}
+
+static void apu_status(APU *apu) {
+  uint8_t status = 0;
+  for (int i = 0; i < 4; i++)
+    if (apu->channels[i].enabled)
+      status |= 1 << i;
+  IO(NR52) = (IO(NR52) & 0x80) | 0x70 | status;
+}
+
+/** steps a channel's waveform through `cycles`, from `start` in the batch */
+static void apu_render(APU *apu, int index, int start, int cycles) {
+  APUChannel *channel = &apu->channels[index];
+  int period = apu_period(apu, index);
+
+  // noise with a shift of 14 or 15 is never clocked
+  if (index == 3 && (NRX(3, 3) >> 4) >= 14)
+    return;
+
+  int timer = channel->timer;
+  for (; timer <= cycles; timer += period) {
+    if (index == 3) {
+      uint16_t lfsr = channel->lfsr;
+      uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+      lfsr = (lfsr >> 1) | (bit << 14);
+      if (NRX(3, 3) & 0x08)
+        lfsr = (lfsr & ~0x40) | (bit << 6);
+      channel->lfsr = lfsr;
+    } else {
+      channel->position = (channel->position + 1) & (index == 2 ? 31 : 7);
+    }
+    apu_set_level(apu, index, apu_level(apu, index), start + timer);
+  }
+  channel->timer = timer - cycles;
+}
+
+static uint16_t apu_sweep_next(APU *apu) {
+  APUChannel *channel = &apu->channels[0];
+  uint16_t delta = channel->sweep_shadow >> (IO(NR10) & 7);
+  return IO(NR10) & 0x08 ? channel->sweep_shadow - delta : channel->sweep_shadow + delta;
+}
+
+static void apu_sweep(APU *apu) {
+  APUChannel *channel = &apu->channels[0];
+  if (channel->sweep_timer && --channel->sweep_timer)
+    return;
+
+  uint8_t period = (IO(NR10) >> 4) & 7;
+  channel->sweep_timer = period ? period : 8;
+  if (!channel->sweep_enabled || !period)
+    return;
+
+  uint16_t frequency = apu_sweep_next(apu);
+  if (frequency > 2047) {
+    channel->enabled = 0;
+  } else if (IO(NR10) & 7) {
+    channel->sweep_shadow = frequency;
+    channel->frequency = frequency;
+    // checked again with the new frequency
+    if (apu_sweep_next(apu) > 2047)
+      channel->enabled = 0;
+  }
+}
+
+/** lengths at 256Hz, sweep at 128Hz, envelopes at 64Hz */
+static void apu_sequencer(APU *apu) {
+  uint8_t step = apu->sequencer_step;
+  apu->sequencer_step = (step + 1) & 7;
+
+  if (!(step & 1))
+    for (int i = 0; i < 4; i++) {
+      APUChannel *channel = &apu->channels[i];
+      if ((NRX(i, 4) & 0x40) && channel->length && !--channel->length)
+        channel->enabled = 0;
+    }
+
+  if (step == 2 || step == 6)
+    apu_sweep(apu);
+
+  if (step == 7)
+    for (int i = 0; i < 4; i++) {
+      APUChannel *channel = &apu->channels[i];
+      uint8_t envelope = NRX(i, 2), period = envelope & 7;
+      if (i == 2 || !period)
+        continue;
+      if (channel->envelope_timer && --channel->envelope_timer)
+        continue;
+
+      channel->envelope_timer = period;
+      if (envelope & 0x08 && channel->volume < 15)
+        channel->volume++;
+      else if (!(envelope & 0x08) && channel->volume > 0)
+        channel->volume--;
+    }
+}
+
+static void apu_trigger(APU *apu, int index) {
+  APUChannel *channel = &apu->channels[index];
+  channel->enabled = !!apu_dac(apu, index);
+  if (!channel->length)
+    channel->length = index == 2 ? 256 : 64;
+
+  channel->volume = NRX(index, 2) >> 4;
+  channel->envelope_timer = NRX(index, 2) & 7;
+  channel->timer = apu_period(apu, index);
+  channel->position = 0;
+  channel->lfsr = 0x7FFF;
+
+  if (index == 0) {
+    uint8_t period = (IO(NR10) >> 4) & 7, shift = IO(NR10) & 7;
+    channel->sweep_shadow = channel->frequency;
+    channel->sweep_timer = period ? period : 8;
+    channel->sweep_enabled = period || shift;
+    if (shift && apu_sweep_next(apu) > 2047)
+      channel->enabled = 0;
+  }
+}
+
+void apu_init(APU *apu, uint8_t *io) {
+  memset(apu, 0, sizeof(APU));
+  apu->io = io;
+  apu->sequencer_timer = APU_SEQUENCER_CYCLES;
+
+  memcpy(&IO(NR10), boot_values, sizeof(boot_values));
+  memset(&IO(NR52 + 1), 0xFF, WAVE_RAM - NR52 - 1);
+
+  for (int i = 0; i < 4; i++)
+    apu->channels[i].lfsr = 0x7FFF;
+  // the boot ROM's beep has faded, the channel is still on
+  apu->channels[0].enabled = 1;
+}
+
+/** runs the cycles the CPU has taken since the last sync */
+void apu_sync(APU *apu) {
+  int cycles = apu->pending;
+  apu->pending = 0;
+
+  while (cycles > 0) {
+    int chunk = cycles < apu->sequencer_timer ? cycles : apu->sequencer_timer;
+    if (apu->synth && chunk > SYNTH_BATCH_CYCLES - apu->time)
+      chunk = SYNTH_BATCH_CYCLES - apu->time;
+
+    if (apu->synth) {
+      if (apu_powered(apu))
+        for (int i = 0; i < 4; i++)
+          if (apu->channels[i].enabled && apu_dac(apu, i))
+            apu_render(apu, i, apu->time, chunk);
+      apu->time += chunk;
+    }
+
+    cycles -= chunk;
+    apu->sequencer_timer -= chunk;
+    if (!apu->sequencer_timer) {
+      apu->sequencer_timer = APU_SEQUENCER_CYCLES;
+      if (apu_powered(apu)) {
+        apu_sequencer(apu);
+        apu_status(apu);
+        apu_update(apu);
+      }
+    }
+
+    if (apu->synth && apu->time == SYNTH_BATCH_CYCLES) {
+      synth_end(apu->synth, apu->time);
+      apu->time = 0;
+    }
+  }
+
+  if (apu->synth && apu->time) {
+    synth_end(apu->synth, apu->time);
+    apu->time = 0;
+  }
+}
+
+static void apu_power_off(APU *apu) {
+  for (uint16_t address = NR10; address < NR52; address++)
+    IO(address) = read_masks[address - NR10];
+
+  for (int i = 0; i < 4; i++) {
+    APUChannel *channel = &apu->channels[i];
+    channel->enabled = 0;
+    channel->length = 0;
+    channel->volume = 0;
+    channel->frequency = 0;
+  }
+}
+
+/** a CPU write to FF10-FF3F; the register file keeps what reads return */
+void apu_write(APU *apu, uint16_t address, uint8_t value) {
+  apu_sync(apu);
+  apu_silence(apu);
+
+  if (address >= WAVE_RAM) {
+    IO(address) = value;
+  } else if (address == NR52) {
+    if (!(value & 0x80) && apu_powered(apu))
+      apu_power_off(apu);
+    else if (value & 0x80 && !apu_powered(apu))
+      apu->sequencer_step = 0;
+    IO(NR52) = value & 0x80;
+  } else if (apu_powered(apu) && address < NR52) {
+    IO(address) = value | read_masks[address - NR10];
+
+    if (address < NR50) {
+      int index = (address - NR10) / 5;
+      APUChannel *channel = &apu->channels[index];
+
+      switch ((address - NR10) % 5) {
+      case 1:
+        channel->length = index == 2 ? 256 - value : 64 - (value & 0x3F);
+        break;
+      case 3:
+        if (index != 3)
+          channel->frequency = (channel->frequency & 0x700) | value;
+        break;
+      case 4:
+        if (index != 3)
+          channel->frequency = (channel->frequency & 0xFF) | (value & 0x07) << 8;
+        if (value & 0x80)
+          apu_trigger(apu, index);
+        break;
+      }
+
+      // the DAC being turned off stops the channel
+      if (!apu_dac(apu, index))
+        channel->enabled = 0;
+    }
+  }
+
+  apu_status(apu);
+  apu_update(apu);
+}
@@ -0,0 +1,198 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+
+static void batch_step(Batch *batch, BatchInstance *instance) {
+  Emulator *emulator = &instance->emulator;
+
+  if (batch->frames) {
+    // a CPU error or a stopped debugger runs 0 cycles
+    for (int i = 0; i < batch->frames; i++) {
+      if (emulator_step(emulator) == 0)
+        break;
+    }
+    return;
+  }
+
+  int budget = batch->cycles - instance->overshoot;
+  while (budget > 0) {
+    int ran = emulator_run_cycles(emulator, budget < FRAME_CYCLES ? budget : FRAME_CYCLES);
+    if (ran == 0)
+      break;
+    budget -= ran;
+  }
+  instance->overshoot = budget < 0 ? -budget : 0;
+}
+
+/** runs the caller's slice, then steals from the others in turn */
+static void batch_work(Batch *batch, int self) {
+  for (int i = 0; i < batch->threads; i++) {
+    BatchSlice *slice = &batch->slices[(self + i) % batch->threads];
+
+    uint32_t index;
+    while ((index = __atomic_fetch_add(&slice->next, 1, __ATOMIC_RELAXED)) < slice->end) {
+      batch_step(batch, &batch->instances[index]);
+    }
+  }
+}
+
+typedef struct {
+  Batch *batch;
+  int self;
+} BatchWorker;
+
+static void *batch_worker(void *data) {
+  BatchWorker worker = *(BatchWorker *)data;
+  Batch *batch = worker.batch;
+  uint64_t generation = 0;
+
+  free(data);
+
+  pthread_mutex_lock(&batch->lock);
+  while (1) {
+    while (batch->generation == generation && !batch->quit)
+      pthread_cond_wait(&batch->wake, &batch->lock);
+
+    if (batch->quit)
+      break;
+
+    generation = batch->generation;
+    pthread_mutex_unlock(&batch->lock);
+
+    batch_work(batch, worker.self);
+
+    pthread_mutex_lock(&batch->lock);
+    if (--batch->busy == 0)
+      pthread_cond_signal(&batch->done);
+  }
+  pthread_mutex_unlock(&batch->lock);
+
+  return NULL;
+}
+
+/**
+ * Sets up `count` instances of one ROM image (see emulator_rom_image),
+ * which must outlive the batch, and `threads` threads including the
+ * caller's. Returns -1 when memory or threads run out.
+ */
+int batch_init(Batch *batch, const uint8_t *image, size_t size, int count, int threads) {
+  memset(batch, 0, sizeof(Batch));
+
+  if (count <= 0 || threads <= 0)
+    return -1;
+
+  batch->count = count;
+  batch->threads = threads < count ? threads : count;
+
+  void *instances, *slices;
+  if (posix_memalign(&instances, BATCH_CACHE_LINE, count * sizeof(BatchInstance)) != 0)
+    return -1;
+  if (posix_memalign(&slices, BATCH_CACHE_LINE, batch->threads * sizeof(BatchSlice)) != 0) {
+    free(instances);
+    return -1;
+  }
+
+  batch->instances = instances;
+  batch->slices = slices;
+  memset(batch->instances, 0, count * sizeof(BatchInstance));
+
+  for (int i = 0; i < count; i++) {
+    if (emulator_init_rom(batch_emulator(batch, i), image, size) != 0) {
+      batch_free(batch);
+      return -1;
+    }
+  }
+
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->wake, NULL);
+  pthread_cond_init(&batch->done, NULL);
+
+  // the caller works as thread 0
+  batch->workers = calloc(batch->threads, sizeof(pthread_t));
+  for (int i = 1; batch->workers && i < batch->threads; i++) {
+    BatchWorker *worker = malloc(sizeof(BatchWorker));
+    if (worker)
+      *worker = (BatchWorker){batch, i};
+
+    if (worker == NULL || pthread_create(&batch->workers[i], NULL, batch_worker, worker) != 0) {
+      free(worker);
+      batch->threads = i;
+      break;
+    }
+  }
+
+  if (batch->workers == NULL) {
+    batch_free(batch);
+    return -1;
+  }
+
+  return 0;
+}
+
+void batch_free(Batch *batch) {
+  if (batch->workers) {
+    pthread_mutex_lock(&batch->lock);
+    batch->quit = 1;
+    pthread_cond_broadcast(&batch->wake);
+    pthread_mutex_unlock(&batch->lock);
+
+    for (int i = 1; i < batch->threads; i++) {
+      pthread_join(batch->workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->wake);
+    pthread_cond_destroy(&batch->done);
+  }
+
+  for (int i = 0; batch->instances && i < batch->count; i++) {
+    emulator_free(batch_emulator(batch, i));
+  }
+
+  free(batch->workers);
+  free(batch->slices);
+  free(batch->instances);
+  memset(batch, 0, sizeof(Batch));
+}
+
+static int batch_round(Batch *batch) {
+  // even slices, one per thread
+  for (int i = 0; i < batch->threads; i++) {
+    batch->slices[i].next = (uint64_t)batch->count * i / batch->threads;
+    batch->slices[i].end = (uint64_t)batch->count * (i + 1) / batch->threads;
+  }
+
+  pthread_mutex_lock(&batch->lock);
+  batch->busy = batch->threads - 1;
+  batch->generation++;
+  pthread_cond_broadcast(&batch->wake);
+  pthread_mutex_unlock(&batch->lock);
+
+  batch_work(batch, 0);
+
+  pthread_mutex_lock(&batch->lock);
+  while (batch->busy > 0)
+    pthread_cond_wait(&batch->done, &batch->lock);
+  pthread_mutex_unlock(&batch->lock);
+
+  int errors = 0;
+  for (int i = 0; i < batch->count; i++) {
+    errors += batch_emulator(batch, i)->cpu.error != CPU_OK;
+  }
+
+  return errors;
+}
+
+int batch_run_frames(Batch *batch, int frames) {
+  batch->frames = frames;
+  return batch_round(batch);
+}
+
+int batch_run_cycles(Batch *batch, int cycles) {
+  batch->frames = 0;
+  batch->cycles = cycles;
+  return batch_round(batch);
+}
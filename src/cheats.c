@@ -0,0 +1,205 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cheats.h"
+
+#define BANK_SIZE 0x4000
+
+/** reads hex digits into `digits`, skipping dashes; returns how many */
+static int cheats_digits(const char *code, uint8_t *digits, int max) {
+  int count = 0;
+
+  for (; *code; code++) {
+    if (*code == '-')
+      continue;
+    if (!isxdigit((unsigned char)*code) || count == max)
+      return -1;
+
+    char c = toupper((unsigned char)*code);
+    digits[count++] = c <= '9' ? c - '0' : c - 'A' + 10;
+  }
+
+  return count;
+}
+
+/** returns -1 if `code` is neither a Game Genie nor a GameShark code */
+int cheats_parse(Cheat *cheat, const char *code) {
+  uint8_t d[9];
+  int count = cheats_digits(code, d, 9);
+
+  memset(cheat, 0, sizeof(Cheat));
+
+  switch (count) {
+  case 6:
+  case 9:
+    // ABC-DEF-GHI: AB new data, FCDE address with F inverted,
+    // GI compare byte rotated right by 2 and XORed with BA
+    cheat->type = CHEAT_GAME_GENIE;
+    cheat->value = d[0] << 4 | d[1];
+    cheat->address = (d[5] ^ 0xF) << 12 | d[2] << 8 | d[3] << 4 | d[4];
+    if (cheat->address >= 0x8000)
+      return -1;
+
+    if (count == 9) {
+      uint8_t compare = d[6] << 4 | d[8];
+      cheat->compare = (uint8_t)(compare >> 2 | compare << 6) ^ 0xBA;
+      cheat->has_compare = 1;
+    }
+    return 0;
+  case 8:
+    cheat->type = CHEAT_GAMESHARK;
+    cheat->bank = d[0] << 4 | d[1];
+    cheat->value = d[2] << 4 | d[3];
+    cheat->address = (d[6] << 4 | d[7]) << 8 | d[4] << 4 | d[5];
+    return cheat->address >= 0x8000 ? 0 : -1;
+  default:
+    return -1;
+  }
+}
+
+static int cheats_patch_bank(Cheats *cheats, RAM *ram, uint32_t bank, Cheat *cheat) {
+  uint16_t offset = cheat->address & (BANK_SIZE - 1);
+  const uint8_t *original = ram->rom + bank * BANK_SIZE;
+
+  if (cheat->has_compare && original[offset] != cheat->compare)
+    return 0;
+
+  if (cheats->banks[bank] == NULL) {
+    cheats->banks[bank] = malloc(BANK_SIZE);
+    if (cheats->banks[bank] == NULL)
+      return -1;
+    memcpy(cheats->banks[bank], original, BANK_SIZE);
+  }
+
+  cheats->banks[bank][offset] = cheat->value;
+  return 0;
+}
+
+/**
+ * The patched copy of `bank`, NULL when no code changes it. Called by
+ * ram_map_banks: the copy is made the first time the bank is mapped in. If
+ * it can't be allocated the bank stays unpatched, `failed` is set and the
+ * next mapping tries again.
+ */
+const uint8_t *cheats_bank(Cheats *cheats, RAM *ram, uint32_t bank) {
+  if (cheats->checked[bank])
+    return cheats->banks[bank];
+
+  for (int i = 0; i < cheats->count; i++) {
+    Cheat *cheat = &cheats->cheats[i];
+    if (cheat->type != CHEAT_GAME_GENIE || (cheat->address < BANK_SIZE) != (bank == 0))
+      continue;
+
+    if (cheats_patch_bank(cheats, ram, bank, cheat) != 0) {
+      cheats->failed = 1;
+      return NULL;
+    }
+  }
+
+  cheats->checked[bank] = 1;
+  return cheats->banks[bank];
+}
+
+/**
+ * Drops the patched banks and maps the current ones in again, patched
+ * with the new codes. Returns -1 if they can't be allocated.
+ */
+static int cheats_patch(Cheats *cheats, RAM *ram) {
+  for (int i = 0; i < CHEATS_MAX_BANKS; i++) {
+    free(cheats->banks[i]);
+    cheats->banks[i] = NULL;
+  }
+  memset(cheats->checked, 0, sizeof(cheats->checked));
+  cheats->failed = 0;
+
+  ram_map_banks(ram);
+  return cheats->failed ? -1 : 0;
+}
+
+static inline int cheats_equal(Cheat *a, Cheat *b) {
+  return a->type == b->type && a->address == b->address && a->value == b->value &&
+         a->compare == b->compare && a->has_compare == b->has_compare &&
+         a->bank == b->bank;
+}
+
+/**
+ * Adds a code and attaches `cheats` to `ram`. Returns -1 with errno set:
+ * EINVAL for an invalid code or when CHEATS_MAX are already active, ENOMEM
+ * when the banks it patches can't be allocated, leaving the code out.
+ */
+int cheats_add(Cheats *cheats, RAM *ram, const char *code) {
+  Cheat cheat;
+  if (cheats_parse(&cheat, code) != 0 || cheats->count == CHEATS_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  cheats->cheats[cheats->count++] = cheat;
+  ram->cheats = cheats;
+
+  if (cheat.type == CHEAT_GAME_GENIE && cheats_patch(cheats, ram) != 0) {
+    cheats->count--;
+    cheats_patch(cheats, ram);
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Removes every active copy of `code`. Returns -1 with errno set: EINVAL if
+ * there was none, ENOMEM if the remaining codes' banks can't be allocated.
+ */
+int cheats_remove(Cheats *cheats, RAM *ram, const char *code) {
+  Cheat cheat;
+  if (cheats_parse(&cheat, code) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int kept = 0;
+  for (int i = 0; i < cheats->count; i++) {
+    if (!cheats_equal(&cheats->cheats[i], &cheat))
+      cheats->cheats[kept++] = cheats->cheats[i];
+  }
+
+  if (kept == cheats->count) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  cheats->count = kept;
+  if (cheat.type == CHEAT_GAME_GENIE && cheats_patch(cheats, ram) != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+/** removes all codes and frees the patched banks */
+void cheats_clear(Cheats *cheats, RAM *ram) {
+  cheats->count = 0;
+  cheats_patch(cheats, ram);
+}
+
+/** the GameShark writes, once per VBlank */
+void cheats_apply(Cheats *cheats, RAM *ram) {
+  for (int i = 0; i < cheats->count; i++) {
+    Cheat *cheat = &cheats->cheats[i];
+    if (cheat->type != CHEAT_GAMESHARK)
+      continue;
+
+    // a fixed cartridge RAM bank, whichever one is mapped
+    if ((cheat->bank & 0xF8) == 0x80 && cheat->address >= 0xA000 &&
+        cheat->address < 0xC000 && ram->sram) {
+      uint32_t offset = (cheat->bank & 0x07) * RAM_BANK_SIZE + (cheat->address - 0xA000);
+      ram->sram[offset & (ram->sram_size - 1)] = cheat->value;
+      ram_dirty_sram(ram, offset & (ram->sram_size - 1));
+      continue;
+    }
+
+    ram_set(ram, cheat->address, cheat->value);
+  }
+}
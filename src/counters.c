@@ -0,0 +1,69 @@
+#include "counters.h"
+
+static const char *regions[REGION_COUNT] = {
+    "rom0", "romx", "vram", "sram", "wram", "echo", "oam", "io", "hram",
+};
+
+static const char *interrupts[COUNTER_INTERRUPTS] = {
+    "vblank", "lcdstat", "timer", "serial", "joypad",
+};
+
+static const char *modes[4] = {"hblank", "vblank", "oam", "vram"};
+
+#define U(x) ((unsigned long long)(x))
+
+void counters_write_csv_header(FILE *file) {
+  fprintf(file, "frame");
+  for (int i = 0; i < REGION_COUNT; i++)
+    fprintf(file, ",read_%s", regions[i]);
+  for (int i = 0; i < REGION_COUNT; i++)
+    fprintf(file, ",write_%s", regions[i]);
+  fprintf(file, ",bank_switches,dma_transfers");
+  for (int i = 0; i < COUNTER_INTERRUPTS; i++)
+    fprintf(file, ",raised_%s", interrupts[i]);
+  for (int i = 0; i < COUNTER_INTERRUPTS; i++)
+    fprintf(file, ",serviced_%s", interrupts[i]);
+  fprintf(file, ",halt_cycles");
+  for (int i = 0; i < 4; i++)
+    fprintf(file, ",mode_%s", modes[i]);
+  fprintf(file, ",scanlines\n");
+}
+
+void counters_write_csv(const Counters *counters, uint64_t frame, FILE *file) {
+  fprintf(file, "%llu", U(frame));
+  for (int i = 0; i < REGION_COUNT; i++)
+    fprintf(file, ",%llu", U(counters->reads[i]));
+  for (int i = 0; i < REGION_COUNT; i++)
+    fprintf(file, ",%llu", U(counters->writes[i]));
+  fprintf(file, ",%llu,%llu", U(counters->bank_switches), U(counters->dma_transfers));
+  for (int i = 0; i < COUNTER_INTERRUPTS; i++)
+    fprintf(file, ",%llu", U(counters->interrupts_raised[i]));
+  for (int i = 0; i < COUNTER_INTERRUPTS; i++)
+    fprintf(file, ",%llu", U(counters->interrupts_serviced[i]));
+  fprintf(file, ",%llu", U(counters->halt_cycles));
+  for (int i = 0; i < 4; i++)
+    fprintf(file, ",%llu", U(counters->mode_changes[i]));
+  fprintf(file, ",%llu\n", U(counters->scanlines));
+}
+
+static void write_object(FILE *file, const char *name, const char **keys,
+                         const uint64_t *values, int count) {
+  fprintf(file, ",\"%s\":{", name);
+  for (int i = 0; i < count; i++)
+    fprintf(file, "%s\"%s\":%llu", i ? "," : "", keys[i], U(values[i]));
+  fprintf(file, "}");
+}
+
+/** one object per line, so the stream can be read as JSON lines */
+void counters_write_json(const Counters *counters, uint64_t frame, FILE *file) {
+  fprintf(file, "{\"frame\":%llu", U(frame));
+  write_object(file, "reads", regions, counters->reads, REGION_COUNT);
+  write_object(file, "writes", regions, counters->writes, REGION_COUNT);
+  fprintf(file, ",\"bank_switches\":%llu,\"dma_transfers\":%llu",
+          U(counters->bank_switches), U(counters->dma_transfers));
+  write_object(file, "raised", interrupts, counters->interrupts_raised, COUNTER_INTERRUPTS);
+  write_object(file, "serviced", interrupts, counters->interrupts_serviced, COUNTER_INTERRUPTS);
+  fprintf(file, ",\"halt_cycles\":%llu", U(counters->halt_cycles));
+  write_object(file, "modes", modes, counters->mode_changes, 4);
+  fprintf(file, ",\"scanlines\":%llu}\n", U(counters->scanlines));
+}
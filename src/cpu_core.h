@@ -0,0 +1,331 @@
+/**
+ * A CPU step and the helpers that touch memory, included by cpu.c once per
+ * core with CPU_STEP set to the function name, CPU_FAST_PATHS and
+ * CPU_DEBUG to 0 or 1, and CPU_READ/CPU_WRITE to the data accessors.
+ * Instruction fetches always go straight to ram_get. Only meant to be
+ * included from cpu.c, after its helpers.
+ */
+
+// each core gets its own copy of the helpers below
+#define CPU_LOCAL(name) CPU_LOCAL_(name, CPU_STEP)
+#define CPU_LOCAL_(name, step) CPU_LOCAL__(name, step)
+#define CPU_LOCAL__(name, step) name##_##step
+
+#define cpu_push_stack CPU_LOCAL(cpu_push_stack)
+#define cpu_pop_stack CPU_LOCAL(cpu_pop_stack)
+#define get_r8 CPU_LOCAL(get_r8)
+#define set_r8 CPU_LOCAL(set_r8)
+#define inc_r8 CPU_LOCAL(inc_r8)
+#define dec_r8 CPU_LOCAL(dec_r8)
+#define cpu_cb CPU_LOCAL(cpu_cb)
+
+static inline void cpu_push_stack(CPU *cpu, uint16_t value) {
+  // decrement the stack pointer
+  cpu->sp -= 2;
+
+  // push the value onto the stack
+  CPU_WRITE(cpu, cpu->sp, value & 0xFF);
+  CPU_WRITE(cpu, cpu->sp + 1, (value >> 8) & 0xFF);
+}
+
+static inline uint16_t cpu_pop_stack(CPU *cpu) {
+  // pop the value off the stack
+  uint16_t value = CPU_READ(cpu, cpu->sp) | (CPU_READ(cpu, cpu->sp + 1) << 8);
+  // increment the stack pointer
+  cpu->sp += 2;
+
+  return value;
+}
+
+static inline uint8_t get_r8(CPU *cpu, uint8_t opcode) {
+  switch(opcode & 0x07) {
+    case 0x00: return cpu->b;
+    case 0x01: return cpu->c;
+    case 0x02: return cpu->d;
+    case 0x03: return cpu->e;
+    case 0x04: return cpu->h;
+    case 0x05: return cpu->l;
+    case 0x06: return CPU_READ(cpu, cpu->hl);
+    case 0x07: return cpu->a;
+    default: return 0;
+  }
+}
+
+static inline void set_r8(CPU *cpu, uint8_t opcode, uint8_t value) {
+  switch(opcode & 0x07) {
+    case 0x00: cpu->b = value; break;
+    case 0x01: cpu->c = value; break;
+    case 0x02: cpu->d = value; break;
+    case 0x03: cpu->e = value; break;
+    case 0x04: cpu->h = value; break;
+    case 0x05: cpu->l = value; break;
+    case 0x06: CPU_WRITE(cpu, cpu->hl, value); break;
+    case 0x07: cpu->a = value; break;
+  }
+}
+
+static inline void inc_r8(CPU *cpu, uint8_t opcode) {
+  uint8_t value = get_r8(cpu, opcode);
+  value++;
+
+  cpu_set_flags(cpu, value == 0, 0, (value & 0x0F) == 0, CARRYF);
+  set_r8(cpu, opcode, value);
+}
+
+static inline void dec_r8(CPU *cpu, uint8_t opcode) {
+  uint8_t value = get_r8(cpu, opcode);
+  value--;
+
+  cpu_set_flags(cpu, value == 0, 1, (value & 0x0F) == 0x0F, CARRYF);
+  set_r8(cpu, opcode, value);
+}
+
+static void cpu_cb(CPU *cpu) {
+  uint8_t opcode = ram_get(cpu->ram, cpu->pc);
+  Instruction instruction = prefixed[opcode];
+
+  // remove 1 that was added on main step
+  cpu->pc += instruction.bytes - 1;
+
+  uint8_t value = get_r8(cpu, opcode);
+  uint8_t carry = CARRYF;
+  uint8_t set_carry = 0;
+
+  switch(opcode) {
+    case 0x00 ... 0x07: // RLC
+      set_carry = value >> 7;
+      value <<= 1;
+      if(set_carry) value |= 1;
+      cpu_set_flags(cpu, value == 0, 0, 0, set_carry);
+      break;
+    case 0x10 ... 0x17: // RL
+      set_carry = value >> 7;
+      value <<= 1;
+      if(carry) value |= 1;
+      cpu_set_flags(cpu, value == 0, 0, 0, set_carry);
+      break;
+    case 0x18 ... 0x1F: // RR
+      set_carry = value & 1;
+      value >>= 1;
+      if(carry) value |= 0x80;
+      cpu_set_flags(cpu, value == 0, 0, 0, set_carry);
+      break;
+    case 0x20 ... 0x27: // SLA
+      set_carry = value >> 7;
+      value <<= 1;
+      cpu_set_flags(cpu, value == 0, 0, 0, set_carry);
+      break;
+    case 0x28 ... 0x2F: // SRA
+      set_carry = value & 1;
+      value = (value & 0x80) | (value >> 1);
+      cpu_set_flags(cpu, value == 0, 0, 0, set_carry);
+      break;
+    case 0x30 ... 0x37: // SWAP
+      value = ((value & 0xF) << 4) | ((value & 0xF0) >> 4);
+      cpu_set_flags(cpu, value == 0, 0, 0, 0);
+      break;
+    case 0x38 ... 0x3F:
+      set_carry = value & 1;
+      value >>= 1;
+      cpu_set_flags(cpu, value == 0, 0, 0, set_carry);
+      break;
+    case 0x40 ... 0x7F: // BIT
+      cpu_set_flags(cpu, (value & BIT) == 0, 0, 1, CARRYF);
+      break;
+    case 0x80 ... 0xBF: // RES
+      value &= ~BIT;
+      break;
+    case 0xC0 ... 0xFF: // SET
+      value |= BIT;
+      break;
+  }
+
+  set_r8(cpu, opcode, value);
+}
+
+#if CPU_FAST_PATHS
+int CPU_STEP(CPU *cpu, int budget) {
+#else
+int CPU_STEP(CPU *cpu) {
+#endif
+  if (cpu->error) {
+    cpu->cycles += 4;
+    return 4;
+  }
+
+  // check interrupts
+  if (cpu->ime) {
+    uint8_t *interrupt_flag = &cpu->ram->io[IF - RAM_IO];
+    uint8_t interrupt = cpu->ram->ie & *interrupt_flag;
+    if (interrupt) {
+      // no nested interrupts
+      cpu->ime = 0;
+      COUNT_INTERRUPTS(cpu->ram, interrupts_serviced, interrupt & -interrupt);
+
+      uint16_t pc = cpu->pc;
+
+      // save current pc to stack
+      cpu_push_stack(cpu, cpu->pc);
+
+      if (interrupt & INT_VBLANK) {
+        cpu->pc = 0x40;
+        *interrupt_flag &= ~INT_VBLANK;
+      } else if (interrupt & INT_LCDSTAT) {
+        cpu->pc = 0x48;
+        *interrupt_flag &= ~INT_LCDSTAT;
+      } else if (interrupt & INT_TIMER) {
+        cpu->pc = 0x50;
+        *interrupt_flag &= ~INT_TIMER;
+      } else if (interrupt & INT_SERIAL) {
+        cpu->pc = 0x58;
+        *interrupt_flag &= ~INT_SERIAL;
+      } else if (interrupt & INT_JOYPAD) {
+        cpu->pc = 0x60;
+        *interrupt_flag &= ~INT_JOYPAD;
+      } 
+
+      if (cpu->profiler)
+        profiler_interrupt(cpu->profiler, cpu, pc, cpu->pc);
+    }
+  }
+
+  if (cpu->halted) {
+    if (cpu->profiler)
+      cpu->profiler->halted += 4;
+    COUNT_ADD(cpu->ram, halt_cycles, 4);
+    cpu->cycles += 4;
+    return 4;
+  }
+
+#if CPU_DEBUG
+  // a breakpoint or the end of a step, before the instruction runs
+  if (debugger_check(cpu->debugger, cpu))
+    return 0;
+#endif
+
+  // fetch the next instruction
+  uint16_t pc = cpu->pc, sp = cpu->sp;
+  uint8_t opcode = ram_get(cpu->ram, cpu->pc);
+
+#if CPU_FAST_PATHS
+  // copy and fill loops in one go, left to single steps while traced
+  if (idiom_starts[opcode] && !cpu->trace && !cpu->profiler) {
+    int block = idiom_run(cpu, opcode, budget);
+    if (block) {
+      cpu->cycles += block;
+      return block;
+    }
+  }
+#endif
+
+  Instruction instruction = instructions[opcode];
+
+  /* trace_02(cpu, instruction); */
+  if (cpu->trace)
+    trace_record(cpu->trace, cpu);
+
+  cpu->pc += instruction.bytes;
+
+  uint8_t nn = NN;
+  uint16_t nnn = NNN;
+  uint8_t carry = CARRYF;
+
+  uint8_t cycles = instruction.cycles;
+
+  switch(opcode) {
+    case 0x00: /* NOP */ break;
+    CASE4_16(0x01) set_r16(cpu, opcode, nnn); break;
+    case 0x02: CPU_WRITE(cpu, cpu->bc, cpu->a); break;
+    CASE8_8(0x04) inc_r8(cpu, (opcode - 0x04) / 8); break;
+    CASE8_8(0x05) dec_r8(cpu, (opcode - 0x05) / 8); break;
+    CASE8_8(0x06) set_r8(cpu, (opcode - 0x06) / 8, nn); break;
+    CASE4_16(0x09) add_hl_r16(cpu, opcode); break;
+    CASE4_16(0x03) set_r16(cpu, opcode, get_r16(cpu, opcode) + 1); break;
+    CASE4_16(0x0B) set_r16(cpu, opcode, get_r16(cpu, opcode) - 1); break;
+    case 0x08: CPU_WRITE(cpu, nnn, cpu->sp & 0xFF); CPU_WRITE(cpu, nnn + 1, cpu->sp >> 8); break;
+    case 0x12: CPU_WRITE(cpu, cpu->de, cpu->a); break;
+    case 0x18: cpu->pc += (int8_t) nn; break;
+    // TODO: rewrite rotates
+    case 0x07: cpu->f = (cpu->a >> 7) << 4; cpu->a = (cpu->a << 1) | (CARRYF); break;
+    case 0x17: cpu->f = (cpu->a >> 7) << 4; cpu->a = (cpu->a << 1) | (cpu->f >> 4); break;
+    case 0x0F: cpu->f = (cpu->a & 1) << 4; cpu->a >>= 1; break;
+    case 0x1F: cpu->f = (cpu->a & 1) << 4; cpu->a = (cpu->a >> 1) | (carry << 7); break;
+    case 0x0A: case 0x1A: cpu->a = CPU_READ(cpu, get_r16(cpu, opcode)); break;
+    case 0x28: if(ZEROF) { cpu->pc += (int8_t) nn; cycles += 4; } break;
+    case 0x20: if(!(ZEROF)) { cpu->pc += (int8_t) nn; cycles += 4; } break;
+    case 0x30: if(!(CARRYF)) { cpu->pc += (int8_t) nn; cycles += 4; } break;
+    case 0x3F: cpu_set_flags(cpu, ZEROF, 0, 0, !(CARRYF)); break;
+    case 0x22: CPU_WRITE(cpu, cpu->hl++, cpu->a); break;
+    case 0x27: daa(cpu); break;
+    case 0x2A: cpu->a = CPU_READ(cpu, cpu->hl++); break;
+    case 0x3A: cpu->a = CPU_READ(cpu, cpu->hl--); break;
+    case 0x37: cpu_set_flags(cpu, ZEROF, 0, 0, 1); break;
+    case 0x2F: cpu->a = ~cpu->a; cpu_set_flags(cpu, ZEROF, 1, 1, CARRYF); break;
+    case 0x32: CPU_WRITE(cpu, cpu->hl--, cpu->a); break;
+    case 0x38: if(CARRYF) cpu->pc += (int8_t) nn; break;
+    case 0x40 ... 0x75: set_r8(cpu, (opcode - 0x40) / 8, get_r8(cpu, opcode)); break;
+    case 0x77 ... 0x7F: set_r8(cpu, (opcode - 0x40) / 8, get_r8(cpu, opcode)); break;
+    case 0x76: cpu->halted = 1; break;
+    case 0x80 ... 0x87: add_a_r8(cpu, get_r8(cpu, opcode)); break;
+    case 0x88 ... 0x8F: adc_a_r8(cpu, get_r8(cpu, opcode)); break;
+    case 0x90 ... 0x97: sub_a_r8(cpu, get_r8(cpu, opcode)); break;
+    case 0x98 ... 0x9F: sbc_a_r8(cpu, get_r8(cpu, opcode)); break;
+    case 0xA0 ... 0xA7: and_a_r8(cpu, get_r8(cpu, opcode)); break;
+    case 0xA8 ... 0xAF: xor_a_r8(cpu, get_r8(cpu, opcode)); break;
+    case 0xB0 ... 0xB7: or_a_r8(cpu, get_r8(cpu, opcode)); break;
+    case 0xB8 ... 0xBF: cp_a_r8(cpu, get_r8(cpu, opcode)); break;
+    CASE_COND_JUMP(0xC0) { cpu->pc = cpu_pop_stack(cpu); cycles += 12; } break;
+    CASE_COND_JUMP(0xC2) { cpu->pc = nnn; cycles += 4; } break;
+    CASE_COND_JUMP(0xC4) { cpu_push_stack(cpu, cpu->pc); cpu->pc = nnn; cycles += 12; } break;
+    case 0xC3: cpu->pc = nnn; break;
+    case 0xCE: adc_a_r8(cpu, nn); break;
+    case 0xC6: add_a_r8(cpu, nn); break;
+    case 0xD6: sub_a_r8(cpu, nn); break;
+    case 0xCB: cpu_cb(cpu); break;
+    case 0xC1: case 0xD1: case 0xE1: set_r16(cpu, opcode, cpu_pop_stack(cpu)); break;
+    case 0xC9: cpu->pc = cpu_pop_stack(cpu); break;
+    case 0xCD: cpu_push_stack(cpu, cpu->pc); cpu->pc = nnn; break;
+    case 0xDE: sbc_a_r8(cpu, nn); break;
+    case 0xD9: cpu->pc = cpu_pop_stack(cpu); cpu->ime = 1; break;
+    case 0xE0: CPU_WRITE(cpu, 0xFF00 + nn, cpu->a); break;
+    case 0xE2: CPU_WRITE(cpu, 0xFF00 + cpu->c, cpu->a); break;
+    case 0xE6: and_a_r8(cpu, nn); break;
+    case 0xEA: CPU_WRITE(cpu, nnn, cpu->a); break;
+    case 0xE8: add_sp(cpu, nn, &cpu->sp); break;
+    case 0xE9: cpu->pc = cpu->hl; break;
+    case 0xEE: xor_a_r8(cpu, nn); break;
+    case 0xF0: cpu->a = CPU_READ(cpu, 0xFF00 + nn); break;
+    case 0xF1: cpu->af = cpu_pop_stack(cpu) & 0xFFF0; break;
+    case 0xF2: cpu->a = CPU_READ(cpu, 0xFF00 + cpu->c); break;
+    case 0xF3: case 0xFB: cpu->ime = opcode == 0xFB; break;
+    case 0xF6: or_a_r8(cpu, nn); break;
+    case 0xF8: add_sp(cpu, nn, &cpu->hl); break;
+    case 0xFA: cpu->a = CPU_READ(cpu, nnn); break;
+    case 0xFE: cp_a_r8(cpu, nn); break;
+    case 0xC5: case 0xD5: case 0xE5: cpu_push_stack(cpu, get_r16(cpu, opcode)); break;
+    case 0xF5: cpu_push_stack(cpu, cpu->af); break;
+    case 0xF9: cpu->sp = cpu->hl; break;
+    CASE8_8(0xC7) { cpu_push_stack(cpu, cpu->pc); cpu->pc = opcode & 0x38; } break;
+    default:
+      cpu->error = CPU_UNKNOWN_OPCODE;
+      cpu->error_pc = pc;
+      cpu->error_opcode = opcode;
+      cpu->pc = pc;
+      cycles = 4;
+      break;
+  }
+
+  if (cpu->profiler)
+    profiler_record(cpu->profiler, cpu, pc, sp, opcode, cycles);
+
+  cpu->cycles += cycles;
+  return cycles;
+}
+
+#undef cpu_push_stack
+#undef cpu_pop_stack
+#undef get_r8
+#undef set_r8
+#undef inc_r8
+#undef dec_r8
+#undef cpu_cb
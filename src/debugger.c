@@ -0,0 +1,187 @@
+#include <string.h>
+
+#include "debugger.h"
+#include "instructions.h"
+
+static inline int debugger_bit(const uint64_t *bitmap, uint16_t address) {
+  return (bitmap[address >> 6] >> (address & 63)) & 1;
+}
+
+static inline void debugger_set_bit(uint64_t *bitmap, uint16_t address, int value) {
+  uint64_t mask = 1ULL << (address & 63);
+  bitmap[address >> 6] = value ? bitmap[address >> 6] | mask : bitmap[address >> 6] & ~mask;
+}
+
+void debugger_init(Debugger *debugger) {
+  memset(debugger, 0, sizeof(Debugger));
+}
+
+/** whether the emulator has to run cpu_step_debug */
+int debugger_armed(Debugger *debugger) {
+  return debugger->breakpoint_count || debugger->condition_count ||
+         debugger->watchpoint_count || debugger->mode != DEBUGGER_CONTINUE ||
+         debugger->stop != DEBUGGER_RUNNING;
+}
+
+void debugger_break(Debugger *debugger, uint16_t address) {
+  if (!debugger_bit(debugger->breakpoints, address))
+    debugger->breakpoint_count++;
+  debugger_set_bit(debugger->breakpoints, address, 1);
+}
+
+/**
+ * Breaks at `address` only when `condition` returns non-zero. Returns -1
+ * when DEBUGGER_MAX_CONDITIONS are already set.
+ */
+int debugger_break_if(Debugger *debugger, uint16_t address, DebuggerCondition condition,
+                      void *data) {
+  if (debugger->condition_count == DEBUGGER_MAX_CONDITIONS)
+    return -1;
+
+  DebuggerBreakpoint *breakpoint = &debugger->conditions[debugger->condition_count++];
+  breakpoint->address = address;
+  breakpoint->condition = condition;
+  breakpoint->data = data;
+
+  debugger_set_bit(debugger->conditional, address, 1);
+  return 0;
+}
+
+/** removes the breakpoint at `address` and all its conditions */
+void debugger_clear_break(Debugger *debugger, uint16_t address) {
+  if (debugger_bit(debugger->breakpoints, address))
+    debugger->breakpoint_count--;
+  debugger_set_bit(debugger->breakpoints, address, 0);
+  debugger_set_bit(debugger->conditional, address, 0);
+
+  int kept = 0;
+  for (int i = 0; i < debugger->condition_count; i++) {
+    if (debugger->conditions[i].address != address)
+      debugger->conditions[kept++] = debugger->conditions[i];
+  }
+  debugger->condition_count = kept;
+}
+
+static void debugger_mark(Debugger *debugger) {
+  memset(debugger->watched, 0, sizeof(debugger->watched));
+
+  for (int i = 0; i < debugger->watchpoint_count; i++) {
+    DebuggerWatchpoint *watchpoint = &debugger->watchpoints[i];
+    for (uint32_t address = watchpoint->start; address <= watchpoint->end; address++)
+      debugger->watched[address] |= watchpoint->access;
+  }
+}
+
+/**
+ * Watches `start` to `end` inclusive for DEBUGGER_READ and/or
+ * DEBUGGER_WRITE. Returns -1 for an empty range or when
+ * DEBUGGER_MAX_WATCHPOINTS are already set.
+ */
+int debugger_watch(Debugger *debugger, uint16_t start, uint16_t end, uint8_t access) {
+  access &= DEBUGGER_READ | DEBUGGER_WRITE;
+  if (start > end || !access || debugger->watchpoint_count == DEBUGGER_MAX_WATCHPOINTS)
+    return -1;
+
+  DebuggerWatchpoint *watchpoint = &debugger->watchpoints[debugger->watchpoint_count++];
+  watchpoint->start = start;
+  watchpoint->end = end;
+  watchpoint->access = access;
+
+  debugger_mark(debugger);
+  return 0;
+}
+
+/** removes the watchpoints set on exactly `start` to `end` */
+void debugger_unwatch(Debugger *debugger, uint16_t start, uint16_t end) {
+  int kept = 0;
+  for (int i = 0; i < debugger->watchpoint_count; i++) {
+    DebuggerWatchpoint *watchpoint = &debugger->watchpoints[i];
+    if (watchpoint->start != start || watchpoint->end != end)
+      debugger->watchpoints[kept++] = *watchpoint;
+  }
+  debugger->watchpoint_count = kept;
+
+  debugger_mark(debugger);
+}
+
+static void debugger_resume(Debugger *debugger, DebuggerMode mode) {
+  debugger->mode = mode;
+  debugger->stop = DEBUGGER_RUNNING;
+  debugger->resuming = 1;
+}
+
+void debugger_continue(Debugger *debugger) {
+  debugger_resume(debugger, DEBUGGER_CONTINUE);
+}
+
+/** runs one instruction (or waits out HALT) and stops */
+void debugger_step(Debugger *debugger) {
+  debugger_resume(debugger, DEBUGGER_STEP);
+}
+
+/**
+ * Like debugger_step, but a CALL or RST runs until it returns: the PC is
+ * back after it with the stack no deeper than before.
+ */
+void debugger_step_over(Debugger *debugger, CPU *cpu) {
+  uint8_t opcode = cpu_memory_get(cpu, cpu->pc);
+  int call = opcode == 0xCD || (opcode & 0xE7) == 0xC4 || (opcode & 0xC7) == 0xC7;
+
+  if (!call) {
+    debugger_step(debugger);
+    return;
+  }
+
+  debugger->return_pc = cpu->pc + instructions[opcode].bytes;
+  debugger->return_sp = cpu->sp;
+  debugger_resume(debugger, DEBUGGER_STEP_OVER);
+}
+
+static int debugger_stop(Debugger *debugger, DebuggerStop stop) {
+  debugger->stop = stop;
+  debugger->mode = DEBUGGER_CONTINUE;
+  return 1;
+}
+
+static int debugger_condition(Debugger *debugger, CPU *cpu) {
+  for (int i = 0; i < debugger->condition_count; i++) {
+    DebuggerBreakpoint *breakpoint = &debugger->conditions[i];
+    if (breakpoint->address == cpu->pc && breakpoint->condition(cpu, breakpoint->data))
+      return 1;
+  }
+
+  return 0;
+}
+
+/** before each instruction, returns 1 to stop in front of it */
+int debugger_check(Debugger *debugger, CPU *cpu) {
+  uint16_t pc = cpu->pc;
+  debugger->pc = pc;
+
+  if (debugger->resuming) {
+    debugger->resuming = 0;
+    return 0;
+  }
+
+  if (debugger->mode == DEBUGGER_STEP ||
+      (debugger->mode == DEBUGGER_STEP_OVER && pc == debugger->return_pc &&
+       cpu->sp >= debugger->return_sp))
+    return debugger_stop(debugger, DEBUGGER_STEPPED);
+
+  if (debugger_bit(debugger->breakpoints, pc) ||
+      (debugger_bit(debugger->conditional, pc) && debugger_condition(debugger, cpu)))
+    return debugger_stop(debugger, DEBUGGER_BREAKPOINT);
+
+  return 0;
+}
+
+/** a watched access; the first one in an instruction is the one reported */
+void debugger_hit(Debugger *debugger, uint16_t address, uint8_t value, uint8_t access) {
+  if (debugger->stop != DEBUGGER_RUNNING)
+    return;
+
+  debugger_stop(debugger, DEBUGGER_WATCHPOINT);
+  debugger->address = address;
+  debugger->value = value;
+  debugger->access = access;
+}
@@ -1,49 +1,249 @@
+#include <errno.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "debugger.h"
 #include "emulator.h"
 
-#define MAX_CYCLES 70224
 const uint16_t freqs[] = { 1024, 16, 64, 256 };
 
-static void *load_rom(uint8_t *rom, char *filename) {
+#define ROM_MIN_SIZE 0x8000
+#define ROM_MAX_SIZE 0x200000
+
+/**
+ * Copies a ROM dump into a fresh image padded with zeros to a power of two
+ * of at least 32KB (and cut at 2MB), so banks can be masked instead of
+ * checked. The image is read-only from then on and any number of instances
+ * can share it; free() it after the last one is done.
+ */
+uint8_t *emulator_rom_image(const uint8_t *data, size_t size, size_t *image_size) {
+  if (size > ROM_MAX_SIZE)
+    size = ROM_MAX_SIZE;
+
+  size_t padded = ROM_MIN_SIZE;
+  while (padded < size)
+    padded <<= 1;
+
+  uint8_t *image = calloc(1, padded);
+  if (image == NULL)
+    return NULL;
+
+  memcpy(image, data, size);
+  *image_size = padded;
+  return image;
+}
+
+/** emulator_rom_image from a file, NULL with errno set on failure */
+uint8_t *emulator_rom_load(const char *filename, size_t *image_size) {
   FILE *f = fopen(filename, "rb");
-  fread(rom, 1, 0x200000, f);
+  if (f == NULL)
+    return NULL;
+
+  uint8_t *data = malloc(ROM_MAX_SIZE);
+  size_t size = data ? fread(data, 1, ROM_MAX_SIZE, f) : 0;
   fclose(f);
 
-  return rom;
+  uint8_t *image = size ? emulator_rom_image(data, size, image_size) : NULL;
+  if (size == 0)
+    errno = EINVAL;
+
+  free(data);
+  return image;
 }
 
-void emulator_init(Emulator *emulator, char *filename) {
-  load_rom(emulator->rom, filename);
+static int emulator_reset(Emulator *emulator) {
+  memset(&emulator->cpu, 0, sizeof(emulator->cpu));
+  memset(&emulator->gpu, 0, sizeof(emulator->gpu));
+  memset(&emulator->ram, 0, sizeof(emulator->ram));
+  memset(&emulator->input, 0, sizeof(emulator->input));
+
+  if (ram_init(&emulator->ram, &emulator->input, emulator->rom, emulator->rom_size) != 0)
+    return -1;
 
-  ram_init(&emulator->ram, &emulator->input, emulator->rom);
   cpu_init(&emulator->cpu, &emulator->ram);
   gpu_init(&emulator->gpu, &emulator->cpu, emulator->cpu.ram);
+  apu_init(&emulator->apu, emulator->ram.io);
+  emulator->ram.apu = &emulator->apu;
+  serial_init(&emulator->serial, emulator->ram.io, &emulator->cpu);
+  emulator->ram.serial = &emulator->serial;
+
+  emulator->div = 0;
+  emulator->tima = 0;
+  emulator->cycles = 0;
+  emulator->instructions = 0;
+  emulator->reference_core = 0;
+  return 0;
+}
+
+/** returns -1 (with errno set) when the ROM can't be read */
+int emulator_init(Emulator *emulator, char *filename) {
+  size_t size;
+  uint8_t *image = emulator_rom_load(filename, &size);
+  if (image == NULL)
+    return -1;
+
+  if (emulator_init_rom(emulator, image, size) != 0) {
+    free(image);
+    return -1;
+  }
+
+  emulator->rom_owned = image;
+  return 0;
+}
+
+/**
+ * Same as emulator_init, sharing an image from emulator_rom_image. The
+ * image is not copied and must outlive the emulator. Call emulator_free
+ * before initialising an emulator again.
+ */
+int emulator_init_rom(Emulator *emulator, const uint8_t *image, size_t size) {
+  // a power of two between 32KB and 2MB
+  if (size < ROM_MIN_SIZE || size > ROM_MAX_SIZE || (size & (size - 1)))
+    return -1;
+
+  emulator->rom = image;
+  emulator->rom_size = size;
+  emulator->rom_owned = NULL;
+  return emulator_reset(emulator);
+}
+
+/** frees cartridge RAM, and the ROM image if emulator_init loaded it */
+void emulator_free(Emulator *emulator) {
+  ram_free(&emulator->ram);
+  free(emulator->rom_owned);
+  emulator->rom_owned = NULL;
+  emulator->rom = NULL;
+}
+
+static inline int emulator_clock(Emulator *emulator, int cycles) {
+  emulator->instructions++;
+  emulator_update_timers(emulator, cycles);
+  gpu_step(&emulator->gpu, cycles);
+  emulator->apu.pending += cycles;
+  if (emulator->serial.timer)
+    serial_step(&emulator->serial, cycles);
+  return cycles;
+}
+
+/** one CPU step; a fast path block stays within `budget` */
+static inline int emulator_tick(Emulator *emulator, int budget) {
+  return emulator_clock(emulator, emulator->reference_core
+                                      ? cpu_step_reference(&emulator->cpu)
+                                      : cpu_step(&emulator->cpu, budget));
+}
+
+/** emulator_run_cycles on cpu_step_debug, until the debugger stops */
+static int emulator_run_debug(Emulator *emulator, int budget) {
+  Debugger *debugger = emulator->cpu.debugger;
+  int cyclesThisUpdate = 0;
+
+  while (cyclesThisUpdate < budget && !emulator->cpu.error &&
+         debugger->stop == DEBUGGER_RUNNING) {
+    int cycles = cpu_step_debug(&emulator->cpu);
+    if (cycles == 0)
+      break;
+    cyclesThisUpdate += emulator_clock(emulator, cycles);
+  }
+
+  apu_sync(&emulator->apu);
+  emulator->cycles += cyclesThisUpdate;
+  return cyclesThisUpdate;
 }
 
-void emulator_step(Emulator *emulator) {
+static inline int emulator_debugging(Emulator *emulator) {
+  return emulator->cpu.debugger && debugger_armed(emulator->cpu.debugger);
+}
+
+/**
+ * Runs whole instructions until at least `budget` cycles have passed, or
+ * the CPU hits an error or an armed debugger stops. Returns how many cycles
+ * actually ran.
+ */
+int emulator_run_cycles(Emulator *emulator, int budget) {
+  if (emulator_debugging(emulator))
+    return emulator_run_debug(emulator, budget);
+
   int cyclesThisUpdate = 0;
 
-  while (cyclesThisUpdate < MAX_CYCLES) {
-    int cycles = cpu_step(&emulator->cpu);
-    cyclesThisUpdate += cycles;
-    emulator_update_timers(emulator, cycles);
-    gpu_step(&emulator->gpu, cycles);
+  while (cyclesThisUpdate < budget && !emulator->cpu.error) {
+    cyclesThisUpdate += emulator_tick(emulator, budget - cyclesThisUpdate);
+  }
+
+  apu_sync(&emulator->apu);
+  emulator->cycles += cyclesThisUpdate;
+  return cyclesThisUpdate;
+}
+
+/**
+ * Runs a single CPU step, one instruction or one fast path block, and the
+ * hardware it clocks. Returns the cycles it took.
+ */
+int emulator_run_instruction(Emulator *emulator) {
+  if (emulator_debugging(emulator))
+    return emulator_run_debug(emulator, 1);
+
+  int cycles = emulator_tick(emulator, INT_MAX);
+  apu_sync(&emulator->apu);
+  emulator->cycles += cycles;
+  return cycles;
+}
+
+/** runs one frame worth of cycles, returns how many actually ran */
+int emulator_step(Emulator *emulator) {
+  return emulator_run_cycles(emulator, FRAME_CYCLES);
+}
+
+/** sets the joypad, newly pressed buttons raise the joypad interrupt */
+void emulator_set_input(Emulator *emulator, uint8_t mask) {
+  if (mask & ~input_mask(&emulator->input))
+    cpu_interrupt(&emulator->cpu, INT_JOYPAD);
+  input_set(&emulator->input, mask);
+}
+
+/**
+ * Runs one real frame, then `frames` more with the same input and rolls
+ * back through a save state kept in `state` (STATE_MAX_SIZE bytes), leaving
+ * the last speculative frame in the framebuffer. This hides the game's own
+ * input lag: what's shown is where the current input leads.
+ */
+void emulator_run_ahead(Emulator *emulator, uint8_t *state, int frames) {
+  emulator_step(emulator);
+
+  if (frames <= 0)
+    return;
+
+  size_t size = emulator_save_state(emulator, state);
+
+  // speculative frames are not heard
+  APUSynth *synth = emulator->apu.synth;
+  emulator->apu.synth = NULL;
+
+  for (int i = 0; i < frames; i++) {
+    emulator_step(emulator);
   }
+
+  emulator_load_state(emulator, state, size);
+  emulator->apu.synth = synth;
 }
 
+/**
+ * Counts `cycles` into DIV and TIMA. Any number of cycles at once gives the
+ * same result as the same total in single instructions, so fast path blocks
+ * can be clocked in one call.
+ */
 void emulator_update_timers(Emulator *emulator, int cycles) {
   uint8_t timer_attrs = ram_get(emulator->cpu.ram, MEM_TAC);
   uint8_t div = ram_get(emulator->cpu.ram, MEM_DIV);
   uint8_t tima = ram_get(emulator->cpu.ram, MEM_TIMA);
   uint8_t tma = ram_get(emulator->cpu.ram, MEM_TMA);
-  
+
   emulator->div += cycles;
   if (emulator->div >= 256) {
-    emulator->div = 0;
-    ram_set(emulator->cpu.ram, MEM_DIV, div + 1);
+    ram_set(emulator->cpu.ram, MEM_DIV, div + emulator->div / 256);
+    emulator->div %= 256;
   }
 
   if (timer_attrs & 0x04) {
@@ -53,15 +253,17 @@ void emulator_update_timers(Emulator *emulator, int cycles) {
     uint16_t clock_speed = freqs[freq];
 
     if (emulator->tima >= clock_speed) {
-      emulator->tima = 0;
-      ram_set(emulator->cpu.ram, MEM_TIMA, tima + 1);
+      while (emulator->tima >= clock_speed) {
+        emulator->tima -= clock_speed;
 
-      // if TIMA overflows, reset to TMA and trigger interrupt
-      if (tima == 0xFF) {
-        ram_set(emulator->cpu.ram, MEM_TIMA, tma);
-        cpu_interrupt(&emulator->cpu, INT_TIMER);
+        // if TIMA overflows, reset to TMA and trigger interrupt
+        if (tima++ == 0xFF) {
+          tima = tma;
+          cpu_interrupt(&emulator->cpu, INT_TIMER);
+        }
       }
+
+      ram_set(emulator->cpu.ram, MEM_TIMA, tima);
     }
   }
-
 }
@@ -2,14 +2,71 @@
 #include "ram.h"
 
 #include <SDL2/SDL.h>
-
-void frontend_draw_tiles(Frontend *frontend, uint8_t *mem);
-void frontend_draw_sprites(Frontend *frontend, uint8_t *mem);
+#include <string.h>
 
 #define SCALE 4
+#define VIEWER_SCALE 2
+
+#define TRIPLE_FRESH 0x04
+
+// frames per device callback, about 5ms, and what the ring holds
+#define AUDIO_DEVICE_FRAMES 256
+#define AUDIO_RING_FRAMES 4096
+// queued right after a frame's samples; a frame drains about 800 of them,
+// which leaves a callback's worth for clocks up to 0.3% apart, and about
+// 30ms of latency in all
+#define AUDIO_TARGET_FRAMES 1400
+
+// the DMG refresh, about 59.73Hz
+#define DMG_REFRESH ((double)CLOCKSPEED / FRAME_CYCLES)
+// how far the display may be off it for emulation to follow vsync, within
+// what the synth's rate control can take up
+#define DISPLAY_TOLERANCE 0.005
+// frames between checks that vsync really comes at that rate
+#define DISPLAY_CHECK_FRAMES 120
+
+static int frontend_near_refresh(double hz) {
+  double ratio = hz / DMG_REFRESH;
+  return ratio > 1 - DISPLAY_TOLERANCE && ratio < 1 + DISPLAY_TOLERANCE;
+}
+
+/** device callback: drains the ring, an underrun plays silence */
+static void frontend_audio(void *data, Uint8 *stream, int length) {
+  AudioRing *ring = data;
+  int16_t *frames = (int16_t *)stream;
+  size_t count = length / (2 * sizeof(int16_t));
+  size_t read = ring_read(ring, frames, count);
+
+  memset(&frames[read * 2], 0, (count - read) * 2 * sizeof(int16_t));
+}
+
+static void frontend_open_audio(Frontend *frontend) {
+  frontend->audio = 0;
+  if (ring_init(&frontend->audio_ring, AUDIO_RING_FRAMES) != 0)
+    return;
+
+  SDL_AudioSpec want, have;
+  SDL_zero(want);
+  want.freq = APU_SAMPLE_RATE;
+  want.format = AUDIO_S16SYS;
+  want.channels = 2;
+  want.samples = AUDIO_DEVICE_FRAMES;
+  want.callback = frontend_audio;
+  want.userdata = &frontend->audio_ring;
+
+  frontend->audio = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+  if (frontend->audio == 0) {
+    SDL_Log("No sound: %s", SDL_GetError());
+    ring_free(&frontend->audio_ring);
+    return;
+  }
+
+  apu_synth_init(&frontend->synth, &frontend->audio_ring);
+  frontend->synth.target = AUDIO_TARGET_FRAMES;
+}
 
 void frontend_init(Frontend *frontend) {
-  if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+  if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
     SDL_Log("Unable to initialize SDL: %s", SDL_GetError());
     SDL_Quit();
   }
@@ -26,83 +83,177 @@ void frontend_init(Frontend *frontend) {
   SDL_Renderer *renderer = SDL_CreateRenderer(
       window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 
+  // a display close to the DMG's rate paces emulation with vsync, one
+  // frame per refresh; anything else leaves it to the limiter
+  SDL_RendererInfo info;
+  SDL_DisplayMode mode;
+  frontend->display_synced =
+      SDL_GetRendererInfo(renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC) &&
+      SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 &&
+      frontend_near_refresh(mode.refresh_rate);
+  frontend->vsync = frontend->display_synced ? SDL_CreateSemaphore(0) : NULL;
+  if (frontend->vsync == NULL)
+    frontend->display_synced = 0;
+
   SDL_Texture *texture = SDL_CreateTexture(
       renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, 160, 144);
 
+  frontend->window = window;
   frontend->renderer = renderer;
   frontend->texture = texture;
+
+  frontend_open_audio(frontend);
+
+  frontend->buffer.back = 0;
+  frontend->buffer.state = 1;
+  frontend->buffer.front = 2;
+
+  frontend->input = 0;
+  frontend->running = 1;
+  frontend->rewinding = 0;
+  frontend->rewind.arena = NULL;
+  frontend->tracing = 0;
+  frontend->viewing = 0;
+  frontend->viewer_window = NULL;
+  frontend->trace.header = NULL;
+  frontend->stats = 0;
+  frontend->run_ahead = 0;
+}
+
+/** producer side: hand the back slot over and take the old middle one */
+static void triple_buffer_publish(TripleBuffer *buffer) {
+  int old = __atomic_exchange_n(&buffer->state, buffer->back | TRIPLE_FRESH,
+                                __ATOMIC_ACQ_REL);
+  buffer->back = old & 0x03;
+}
+
+/** consumer side: returns 1 and swaps in the newest frame, if there is one */
+static int triple_buffer_acquire(TripleBuffer *buffer) {
+  if (!(__atomic_load_n(&buffer->state, __ATOMIC_ACQUIRE) & TRIPLE_FRESH))
+    return 0;
+
+  int old = __atomic_exchange_n(&buffer->state, buffer->front, __ATOMIC_ACQ_REL);
+  buffer->front = old & 0x03;
+
+  return 1;
+}
+
+static uint8_t frontend_key_mask(SDL_Keycode key) {
+  switch (key) {
+  case SDLK_UP:
+    return INPUT_UP;
+  case SDLK_DOWN:
+    return INPUT_DOWN;
+  case SDLK_LEFT:
+    return INPUT_LEFT;
+  case SDLK_RIGHT:
+    return INPUT_RIGHT;
+  case SDLK_z:
+    return INPUT_A;
+  case SDLK_x:
+    return INPUT_B;
+  case SDLK_RETURN:
+    return INPUT_START;
+  case SDLK_BACKSPACE:
+    return INPUT_SELECT;
+  default:
+    return 0;
+  }
+}
+
+static void frontend_open_viewer(Frontend *frontend) {
+  if (frontend->viewer_window == NULL) {
+    SDL_Window *window = SDL_CreateWindow(
+        "leekboy debug", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+        VIEWER_WIDTH * VIEWER_SCALE, VIEWER_HEIGHT * VIEWER_SCALE, SDL_WINDOW_SHOWN);
+    if (window == NULL) {
+      printf("Debug window creation failed: %s\n", SDL_GetError());
+      return;
+    }
+
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    frontend->viewer_window = window;
+    frontend->viewer_renderer = renderer;
+    frontend->viewer_texture =
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                          SDL_TEXTUREACCESS_STREAMING, VIEWER_WIDTH, VIEWER_HEIGHT);
+  } else {
+    SDL_ShowWindow(frontend->viewer_window);
+  }
+
+  __atomic_store_n(&frontend->viewing, 1, __ATOMIC_RELEASE);
+}
+
+static void frontend_close_viewer(Frontend *frontend) {
+  __atomic_store_n(&frontend->viewing, 0, __ATOMIC_RELEASE);
+  if (frontend->viewer_window)
+    SDL_HideWindow(frontend->viewer_window);
+}
+
+/** decodes straight into the streaming texture, one upload per frame */
+static void frontend_draw_viewer(Frontend *frontend) {
+  void *pixels;
+  int pitch;
+
+  if (SDL_LockTexture(frontend->viewer_texture, NULL, &pixels, &pitch) != 0)
+    return;
+  viewer_draw(&frontend->buffer.memory[frontend->buffer.front], pixels,
+              pitch / sizeof(uint32_t));
+  SDL_UnlockTexture(frontend->viewer_texture);
+
+  SDL_RenderCopy(frontend->viewer_renderer, frontend->viewer_texture, NULL, NULL);
+  SDL_RenderPresent(frontend->viewer_renderer);
 }
 
-void frontend_update(Frontend *frontend, Emulator *emulator) {
-  uint8_t should_interrupt = 0;
+void frontend_update(Frontend *frontend) {
+  uint8_t input = __atomic_load_n(&frontend->input, __ATOMIC_RELAXED);
 
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     if (event.type == SDL_QUIT) {
-      SDL_Quit();
-      exit(0);
+      __atomic_store_n(&frontend->running, 0, __ATOMIC_RELEASE);
+      return;
+    }
+
+    // with two windows open, closing one doesn't send SDL_QUIT
+    if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE) {
+      if (frontend->viewer_window &&
+          event.window.windowID == SDL_GetWindowID(frontend->viewer_window)) {
+        frontend_close_viewer(frontend);
+      } else {
+        __atomic_store_n(&frontend->running, 0, __ATOMIC_RELEASE);
+        return;
+      }
     }
 
     if (event.type == SDL_KEYDOWN) {
-      should_interrupt = 1;
-      switch (event.key.keysym.sym) {
-      case SDLK_UP:
-        emulator->input.up = 1;
-        break;
-      case SDLK_DOWN:
-        emulator->input.down = 1;
-        break;
-      case SDLK_LEFT:
-        emulator->input.left = 1;
-        break;
-      case SDLK_RIGHT:
-        emulator->input.right = 1;
-        break;
-      case SDLK_z:
-        emulator->input.a = 1;
-        break;
-      case SDLK_x:
-        emulator->input.b = 1;
-        break;
-      case SDLK_RETURN:
-        emulator->input.start = 1;
-        break;
-      case SDLK_BACKSPACE:
-        emulator->input.select = 1;
-        break;
+      input |= frontend_key_mask(event.key.keysym.sym);
+      if (event.key.keysym.sym == SDLK_r)
+        __atomic_store_n(&frontend->rewinding, 1, __ATOMIC_RELEASE);
+      if (event.key.keysym.sym == SDLK_F1 && !event.key.repeat)
+        __atomic_xor_fetch(&frontend->tracing, 1, __ATOMIC_ACQ_REL);
+      if (event.key.keysym.sym == SDLK_F2 && !event.key.repeat) {
+        if (__atomic_load_n(&frontend->viewing, __ATOMIC_ACQUIRE))
+          frontend_close_viewer(frontend);
+        else
+          frontend_open_viewer(frontend);
       }
     } else if (event.type == SDL_KEYUP) {
-      switch (event.key.keysym.sym) {
-      case SDLK_UP:
-        emulator->input.up = 0;
-        break;
-      case SDLK_DOWN:
-        emulator->input.down = 0;
-        break;
-      case SDLK_LEFT:
-        emulator->input.left = 0;
-        break;
-      case SDLK_RIGHT:
-        emulator->input.right = 0;
-        break;
-      case SDLK_z:
-        emulator->input.a = 0;
-        break;
-      case SDLK_x:
-        emulator->input.b = 0;
-        break;
-      case SDLK_RETURN:
-        emulator->input.start = 0;
-        break;
-      case SDLK_BACKSPACE:
-        emulator->input.select = 0;
-        break;
-      }
+      input &= ~frontend_key_mask(event.key.keysym.sym);
+      if (event.key.keysym.sym == SDLK_r)
+        __atomic_store_n(&frontend->rewinding, 0, __ATOMIC_RELEASE);
     }
   }
 
-  if (should_interrupt)
-    cpu_interrupt(&emulator->cpu, INT_JOYPAD);
+  __atomic_store_n(&frontend->input, input, __ATOMIC_RELEASE);
+
+  // paced by vsync, every refresh is presented, a late frame again
+  int synced = __atomic_load_n(&frontend->display_synced, __ATOMIC_ACQUIRE);
+  if (!triple_buffer_acquire(&frontend->buffer) && !synced) {
+    // nothing new to show, don't burn a present on the same frame
+    SDL_Delay(1);
+    return;
+  }
 
   // draw
   SDL_SetRenderDrawColor(frontend->renderer, 0, 0, 0, 255);
@@ -115,69 +266,158 @@ void frontend_update(Frontend *frontend, Emulator *emulator) {
   rect.w = 160 * SCALE;
   rect.h = 144 * SCALE;
 
-  SDL_UpdateTexture(frontend->texture, NULL, emulator->gpu.framebuffer,
+  SDL_UpdateTexture(frontend->texture, NULL,
+                    frontend->buffer.frames[frontend->buffer.front],
                     160 * sizeof(uint32_t));
   SDL_RenderCopy(frontend->renderer, frontend->texture, NULL, &rect);
 
-  /* frontend_draw_tiles(frontend, emulator->cpu.ram->data + 0x8000); */
-  /* frontend_draw_sprites(frontend, emulator->cpu.ram->data); */
-
   SDL_RenderPresent(frontend->renderer);
+
+  // a refresh has gone by, the emulation thread may run one frame; at most
+  // one is owed, so a slow frame isn't followed by a burst
+  if (synced && SDL_SemValue(frontend->vsync) == 0)
+    SDL_SemPost(frontend->vsync);
+
+  if (__atomic_load_n(&frontend->viewing, __ATOMIC_ACQUIRE))
+    frontend_draw_viewer(frontend);
 }
 
-void frontend_run(Frontend *frontend, Emulator *emulator) {
-  while (1) {
-    frontend_update(frontend, emulator);
-    emulator_step(emulator);
+/**
+ * Waits out the rest of the frame: for the next vsync when the display is
+ * close enough to the DMG's rate, otherwise until the limiter's deadline.
+ * Vsync that turns out not to come at that rate (forced off by the driver,
+ * a variable refresh) hands pacing back to the limiter for good.
+ */
+static void frontend_pace(Frontend *frontend) {
+  if (!frontend->display_synced) {
+    limiter_wait(&frontend->limiter);
+    return;
   }
+
+  uint64_t produced = limiter_now();
+  SDL_SemWait(frontend->vsync);
+  limiter_follow(&frontend->limiter, produced);
+
+  if (++frontend->sync_frames < DISPLAY_CHECK_FRAMES)
+    return;
+
+  uint64_t now = limiter_now();
+  double hz = frontend->sync_frames * 1e9 / (now - frontend->sync_start);
+  if (!frontend_near_refresh(hz)) {
+    SDL_Log("Display refreshes at %.2fHz, pacing by the clock instead", hz);
+    __atomic_store_n(&frontend->display_synced, 0, __ATOMIC_RELEASE);
+  }
+
+  frontend->sync_frames = 0;
+  frontend->sync_start = now;
 }
 
-void frontend_draw_tiles(Frontend *frontend, uint8_t *mem) {
-  int xOffset = 160 * 2 + 8;
-  int tilesPerRow = 16;
-  for (int tile = 0; tile < 0x100; tile++) {
-    for (int row = 0; row < 16; row += 2) {
-      uint8_t left = mem[row + tile * 16];
-      uint8_t right = mem[row + 1 + tile * 16];
-
-      for (int col = 0; col < 8; col++) {
-        uint8_t c = ((left >> col) << 1 | (right >> col)) & 0b11;
-        uint8_t colors[] = {0xFF, 0xAA, 0x55, 0x00};
-
-        SDL_SetRenderDrawColor(frontend->renderer, colors[c], colors[c],
-                               colors[c], 255);
-        SDL_RenderDrawPoint(frontend->renderer,
-                            xOffset + col + tile % tilesPerRow * 8,
-                            tile / tilesPerRow * 8 + row / 2);
+/**
+ * Emulation thread: runs frames at the DMG refresh rate, one per vsync on a
+ * display within DISPLAY_TOLERANCE of it, else off the monotonic clock.
+ */
+static int frontend_emulate(void *data) {
+  Frontend *frontend = data;
+  Emulator *emulator = frontend->emulator;
+
+  limiter_init(&frontend->limiter, FRAME_CYCLES, CLOCKSPEED);
+  frontend->sync_start = limiter_now();
+  frontend->sync_frames = 0;
+  if (frontend->stats)
+    printf("pacing: %s\n", frontend->display_synced ? "vsync" : "clock");
+
+  while (__atomic_load_n(&frontend->running, __ATOMIC_ACQUIRE)) {
+    uint8_t input = __atomic_load_n(&frontend->input, __ATOMIC_ACQUIRE);
+    if (frontend->movie)
+      movie_record_input(frontend->movie, emulator, input);
+    else
+      emulator_set_input(emulator, input);
+
+    int tracing = __atomic_load_n(&frontend->tracing, __ATOMIC_ACQUIRE);
+    emulator->cpu.trace = tracing && frontend->trace.header ? &frontend->trace : NULL;
+
+    Rewind *rewind = frontend->rewind.arena ? &frontend->rewind : NULL;
+
+    if (rewind && __atomic_load_n(&frontend->rewinding, __ATOMIC_ACQUIRE)) {
+      // run the restored frame to draw it, stay put once out of history
+      if (rewind_pop(rewind, emulator) == 0) {
+        if (frontend->movie)
+          movie_truncate(frontend->movie, emulator->cycles);
+        emulator_step(emulator);
       }
+    } else {
+      emulator_run_ahead(emulator, frontend->state, frontend->run_ahead);
+
+      if (rewind)
+        rewind_push(rewind, emulator);
+    }
+
+    // the frame's samples are all in the ring, where the target is measured
+    if (frontend->audio)
+      apu_synth_steer(&frontend->synth);
+
+    if (frontend->movie && movie_record_frame(frontend->movie, emulator) != 0) {
+      fprintf(stderr, "Could not allocate movie, recording stopped\n");
+      frontend->movie = NULL;
+    }
+
+    if (emulator->cpu.error) {
+      fprintf(stderr, "Unknown opcode: 0x%02X at 0x%04X\n", emulator->cpu.error_opcode,
+              emulator->cpu.error_pc);
+      __atomic_store_n(&frontend->running, 0, __ATOMIC_RELEASE);
+      break;
+    }
+
+    uint32_t *frame = frontend->buffer.frames[frontend->buffer.back];
+    for (int i = 0; i < FRAME_PIXELS; i++) {
+      frame[i] = gpu_colors[emulator->gpu.framebuffer[i]];
+    }
+    if (__atomic_load_n(&frontend->viewing, __ATOMIC_ACQUIRE))
+      viewer_capture(&frontend->buffer.memory[frontend->buffer.back], &emulator->ram);
+    triple_buffer_publish(&frontend->buffer);
+
+    frontend_pace(frontend);
+
+    if (frontend->stats && frontend->limiter.frames == 60) {
+      if (frontend->audio)
+        printf("audio: %zu frames queued, rate %+.3f%%\n", ring_level(&frontend->audio_ring),
+               ((double)frontend->synth.factor / frontend->synth.rate - 1) * 100);
+      limiter_report(&frontend->limiter, stdout);
     }
   }
 
-  SDL_RenderPresent(frontend->renderer);
+  return 0;
 }
 
-void frontend_draw_sprites(Frontend *frontend, uint8_t *mem) {
-  int xOffset = 160 * 2 + 8;
-  int yOffset = 144 * 2 + 8;
-  int spritesPerRow = 10;
+void frontend_run(Frontend *frontend, Emulator *emulator) {
+  frontend->emulator = emulator;
 
-  for (int sprite = 0; sprite < 40; sprite++) {
-    uint8_t tile = mem[0xfe00 + sprite * 4 + 2];
+  if (frontend->audio) {
+    // start at the target latency instead of climbing to it slowly
+    static const int16_t silence[AUDIO_TARGET_FRAMES * 2];
+    ring_write(&frontend->audio_ring, silence, AUDIO_TARGET_FRAMES);
 
-    for (int row = 0; row < 8; row += 2) {
-      uint8_t left = mem[row + tile * 16 + 0x8000];
-      uint8_t right = mem[row + 1 + tile * 16 + 0x8000];
+    emulator->apu.synth = &frontend->synth;
+    SDL_PauseAudioDevice(frontend->audio, 0);
+  }
 
-      for (int col = 0; col < 8; col++) {
-        uint8_t c = ((left >> col) << 1 | (right >> col)) & 0b11;
-        uint8_t colors[] = {0xFF, 0xAA, 0x55, 0x00};
+  SDL_Thread *thread = SDL_CreateThread(frontend_emulate, "emulator", frontend);
 
-        SDL_SetRenderDrawColor(frontend->renderer, colors[c], colors[c],
-                               colors[c], 255);
-        SDL_RenderDrawPoint(frontend->renderer,
-                            xOffset + col + sprite % spritesPerRow * 8,
-                            yOffset + sprite / spritesPerRow * 8 + row / 2);
-      }
-    }
+  while (__atomic_load_n(&frontend->running, __ATOMIC_ACQUIRE)) {
+    frontend_update(frontend);
+  }
+
+  // no more presents: release an emulation thread waiting for one
+  if (frontend->vsync)
+    SDL_SemPost(frontend->vsync);
+  SDL_WaitThread(thread, NULL);
+  if (frontend->vsync)
+    SDL_DestroySemaphore(frontend->vsync);
+
+  if (frontend->audio) {
+    SDL_CloseAudioDevice(frontend->audio);
+    emulator->apu.synth = NULL;
+    ring_free(&frontend->audio_ring);
   }
+  SDL_Quit();
 }
@@ -1,15 +1,17 @@
 #include "gpu.h"
+#include "cheats.h"
 #include "cpu.h"
 #include "ram.h"
 
 #include <stdbool.h>
 #include <stdio.h>
 
-const int colors[] = {0xFFFFFF, 0xAAAAAA, 0x555555, 0x000000};
+const int gpu_colors[4] = {0xFFFFFF, 0xAAAAAA, 0x555555, 0x000000};
 
 static void gpu_render_tiles(GPU *gpu);
 static void gpu_render_sprites(GPU *gpu);
-static inline int get_color(GPU *gpu, uint8_t value, uint16_t pallete);
+static void gpu_output_line(GPU *gpu, int ly);
+static inline uint8_t get_shade(uint8_t value, uint8_t palette);
 
 void gpu_init(GPU *gpu, CPU *cpu, RAM *ram) {
   gpu->cpu = cpu;
@@ -57,21 +59,20 @@ void gpu_set_mode(GPU *gpu, Mode mode) {
       cpu_interrupt(gpu->cpu, INT_LCDSTAT);
     break;
   case MODE_VBLANK:
+    if (gpu->ram->cheats)
+      cheats_apply(gpu->ram->cheats, gpu->ram);
     cpu_interrupt(gpu->cpu, INT_VBLANK);
     if (stat & STAT_VBL_INT)
       cpu_interrupt(gpu->cpu, INT_LCDSTAT);
     break;
   }
 
+  COUNT(gpu->ram, mode_changes[mode]);
   gpu->mode = mode;
 }
 
-void gpu_step(GPU *gpu, int cycles) {
-  if (!gpu_is_lcd_enabled(gpu))
-    return;
-
-  gpu->cycles += cycles;
-
+// moves to the next mode if enough cycles have passed, returns whether it did
+static int gpu_advance(GPU *gpu) {
   uint8_t ly = ram_get(gpu->ram, LY);
 
   switch (gpu->mode) {
@@ -79,6 +80,7 @@ void gpu_step(GPU *gpu, int cycles) {
     if (gpu->cycles >= 80) {
       gpu->cycles -= 80;
       gpu_set_mode(gpu, MODE_VRAM);
+      return 1;
     }
     break;
   case MODE_VRAM:
@@ -86,6 +88,7 @@ void gpu_step(GPU *gpu, int cycles) {
       gpu->cycles -= 172;
       gpu_set_mode(gpu, MODE_HBLANK);
       gpu_render_scanline(gpu);
+      return 1;
     }
     break;
   case MODE_HBLANK:
@@ -98,6 +101,7 @@ void gpu_step(GPU *gpu, int cycles) {
       } else {
         gpu_set_mode(gpu, MODE_OAM);
       }
+      return 1;
     }
     break;
   case MODE_VBLANK:
@@ -109,12 +113,28 @@ void gpu_step(GPU *gpu, int cycles) {
         gpu_set_mode(gpu, MODE_OAM);
         ram_set(gpu->ram, LY, 0);
       }
+      return 1;
     }
     break;
   }
+
+  return 0;
+}
+
+void gpu_step(GPU *gpu, int cycles) {
+  if (!gpu_is_lcd_enabled(gpu))
+    return;
+
+  gpu->cycles += cycles;
+
+  // a fast path block can span several modes
+  while (gpu_advance(gpu))
+    ;
 }
 
 void gpu_render_scanline(GPU *gpu) {
+  COUNT(gpu->ram, scanlines);
+
   uint8_t lcdc = ram_get(gpu->ram, LCDC);
 
   if (lcdc & LCDC_BG_ENABLE) {
@@ -124,6 +144,104 @@ void gpu_render_scanline(GPU *gpu) {
   if (lcdc & LCDC_OBJ_ENABLE) {
     gpu_render_sprites(gpu);
   }
+
+  if (gpu->output.buffer) {
+    gpu_output_line(gpu, ram_get(gpu->ram, LY));
+  }
+}
+
+static inline int gpu_output_depth(OutputFormat format) {
+  return format == OUTPUT_RGBA ? 4 : 1;
+}
+
+int gpu_set_output(GPU *gpu, const Output *output) {
+  Output out = *output;
+
+  if (out.buffer) {
+    if (out.scale != 1 && out.scale != 2)
+      return -1;
+    if (out.format != OUTPUT_INDEX && out.format != OUTPUT_GRAY &&
+        out.format != OUTPUT_RGBA)
+      return -1;
+    if (out.width == 0 || out.height == 0 || out.x + out.width > 160 ||
+        out.y + out.height > 144)
+      return -1;
+    if (out.scale == 2 && ((out.width | out.height) & 1))
+      return -1;
+
+    uint32_t row = out.width / out.scale * gpu_output_depth(out.format);
+    if (out.stride == 0)
+      out.stride = row;
+    if (out.stride < row)
+      return -1;
+  }
+
+  gpu->output = out;
+  return 0;
+}
+
+size_t gpu_output_size(const Output *output) {
+  size_t rows = output->height / (output->scale == 2 ? 2 : 1);
+  size_t row = output->width / (output->scale == 2 ? 2 : 1) *
+               gpu_output_depth(output->format);
+  size_t stride = output->stride ? output->stride : row;
+
+  return rows ? stride * (rows - 1) + row : 0;
+}
+
+// `sum` is the total of `count` shades, 1 or 4
+static inline uint8_t gpu_output_gray(int sum, int count) {
+  return 0xFF - (0x55 * sum + count / 2) / count;
+}
+
+static void gpu_output_pixels(Output *out, uint8_t *row, const uint8_t *sums,
+                              int width, int count) {
+  switch (out->format) {
+  case OUTPUT_INDEX:
+    for (int i = 0; i < width; i++)
+      row[i] = (sums[i] + count / 2) / count;
+    break;
+  case OUTPUT_GRAY:
+    for (int i = 0; i < width; i++)
+      row[i] = gpu_output_gray(sums[i], count);
+    break;
+  case OUTPUT_RGBA:
+    for (int i = 0; i < width; i++) {
+      uint8_t gray = gpu_output_gray(sums[i], count);
+      row[i * 4 + 0] = gray;
+      row[i * 4 + 1] = gray;
+      row[i * 4 + 2] = gray;
+      row[i * 4 + 3] = 0xFF;
+    }
+    break;
+  }
+}
+
+static void gpu_output_line(GPU *gpu, int ly) {
+  Output *out = &gpu->output;
+  int y = ly - out->y;
+
+  if (y < 0 || y >= out->height)
+    return;
+
+  const uint8_t *line = &gpu->framebuffer[ly * 160 + out->x];
+
+  if (out->scale == 1) {
+    gpu_output_pixels(out, out->buffer + y * out->stride, line, out->width, 1);
+    return;
+  }
+
+  // 2x2 blocks: hold the even row's pairs until the odd row completes them
+  int width = out->width / 2;
+  for (int i = 0; i < width; i++) {
+    uint8_t pair = line[i * 2] + line[i * 2 + 1];
+    gpu->pending[i] = (y & 1) ? gpu->pending[i] + pair : pair;
+  }
+
+  if (y & 1) {
+    uint8_t *row = out->buffer + (y / 2) * out->stride;
+    gpu_output_pixels(out, row, gpu->pending, width, 4);
+  }
 }
 
 static void gpu_render_tiles(GPU *gpu) {
@@ -191,7 +309,7 @@ static void gpu_render_tiles(GPU *gpu) {
 
     // write color to framebuffer
     gpu->framebuffer[pixel + (ly * 160)] =
-        get_color(gpu, color_num, ram_get(gpu->ram, PAL_BGP));
+        get_shade(color_num, ram_get(gpu->ram, PAL_BGP));
   }
 }
 
@@ -239,10 +357,10 @@ static void gpu_render_sprites(GPU *gpu) {
                         (data_right & (1 << color_bit)) >> color_bit;
 
         uint16_t palette = attributes & OBJ_PALETTE_NUMBER ? 0xFF49 : 0xFF48;
-        int color = get_color(gpu, color_num, ram_get(gpu->ram, palette));
+        uint8_t shade = get_shade(color_num, ram_get(gpu->ram, palette));
 
         // white is transparent for sprites
-        if (color == 0xFFFFFF) {
+        if (shade == 0) {
           continue;
         }
 
@@ -252,13 +370,12 @@ static void gpu_render_sprites(GPU *gpu) {
           continue;
         }
 
-        gpu->framebuffer[x + (ly * 160)] = color;
+        gpu->framebuffer[x + (ly * 160)] = shade;
       }
     }
   }
 }
 
-static inline int get_color(GPU *gpu, uint8_t value, uint16_t palette) {
-  return colors[((palette >> ((value << 1) | 1)) & 0x01) << 1 |
-                ((palette >> (value << 1)) & 0x01)];
+static inline uint8_t get_shade(uint8_t value, uint8_t palette) {
+  return (palette >> (value << 1)) & 0x03;
 }
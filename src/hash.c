@@ -0,0 +1,98 @@
+#include <string.h>
+
+#include "hash.h"
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t value;
+  memcpy(&value, p, 8);
+  return value;
+#else
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--)
+    value = value << 8 | p[i];
+  return value;
+#endif
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+  acc += input * PRIME2;
+  return rotl(acc, 31) * PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t hash, uint64_t acc) {
+  hash ^= hash_round(0, acc);
+  return hash * PRIME1 + PRIME4;
+}
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed) {
+  const uint8_t *p = data;
+  const uint8_t *end = p + size;
+  uint64_t hash;
+
+  if (size >= 32) {
+    uint64_t v1 = seed + PRIME1 + PRIME2;
+    uint64_t v2 = seed + PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME1;
+
+    // whole stripes, one lane each 8 bytes
+    const uint8_t *last = end - 32;
+    do {
+      v1 = hash_round(v1, read64(p));
+      v2 = hash_round(v2, read64(p + 8));
+      v3 = hash_round(v3, read64(p + 16));
+      v4 = hash_round(v4, read64(p + 24));
+      p += 32;
+    } while (p <= last);
+
+    hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    hash = hash_merge(hash, v1);
+    hash = hash_merge(hash, v2);
+    hash = hash_merge(hash, v3);
+    hash = hash_merge(hash, v4);
+  } else {
+    hash = seed + PRIME5;
+  }
+
+  hash += size;
+
+  for (; p + 8 <= end; p += 8) {
+    hash ^= hash_round(0, read64(p));
+    hash = rotl(hash, 27) * PRIME1 + PRIME4;
+  }
+
+  if (p + 4 <= end) {
+    hash ^= read32(p) * PRIME1;
+    hash = rotl(hash, 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+
+  for (; p < end; p++) {
+    hash ^= *p * PRIME5;
+    hash = rotl(hash, 11) * PRIME1;
+  }
+
+  // avalanche
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  hash *= PRIME3;
+  hash ^= hash >> 32;
+  return hash;
+}
@@ -0,0 +1,226 @@
+#include <string.h>
+
+#include "gpu.h"
+#include "idiom.h"
+#include "ram.h"
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+// longest signature below
+#define IDIOM_MAX_LENGTH 8
+
+const uint8_t idiom_starts[256] = {
+  [0x22] = 1, [0x2A] = 1, [0x32] = 1, [0x3E] = 1,
+  [0x7A] = 1, [0x7B] = 1, [0xAF] = 1,
+};
+
+/** iterations of `per_byte` cycles to run: all `count`, or as many as fit in `budget` */
+static inline uint32_t idiom_size(uint32_t count, int per_byte, int budget) {
+  uint32_t fit = budget > 0 ? (uint32_t)budget / per_byte : 0;
+  if (fit > IDIOM_MAX_BYTES)
+    fit = IDIOM_MAX_BYTES;
+  return count < fit ? count : fit;
+}
+
+/** DEC r8 on a loop counter after `size` of its `count` iterations; 1 while it runs on */
+static inline int idiom_count8(CPU *cpu, uint8_t *counter, uint32_t size) {
+  *counter -= size;
+
+  // DEC: Z when it reaches zero, N set, H on a borrow from bit 4, C kept
+  uint8_t h = (*counter & 0x0F) == 0x0F ? FLAG_H : 0;
+  cpu->f = (*counter ? h : FLAG_Z) | FLAG_N | (cpu->f & FLAG_C);
+  return *counter != 0;
+}
+
+static inline int idiom_overlap(uint16_t a, uint16_t b, uint32_t size) {
+  return a < b + size && b < a + size;
+}
+
+/**
+ * Where a loop may write: plain memory, and not VRAM or OAM while the LCD
+ * is on, since the GPU would see them half written. Call last: the span
+ * counts as written.
+ */
+static uint8_t *idiom_destination(RAM *ram, uint16_t address, uint32_t size) {
+  int lcd_on = ram->io[LCDC - RAM_IO] & LCDC_LCD_ENABLE;
+  int video = address < 0xA000 || (address >= RAM_OAM && address < 0xFEA0);
+
+  if (lcd_on && video)
+    return NULL;
+
+  return ram_write_span(ram, address, size);
+}
+
+/**
+ * LD A,(HL+) / LD (DE),A / INC DE / DEC BC / LD A,B / OR C / JR NZ,-8
+ * (or LD A,C / OR B). 52 cycles a byte, 48 for the last one.
+ */
+static int idiom_copy16(CPU *cpu, int budget) {
+  uint32_t size = idiom_size(cpu->bc ? cpu->bc : 0x10000, 52, budget);
+  if (size == 0)
+    return 0;
+
+  const uint8_t *source = ram_read_span(cpu->ram, cpu->hl, size);
+  if (source == NULL || idiom_overlap(cpu->hl, cpu->de, size))
+    return 0;
+
+  uint8_t *destination = idiom_destination(cpu->ram, cpu->de, size);
+  if (destination == NULL)
+    return 0;
+
+  memcpy(destination, source, size);
+  cpu->hl += size;
+  cpu->de += size;
+  cpu->bc -= size;
+
+  // OR of the counter halves; the loop exits once it is zero
+  cpu->a = cpu->b | cpu->c;
+  cpu->f = cpu->a ? 0 : FLAG_Z;
+
+  if (cpu->a)
+    return size * 52;
+
+  cpu->pc += 8;
+  return size * 52 - 4;
+}
+
+/**
+ * LD A,(HL+) / LD (DE),A / INC DE / DEC B or C / JR NZ,-6.
+ * 40 cycles a byte, 36 for the last one.
+ */
+static int idiom_copy8(CPU *cpu, uint8_t *counter, int budget) {
+  uint32_t size = idiom_size(*counter ? *counter : 256, 40, budget);
+  if (size == 0)
+    return 0;
+
+  const uint8_t *source = ram_read_span(cpu->ram, cpu->hl, size);
+  if (source == NULL || idiom_overlap(cpu->hl, cpu->de, size))
+    return 0;
+
+  uint8_t *destination = idiom_destination(cpu->ram, cpu->de, size);
+  if (destination == NULL)
+    return 0;
+
+  memcpy(destination, source, size);
+  cpu->a = source[size - 1];
+  cpu->hl += size;
+  cpu->de += size;
+
+  if (idiom_count8(cpu, counter, size))
+    return size * 40;
+
+  cpu->pc += 6;
+  return size * 40 - 4;
+}
+
+/**
+ * LD (HL+),A or LD (HL-),A / DEC B or C / JR NZ,-4.
+ * 24 cycles a byte, 20 for the last one.
+ */
+static int idiom_fill8(CPU *cpu, uint8_t opcode, uint8_t *counter, int budget) {
+  uint32_t size = idiom_size(*counter ? *counter : 256, 24, budget);
+  if (size == 0)
+    return 0;
+  int increment = opcode == 0x22;
+
+  int start = increment ? cpu->hl : cpu->hl - (int)(size - 1);
+  if (start < 0)
+    return 0;
+
+  uint8_t *destination = idiom_destination(cpu->ram, start, size);
+  if (destination == NULL)
+    return 0;
+
+  memset(destination, cpu->a, size);
+  cpu->hl = increment ? cpu->hl + size : cpu->hl - size;
+
+  if (idiom_count8(cpu, counter, size))
+    return size * 24;
+
+  cpu->pc += 4;
+  return size * 24 - 4;
+}
+
+/**
+ * LD A,r or XOR A or LD A,d8 / LD (HL+),A or LD (HL-),A / DEC BC /
+ * LD A,B / OR C / JR NZ back to the load. A is reloaded every time round
+ * since the counter test clobbers it. 40 cycles a byte (44 with LD A,d8),
+ * 4 fewer for the last one.
+ */
+static int idiom_fill16(CPU *cpu, const uint8_t *code, int length, uint8_t value,
+                        int budget) {
+  int increment = code[length - 6] == 0x22;
+  int per_byte = length == 8 ? 44 : 40;
+  uint32_t size = idiom_size(cpu->bc ? cpu->bc : 0x10000, per_byte, budget);
+  if (size == 0)
+    return 0;
+
+  int start = increment ? cpu->hl : cpu->hl - (int)(size - 1);
+  if (start < 0)
+    return 0;
+
+  uint8_t *destination = idiom_destination(cpu->ram, start, size);
+  if (destination == NULL)
+    return 0;
+
+  memset(destination, value, size);
+  cpu->hl = increment ? cpu->hl + size : cpu->hl - size;
+  cpu->bc -= size;
+
+  cpu->a = cpu->b | cpu->c;
+  cpu->f = cpu->a ? 0 : FLAG_Z;
+
+  if (cpu->a)
+    return size * per_byte;
+
+  cpu->pc += length;
+  return size * per_byte - 4;
+}
+
+/** the counter test of a 16 bit loop: DEC BC / LD A,B / OR C (or LD A,C / OR B) */
+static inline int idiom_counter16(const uint8_t *code) {
+  return code[0] == 0x0B &&
+         ((code[1] == 0x78 && code[2] == 0xB1) || (code[1] == 0x79 && code[2] == 0xB0));
+}
+
+int idiom_run(CPU *cpu, uint8_t opcode, int budget) {
+  RAM *ram = cpu->ram;
+
+  // code in ROM only, which the loop can't rewrite
+  if (cpu->pc >= 0x8000 || (cpu->ime && ram->ie))
+    return 0;
+
+  const uint8_t *code = ram_read_span(ram, cpu->pc, IDIOM_MAX_LENGTH);
+  if (code == NULL)
+    return 0;
+
+  if (opcode == 0x2A && code[1] == 0x12 && code[2] == 0x13) {
+    if (idiom_counter16(code + 3) && code[6] == 0x20 && code[7] == 0xF8)
+      return idiom_copy16(cpu, budget);
+
+    if ((code[3] == 0x05 || code[3] == 0x0D) && code[4] == 0x20 && code[5] == 0xFA)
+      return idiom_copy8(cpu, code[3] == 0x05 ? &cpu->b : &cpu->c, budget);
+
+    return 0;
+  }
+
+  if (opcode == 0x22 || opcode == 0x32) {
+    if ((code[1] == 0x05 || code[1] == 0x0D) && code[2] == 0x20 && code[3] == 0xFC)
+      return idiom_fill8(cpu, opcode, code[1] == 0x05 ? &cpu->b : &cpu->c, budget);
+    return 0;
+  }
+
+  // the fill value is reloaded from D, E, zero or an immediate
+  int length = opcode == 0x3E ? 8 : 7;
+  const uint8_t *loop = code + length - 6;
+  if ((loop[0] != 0x22 && loop[0] != 0x32) || !idiom_counter16(loop + 1) ||
+      loop[4] != 0x20 || loop[5] != (uint8_t)-length)
+    return 0;
+
+  uint8_t value = opcode == 0x7A ? cpu->d : opcode == 0x7B ? cpu->e :
+                  opcode == 0x3E ? code[1] : 0;
+  return idiom_fill16(cpu, code, length, value, budget);
+}
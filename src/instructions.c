@@ -1,7 +1,7 @@
 #include "instructions.h"
 #include <stdio.h>
 
-Instruction instructions[256] = {
+const Instruction instructions[256] = {
     {"NOP ", 1, 4},         {"LD BC, d16", 3, 12},   {"LD BC, A", 1, 8},
     {"INC BC", 1, 8},       {"INC B", 1, 4},         {"DEC B", 1, 4},
     {"LD B, d8", 2, 8},     {"RLCA ", 1, 4},         {"LD a16, SP", 3, 20},
@@ -89,7 +89,7 @@ Instruction instructions[256] = {
     {"ILLEGAL_FC ", 1, 4},  {"ILLEGAL_FD ", 1, 4},   {"CP d8", 2, 8},
     {"RST 38H", 1, 16}};
 
-Instruction prefixed[256] = {
+const Instruction prefixed[256] = {
     {"RLC B", 2, 8},      {"RLC C", 2, 8},      {"RLC D", 2, 8},
     {"RLC E", 2, 8},      {"RLC H", 2, 8},      {"RLC L", 2, 8},
     {"RLC HL", 2, 16},    {"RLC A", 2, 8},      {"RRC B", 2, 8},
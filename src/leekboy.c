@@ -0,0 +1,247 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "cheats.h"
+#include "debugger.h"
+#include "emulator.h"
+#include "leekboy.h"
+
+struct LeekBoy {
+  Emulator emulator;
+  // the framebuffer in 0xRRGGBB, filled by lb_framebuffer
+  uint32_t pixels[LB_WIDTH * LB_HEIGHT];
+  // cycles run past the last lb_run_cycles budget
+  long overshoot;
+  Cheats cheats;
+  Debugger debugger;
+};
+
+static LeekBoy *lb_fail(int *error, int code) {
+  if (error)
+    *error = code;
+  return NULL;
+}
+
+LeekBoy *lb_create(const uint8_t *rom, size_t size, int *error) {
+  // needs at least the cartridge header
+  if (rom == NULL || size < 0x150)
+    return lb_fail(error, LB_ERROR_ROM);
+
+  LeekBoy *lb = calloc(1, sizeof(LeekBoy));
+  uint8_t *image = lb ? emulator_rom_image(rom, size, &size) : NULL;
+  if (image == NULL) {
+    free(lb);
+    return lb_fail(error, LB_ERROR_MEMORY);
+  }
+
+  // the image is always a valid size, only cartridge RAM can fail here
+  if (emulator_init_rom(&lb->emulator, image, size) != 0) {
+    free(image);
+    free(lb);
+    return lb_fail(error, LB_ERROR_MEMORY);
+  }
+
+  lb->emulator.rom_owned = image;
+  debugger_init(&lb->debugger);
+  lb->emulator.cpu.debugger = &lb->debugger;
+  if (error)
+    *error = LB_OK;
+  return lb;
+}
+
+void lb_destroy(LeekBoy *lb) {
+  cheats_clear(&lb->cheats, &lb->emulator.ram);
+  emulator_free(&lb->emulator);
+  free(lb);
+}
+
+static inline int lb_status(LeekBoy *lb) {
+  if (lb->emulator.cpu.error)
+    return LB_ERROR_OPCODE;
+  // a bank switched in could not be patched
+  if (lb->cheats.failed)
+    return LB_ERROR_MEMORY;
+  return lb->debugger.stop != DEBUGGER_RUNNING ? LB_STOPPED : LB_OK;
+}
+
+int lb_run_frames(LeekBoy *lb, int frames) {
+  // a CPU error or a stopped debugger runs 0 cycles
+  for (int i = 0; i < frames; i++) {
+    if (emulator_step(&lb->emulator) == 0)
+      break;
+  }
+
+  return lb_status(lb);
+}
+
+int lb_run_cycles(LeekBoy *lb, long cycles) {
+  long budget = cycles - lb->overshoot;
+
+  while (budget > 0) {
+    int slice = budget < FRAME_CYCLES ? budget : FRAME_CYCLES;
+    int ran = emulator_run_cycles(&lb->emulator, slice);
+    if (ran == 0)
+      break;
+    budget -= ran;
+  }
+
+  lb->overshoot = budget < 0 ? -budget : 0;
+  return lb_status(lb);
+}
+
+void lb_set_input(LeekBoy *lb, uint8_t mask) {
+  emulator_set_input(&lb->emulator, mask);
+}
+
+const uint32_t *lb_framebuffer(LeekBoy *lb) {
+  for (int i = 0; i < LB_WIDTH * LB_HEIGHT; i++) {
+    lb->pixels[i] = gpu_colors[lb->emulator.gpu.framebuffer[i]];
+  }
+
+  return lb->pixels;
+}
+
+uint64_t lb_cycles(LeekBoy *lb) {
+  return lb->emulator.cycles;
+}
+
+int lb_set_output(LeekBoy *lb, void *buffer, int format, int scale,
+                  int x, int y, int width, int height, size_t stride) {
+  if ((scale != 1 && scale != 2) || x < 0 || y < 0 || width < 0 ||
+      height < 0 || stride > UINT32_MAX ||
+      x + width > LB_WIDTH || y + height > LB_HEIGHT)
+    return LB_ERROR_ARGUMENT;
+
+  Output output = {
+    .buffer = buffer,
+    .format = format,
+    .scale = scale,
+    .x = x,
+    .y = y,
+    .width = width,
+    .height = height,
+    .stride = stride,
+  };
+
+  if (gpu_set_output(&lb->emulator.gpu, &output) != 0)
+    return LB_ERROR_ARGUMENT;
+  return LB_OK;
+}
+
+size_t lb_output_size(int format, int scale, int width, int height) {
+  if (width < 0 || height < 0 || width > LB_WIDTH || height > LB_HEIGHT)
+    return 0;
+
+  Output output = {
+    .format = format,
+    .scale = scale,
+    .width = width,
+    .height = height,
+  };
+  return gpu_output_size(&output);
+}
+
+size_t lb_state_size(LeekBoy *lb) {
+  return emulator_state_size(&lb->emulator);
+}
+
+long lb_save_state(LeekBoy *lb, void *buffer, size_t size) {
+  if (size < emulator_state_size(&lb->emulator))
+    return LB_ERROR_STATE;
+
+  return emulator_save_state(&lb->emulator, buffer);
+}
+
+int lb_load_state(LeekBoy *lb, const void *buffer, size_t size) {
+  if (emulator_load_state(&lb->emulator, buffer, size) != 0)
+    return LB_ERROR_STATE;
+
+  lb->overshoot = 0;
+  return LB_OK;
+}
+
+uint64_t lb_state_hash(LeekBoy *lb) {
+  return emulator_state_hash(&lb->emulator);
+}
+
+static inline int lb_cheat_error(void) {
+  return errno == ENOMEM ? LB_ERROR_MEMORY : LB_ERROR_ARGUMENT;
+}
+
+int lb_add_cheat(LeekBoy *lb, const char *code) {
+  if (code == NULL)
+    return LB_ERROR_ARGUMENT;
+  if (cheats_add(&lb->cheats, &lb->emulator.ram, code) != 0)
+    return lb_cheat_error();
+  return LB_OK;
+}
+
+int lb_remove_cheat(LeekBoy *lb, const char *code) {
+  if (code == NULL)
+    return LB_ERROR_ARGUMENT;
+  if (cheats_remove(&lb->cheats, &lb->emulator.ram, code) != 0)
+    return lb_cheat_error();
+  return LB_OK;
+}
+
+void lb_clear_cheats(LeekBoy *lb) {
+  cheats_clear(&lb->cheats, &lb->emulator.ram);
+}
+
+void lb_break(LeekBoy *lb, uint16_t address) {
+  debugger_break(&lb->debugger, address);
+}
+
+void lb_clear_break(LeekBoy *lb, uint16_t address) {
+  debugger_clear_break(&lb->debugger, address);
+}
+
+int lb_watch(LeekBoy *lb, uint16_t start, uint16_t end, int access) {
+  if (debugger_watch(&lb->debugger, start, end, access) != 0)
+    return LB_ERROR_ARGUMENT;
+  return LB_OK;
+}
+
+void lb_unwatch(LeekBoy *lb, uint16_t start, uint16_t end) {
+  debugger_unwatch(&lb->debugger, start, end);
+}
+
+void lb_continue(LeekBoy *lb) {
+  debugger_continue(&lb->debugger);
+}
+
+void lb_step(LeekBoy *lb) {
+  debugger_step(&lb->debugger);
+}
+
+void lb_step_over(LeekBoy *lb) {
+  debugger_step_over(&lb->debugger, &lb->emulator.cpu);
+}
+
+int lb_stopped(LeekBoy *lb, LBStop *stop) {
+  Debugger *debugger = &lb->debugger;
+
+  // DebuggerStop and LB_STOP_* are in the same order
+  if (stop) {
+    stop->reason = debugger->stop;
+    stop->pc = debugger->pc;
+    stop->address = debugger->address;
+    stop->value = debugger->value;
+    stop->access = debugger->access;
+  }
+
+  return debugger->stop;
+}
+
+const char *lb_error_string(int error) {
+  switch (error) {
+  case LB_OK: return "ok";
+  case LB_ERROR_MEMORY: return "out of memory";
+  case LB_ERROR_ROM: return "invalid ROM image";
+  case LB_ERROR_OPCODE: return "unknown opcode";
+  case LB_ERROR_STATE: return "invalid save state";
+  case LB_ERROR_ARGUMENT: return "invalid argument";
+  case LB_STOPPED: return "stopped by the debugger";
+  default: return "unknown error";
+  }
+}
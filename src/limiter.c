@@ -0,0 +1,158 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "limiter.h"
+
+#include <time.h>
+
+#define NS 1000000000ULL
+
+// spin margin bounds, the margin tracks the host's sleep overshoot
+#define SPIN_MIN 100000
+#define SPIN_MAX 4000000
+
+// frames behind before giving up on catching up
+#define MAX_LAG 4
+
+uint64_t limiter_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NS + ts.tv_nsec;
+}
+
+void limiter_init(Limiter *limiter, uint64_t cycles, uint64_t clock) {
+  limiter->period = cycles * NS / clock;
+  limiter->remainder = cycles * NS % clock;
+  limiter->clock = clock;
+  limiter->error = 0;
+
+  limiter->frame_start = limiter_now();
+  limiter->deadline = limiter->frame_start;
+  limiter->spin = 1000000;
+
+  limiter->emulation_time = 0;
+  limiter->wait_time = 0;
+  limiter->jitter = 0;
+
+  limiter->frames = 0;
+  limiter->emulation_total = 0;
+  limiter->wait_total = 0;
+  limiter->worst_jitter = 0;
+  limiter->resyncs = 0;
+}
+
+static void limiter_advance(Limiter *limiter) {
+  limiter->deadline += limiter->period;
+  limiter->error += limiter->remainder;
+
+  if (limiter->error >= limiter->clock) {
+    limiter->error -= limiter->clock;
+    limiter->deadline++;
+  }
+}
+
+static void limiter_sleep(Limiter *limiter, uint64_t until) {
+  uint64_t before = limiter_now();
+  if (before >= until)
+    return;
+
+  struct timespec ts;
+  ts.tv_sec = (until - before) / NS;
+  ts.tv_nsec = (until - before) % NS;
+  nanosleep(&ts, NULL);
+
+  // grow the margin right away on oversleep, shrink it slowly otherwise
+  uint64_t after = limiter_now();
+  uint64_t overshoot = after > until ? after - until : 0;
+
+  if (overshoot * 2 > limiter->spin) {
+    limiter->spin = overshoot * 2;
+  } else {
+    limiter->spin -= limiter->spin >> 4;
+  }
+
+  if (limiter->spin < SPIN_MIN)
+    limiter->spin = SPIN_MIN;
+  if (limiter->spin > SPIN_MAX)
+    limiter->spin = SPIN_MAX;
+}
+
+static void limiter_count(Limiter *limiter) {
+  limiter->frames++;
+  limiter->emulation_total += limiter->emulation_time;
+  limiter->wait_total += limiter->wait_time;
+  if (limiter->jitter > limiter->worst_jitter)
+    limiter->worst_jitter = limiter->jitter;
+}
+
+/**
+ * Call once per emulated frame, after the frame has been produced.
+ * Blocks until the frame's deadline and starts timing the next frame.
+ */
+void limiter_wait(Limiter *limiter) {
+  uint64_t now = limiter_now();
+  limiter->emulation_time = now - limiter->frame_start;
+
+  limiter_advance(limiter);
+
+  if (now < limiter->deadline) {
+    if (limiter->deadline - now > limiter->spin)
+      limiter_sleep(limiter, limiter->deadline - limiter->spin);
+
+    while ((now = limiter_now()) < limiter->deadline)
+      ;
+
+    limiter->jitter = now - limiter->deadline;
+  } else if (now - limiter->deadline > limiter->period * MAX_LAG) {
+    // too far behind (e.g. suspended), resync instead of fast-forwarding
+    limiter->deadline = now;
+    limiter->jitter = 0;
+    limiter->resyncs++;
+  } else {
+    // late: the next waits will be shorter to make up for it
+    limiter->jitter = now - limiter->deadline;
+  }
+
+  limiter->wait_time = now - limiter->frame_start - limiter->emulation_time;
+  limiter->frame_start = now;
+
+  limiter_count(limiter);
+}
+
+/**
+ * For frames paced by something else, e.g. vsync: call once that wait is
+ * over, with the time the frame was done. Keeps the statistics, and the
+ * deadline at the present so limiter_wait can take over at any frame.
+ */
+void limiter_follow(Limiter *limiter, uint64_t produced) {
+  uint64_t now = limiter_now();
+
+  limiter->emulation_time = produced - limiter->frame_start;
+  limiter->wait_time = now - produced;
+  limiter->jitter = 0;
+
+  limiter->deadline = now;
+  limiter->error = 0;
+  limiter->frame_start = now;
+
+  limiter_count(limiter);
+}
+
+/** prints averages since the last report and starts a new window */
+void limiter_report(Limiter *limiter, FILE *file) {
+  if (limiter->frames == 0)
+    return;
+
+  fprintf(file, "frames: %llu emulation: %.3fms wait: %.3fms worst jitter: %.3fms resyncs: %llu\n",
+          (unsigned long long)limiter->frames,
+          limiter->emulation_total / (double)limiter->frames / 1e6,
+          limiter->wait_total / (double)limiter->frames / 1e6,
+          limiter->worst_jitter / 1e6,
+          (unsigned long long)limiter->resyncs);
+  fflush(file);
+
+  limiter->frames = 0;
+  limiter->emulation_total = 0;
+  limiter->wait_total = 0;
+  limiter->worst_jitter = 0;
+  limiter->resyncs = 0;
+}
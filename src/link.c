@@ -0,0 +1,93 @@
+#include "link.h"
+
+#define SB(serial) (serial)->io[SERIAL_SB - 0xFF00]
+
+void link_init(Link *link, Emulator *a, Emulator *b, int window) {
+  link->emulators[0] = a;
+  link->emulators[1] = b;
+  link->window = window;
+
+  for (int side = 0; side < 2; side++) {
+    link->emulators[side]->serial.link = link;
+    link->targets[side] = link->emulators[side]->cycles;
+    link->owed[side] = 0;
+  }
+
+  pthread_mutex_init(&link->lock, NULL);
+  pthread_cond_init(&link->boundary, NULL);
+  link->generation = 0;
+  link->arrived = 0;
+}
+
+/** unplugs the cable, transfers still waiting for it read 0xFF */
+void link_free(Link *link) {
+  for (int side = 0; side < 2; side++) {
+    Serial *serial = &link->emulators[side]->serial;
+    serial->link = NULL;
+    if (serial->finished)
+      serial_finish(serial, 0xFF);
+  }
+
+  pthread_mutex_destroy(&link->lock);
+  pthread_cond_destroy(&link->boundary);
+}
+
+/** at a window boundary, swaps the bytes of the finished transfers */
+static void link_exchange(Link *link) {
+  for (int side = 0; side < 2; side++) {
+    Serial *master = &link->emulators[side]->serial;
+    Serial *slave = &link->emulators[!side]->serial;
+    if (!master->finished)
+      continue;
+
+    // a partner that isn't listening leaves the line high
+    uint8_t received = 0xFF;
+    if (serial_listening(slave)) {
+      received = SB(slave);
+      serial_finish(slave, SB(master));
+    }
+    serial_finish(master, received);
+  }
+}
+
+/** runs one side to the end of its window; overshoot comes off the next */
+static void link_window(Link *link, int side) {
+  Emulator *emulator = link->emulators[side];
+  link->targets[side] += link->window;
+  link->owed[side] -= link->window;
+
+  if (emulator->cycles < link->targets[side])
+    emulator_run_cycles(emulator, link->targets[side] - emulator->cycles);
+}
+
+void link_run_cycles(Link *link, int cycles) {
+  link->owed[0] += cycles;
+  link->owed[1] += cycles;
+
+  while (link->owed[0] > 0) {
+    link_window(link, 0);
+    link_window(link, 1);
+    link_exchange(link);
+  }
+}
+
+void link_run_side(Link *link, int side, int cycles) {
+  link->owed[side] += cycles;
+
+  while (link->owed[side] > 0) {
+    link_window(link, side);
+
+    pthread_mutex_lock(&link->lock);
+    if (++link->arrived == 2) {
+      link_exchange(link);
+      link->arrived = 0;
+      link->generation++;
+      pthread_cond_broadcast(&link->boundary);
+    } else {
+      uint64_t generation = link->generation;
+      while (generation == link->generation)
+        pthread_cond_wait(&link->boundary, &link->lock);
+    }
+    pthread_mutex_unlock(&link->lock);
+  }
+}
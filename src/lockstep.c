@@ -0,0 +1,198 @@
+#include <string.h>
+
+#include "instructions.h"
+#include "lockstep.h"
+
+static const char *const frame_hash_reason = "state hash at the end of the frame";
+
+static void lockstep_checkpoint(Lockstep *lockstep) {
+  lockstep->checkpoint_size = emulator_save_state(&lockstep->fast, lockstep->checkpoint);
+  lockstep->checkpoint_cycles = lockstep->fast.cycles;
+  lockstep->steps = 0;
+}
+
+/** both instances share `image`, which must outlive the checker */
+int lockstep_init(Lockstep *lockstep, const uint8_t *image, size_t size) {
+  memset(lockstep, 0, sizeof(Lockstep));
+
+  if (emulator_init_rom(&lockstep->fast, image, size) != 0)
+    return -1;
+  if (emulator_init_rom(&lockstep->reference, image, size) != 0) {
+    emulator_free(&lockstep->fast);
+    return -1;
+  }
+
+  lockstep->reference.reference_core = 1;
+  lockstep->fast.ram.writes = &lockstep->fast_writes;
+  lockstep->reference.ram.writes = &lockstep->reference_writes;
+
+  lockstep_checkpoint(lockstep);
+  return 0;
+}
+
+void lockstep_free(Lockstep *lockstep) {
+  emulator_free(&lockstep->fast);
+  emulator_free(&lockstep->reference);
+}
+
+/** starts both instances from a save state, e.g. an earlier reproducer */
+int lockstep_load_state(Lockstep *lockstep, const uint8_t *state, size_t size) {
+  if (emulator_load_state(&lockstep->fast, state, size) != 0 ||
+      emulator_load_state(&lockstep->reference, state, size) != 0)
+    return -1;
+
+  lockstep_checkpoint(lockstep);
+  return 0;
+}
+
+static int lockstep_registers_differ(CPU *a, CPU *b) {
+  return a->af != b->af || a->bc != b->bc || a->de != b->de || a->hl != b->hl ||
+         a->sp != b->sp || a->pc != b->pc || a->ime != b->ime ||
+         a->halted != b->halted;
+}
+
+static int lockstep_mapper_differs(RAM *a, RAM *b) {
+  return a->rom_bank != b->rom_bank || a->ram_bank != b->ram_bank ||
+         a->ram_enable != b->ram_enable || a->bank_mode != b->bank_mode;
+}
+
+static int lockstep_writes_differ(RAMWriteLog *log, RAM *a, RAM *b) {
+  for (int i = 0; i < log->count; i++) {
+    uint16_t address = log->addresses[i];
+    if (ram_get(a, address) != ram_get(b, address))
+      return 1;
+  }
+
+  return 0;
+}
+
+static const char *lockstep_compare(Lockstep *lockstep) {
+  Emulator *fast = &lockstep->fast, *reference = &lockstep->reference;
+
+  if (fast->cycles != reference->cycles)
+    return "cycle count";
+  if (fast->cpu.error != reference->cpu.error)
+    return "unknown opcode on one core";
+  if (lockstep_registers_differ(&fast->cpu, &reference->cpu))
+    return "registers";
+  if (lockstep_mapper_differs(&fast->ram, &reference->ram))
+    return "mapper registers";
+
+  // too many writes to list, compare everything
+  if (lockstep->fast_writes.count > RAM_WRITE_LOG_SIZE ||
+      lockstep->reference_writes.count > RAM_WRITE_LOG_SIZE) {
+    if (emulator_state_hash(fast) != emulator_state_hash(reference))
+      return "memory";
+    return NULL;
+  }
+
+  if (lockstep_writes_differ(&lockstep->fast_writes, &fast->ram, &reference->ram) ||
+      lockstep_writes_differ(&lockstep->reference_writes, &fast->ram, &reference->ram))
+    return "memory writes";
+
+  return NULL;
+}
+
+/**
+ * Runs one step of the fast core, catches the reference up to the same
+ * cycle and compares the two.
+ */
+LockstepStatus lockstep_step(Lockstep *lockstep) {
+  Emulator *fast = &lockstep->fast, *reference = &lockstep->reference;
+
+  lockstep->fast_writes.count = 0;
+  lockstep->reference_writes.count = 0;
+  lockstep->pc = fast->cpu.pc;
+
+  emulator_run_instruction(fast);
+  while (reference->cycles < fast->cycles) {
+    emulator_run_instruction(reference);
+  }
+  lockstep->steps++;
+
+  lockstep->reason = lockstep_compare(lockstep);
+  if (lockstep->reason)
+    return LOCKSTEP_DIVERGED;
+
+  return fast->cpu.error ? LOCKSTEP_ERROR : LOCKSTEP_OK;
+}
+
+/** steps through a frame, then checks the whole state and checkpoints it */
+LockstepStatus lockstep_run_frame(Lockstep *lockstep) {
+  while (lockstep->fast.cycles - lockstep->checkpoint_cycles < FRAME_CYCLES) {
+    LockstepStatus status = lockstep_step(lockstep);
+    if (status != LOCKSTEP_OK)
+      return status;
+  }
+
+  if (emulator_state_hash(&lockstep->fast) != emulator_state_hash(&lockstep->reference)) {
+    lockstep->reason = frame_hash_reason;
+    return LOCKSTEP_DIVERGED;
+  }
+
+  lockstep_checkpoint(lockstep);
+  return LOCKSTEP_OK;
+}
+
+static void lockstep_print_cpu(const char *name, Emulator *emulator, FILE *out) {
+  CPU *cpu = &emulator->cpu;
+  RAM *ram = &emulator->ram;
+
+  fprintf(out, "%-10s A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X "
+               "SP:%04X PC:%04X IME:%d HALT:%d BANK:%02X CY:%llu\n",
+          name, cpu->a, cpu->f, cpu->b, cpu->c, cpu->d, cpu->e, cpu->h, cpu->l,
+          cpu->sp, cpu->pc, cpu->ime, cpu->halted, ram->rom_bank,
+          (unsigned long long)emulator->cycles);
+}
+
+static void lockstep_print_writes(Lockstep *lockstep, RAMWriteLog *log, FILE *out) {
+  int count = log->count < RAM_WRITE_LOG_SIZE ? log->count : RAM_WRITE_LOG_SIZE;
+
+  for (int i = 0; i < count; i++) {
+    uint16_t address = log->addresses[i];
+    uint8_t fast = ram_get(&lockstep->fast.ram, address);
+    uint8_t reference = ram_get(&lockstep->reference.ram, address);
+
+    if (fast != reference)
+      fprintf(out, "  %04X: fast %02X, reference %02X\n", address, fast, reference);
+  }
+}
+
+/** describes the last divergence */
+void lockstep_report(Lockstep *lockstep, FILE *out) {
+  // the (first) instruction of the diverging step
+  uint8_t opcode = ram_get(&lockstep->reference.ram, lockstep->pc);
+  const Instruction *instruction = &instructions[opcode];
+  if (opcode == 0xCB)
+    instruction = &prefixed[ram_get(&lockstep->reference.ram, lockstep->pc + 1)];
+
+  fprintf(out, "Diverged on %s, step %llu of the frame at cycle %llu\n",
+          lockstep->reason, (unsigned long long)lockstep->steps,
+          (unsigned long long)lockstep->checkpoint_cycles);
+  fprintf(out, "Step at PC %04X: %s\n", lockstep->pc, instruction->mnemonic);
+
+  lockstep_print_cpu("fast", &lockstep->fast, out);
+  lockstep_print_cpu("reference", &lockstep->reference, out);
+
+  lockstep_print_writes(lockstep, &lockstep->fast_writes, out);
+  lockstep_print_writes(lockstep, &lockstep->reference_writes, out);
+}
+
+/**
+ * Replays from the checkpoint to just before the diverging step and saves
+ * that state into `state` (STATE_MAX_SIZE bytes). Returns its size; the
+ * checker is left at that point, so lockstep_step diverges again. A
+ * divergence only the frame hash caught gives the frame's checkpoint.
+ */
+size_t lockstep_reproduce(Lockstep *lockstep, uint8_t *state) {
+  uint64_t steps = lockstep->reason == frame_hash_reason ? 0 : lockstep->steps;
+
+  memcpy(state, lockstep->checkpoint, lockstep->checkpoint_size);
+  lockstep_load_state(lockstep, state, lockstep->checkpoint_size);
+
+  for (uint64_t i = 1; i < steps; i++) {
+    lockstep_step(lockstep);
+  }
+
+  return emulator_save_state(&lockstep->fast, state);
+}
@@ -1,20 +1,148 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "cpu.h"
 #include "emulator.h"
 #include "frontend.h"
 #include "gpu.h"
+#include "limiter.h"
+#include "movie.h"
+#include "profiler.h"
+#include "rewind.h"
+#include "trace.h"
+
+// rewind history: up to two minutes, a keyframe every second
+#define REWIND_FRAMES (60 * 120)
+#define REWIND_INTERVAL 60
+
+// instructions kept in the trace ring, 24 bytes each
+#define TRACE_CAPACITY (1 << 22)
+
+static void usage(char *name) {
+  fprintf(stderr, "usage: %s [-H] [-s] [-a frames] [-r megabytes] [-t trace] [-p profile] [-R movie] rom.gb\n", name);
+  fprintf(stderr, "  -H  run headless in real time\n");
+  fprintf(stderr, "  -s  print frame timing once a second\n");
+  fprintf(stderr, "  -a  run ahead this many frames to hide input lag\n");
+  fprintf(stderr, "  -r  keep this much rewind history, hold R to rewind\n");
+  fprintf(stderr, "  -t  trace file, F1 toggles instruction tracing\n");
+  fprintf(stderr, "  -p  profile the game, writes profile.folded and profile.txt on exit\n");
+  fprintf(stderr, "  -R  record the session as a movie, for bench -m to play back\n");
+  exit(1);
+}
+
+static void run_headless(Emulator *emulator, int stats) {
+  Limiter limiter;
+  limiter_init(&limiter, FRAME_CYCLES, CLOCKSPEED);
+
+  while (!emulator->cpu.error) {
+    emulator_step(emulator);
+    limiter_wait(&limiter);
+
+    if (stats && limiter.frames == 60)
+      limiter_report(&limiter, stdout);
+  }
+
+  fprintf(stderr, "Unknown opcode: 0x%02X at 0x%04X\n", emulator->cpu.error_opcode,
+          emulator->cpu.error_pc);
+}
 
 int main(int argc, char **argv) {
-  Frontend frontend;
-  Emulator emulator;
+  static Frontend frontend;
+  static Emulator emulator;
+  static Profiler profiler;
+  static Movie movie;
+
+  int headless = 0, stats = 0, run_ahead = 0, rewind_mb = 0, opt;
+  char *trace_file = NULL, *profile_name = NULL, *movie_file = NULL;
+  while ((opt = getopt(argc, argv, "Hsa:r:t:p:R:")) != -1) {
+    switch (opt) {
+    case 'H':
+      headless = 1;
+      break;
+    case 's':
+      stats = 1;
+      break;
+    case 'a':
+      run_ahead = atoi(optarg);
+      break;
+    case 'r':
+      rewind_mb = atoi(optarg);
+      break;
+    case 't':
+      trace_file = optarg;
+      break;
+    case 'p':
+      profile_name = optarg;
+      break;
+    case 'R':
+      movie_file = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (optind >= argc)
+    usage(argv[0]);
+
+  if (emulator_init(&emulator, argv[optind]) != 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  if (profile_name) {
+    if (profiler_init(&profiler, emulator.rom, emulator.rom_size) == 0)
+      emulator.cpu.profiler = &profiler;
+    else
+      fprintf(stderr, "Could not allocate profiler\n");
+  }
+
+  if (headless) {
+    run_headless(&emulator, stats);
+    return 1;
+  }
 
   frontend_init(&frontend);
-  emulator_init(&emulator, argv[1]);
+  frontend.stats = stats;
+  frontend.run_ahead = run_ahead;
+
+  if (rewind_mb > 0 &&
+      rewind_init(&frontend.rewind, &emulator, (size_t)rewind_mb << 20,
+                  REWIND_FRAMES, REWIND_INTERVAL) != 0) {
+    fprintf(stderr, "Could not allocate rewind buffer\n");
+  }
+
+  if (trace_file && trace_open(&frontend.trace, trace_file, TRACE_CAPACITY) != 0) {
+    perror(trace_file);
+  }
+
+  if (movie_file) {
+    movie_init(&movie, &emulator);
+    frontend.movie = &movie;
+  }
 
   frontend_run(&frontend, &emulator);
 
+  if (frontend.rewind.arena)
+    rewind_free(&frontend.rewind);
+  trace_close(&frontend.trace);
+
+  if (movie_file) {
+    if (movie_save(&movie, movie_file) != 0)
+      perror(movie_file);
+    movie_free(&movie);
+  }
+
+  if (emulator.cpu.profiler) {
+    if (profiler_save(&profiler, profile_name) != 0)
+      perror(profile_name);
+    profiler_free(&profiler);
+  }
+
+  emulator_free(&emulator);
   return 0;
 }
@@ -0,0 +1,223 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "movie.h"
+
+/** starts an empty movie for the ROM `emulator` runs, from power on */
+void movie_init(Movie *movie, Emulator *emulator) {
+  memset(movie, 0, sizeof(Movie));
+  movie->rom_hash = hash64(emulator->rom, emulator->rom_size, 0);
+}
+
+void movie_free(Movie *movie) {
+  free(movie->inputs);
+  free(movie->frames);
+  movie->inputs = NULL;
+  movie->frames = NULL;
+}
+
+static int movie_grow(void **items, size_t *capacity, size_t count, size_t size) {
+  if (count < *capacity)
+    return 0;
+
+  size_t grown = *capacity ? *capacity * 2 : 1024;
+  void *resized = realloc(*items, grown * size);
+  if (resized == NULL)
+    return -1;
+
+  *items = resized;
+  *capacity = grown;
+  return 0;
+}
+
+/**
+ * Applies `mask` to the emulator now, and records it if it differs from the
+ * last recorded input.
+ */
+int movie_record_input(Movie *movie, Emulator *emulator, uint8_t mask) {
+  emulator_set_input(emulator, mask);
+
+  if (movie->input_count > 0 && movie->inputs[movie->input_count - 1].mask == mask)
+    return 0;
+
+  if (movie_grow((void **)&movie->inputs, &movie->input_capacity,
+                 movie->input_count, sizeof(MovieInput)) != 0)
+    return -1;
+
+  movie->inputs[movie->input_count++] = (MovieInput){emulator->cycles, mask};
+  return 0;
+}
+
+/** records the end of a frame, call after each real (not run-ahead) frame */
+int movie_record_frame(Movie *movie, Emulator *emulator) {
+  if (movie_grow((void **)&movie->frames, &movie->frame_capacity,
+                 movie->frame_count, sizeof(MovieFrame)) != 0)
+    return -1;
+
+  movie->frames[movie->frame_count++] =
+      (MovieFrame){emulator->cycles, emulator_state_hash(emulator)};
+  return 0;
+}
+
+/**
+ * Forgets everything after `cycle`, for when the emulator was sent back
+ * there (rewind, loading a state). Inputs at `cycle` itself go too: a state
+ * saved at the end of a frame hasn't seen the next frame's input yet.
+ */
+void movie_truncate(Movie *movie, uint64_t cycle) {
+  while (movie->input_count > 0 && movie->inputs[movie->input_count - 1].cycle >= cycle)
+    movie->input_count--;
+
+  while (movie->frame_count > 0 && movie->frames[movie->frame_count - 1].cycle > cycle)
+    movie->frame_count--;
+}
+
+static void put(FILE *f, uint64_t value, int size) {
+  for (int i = 0; i < size; i++) {
+    fputc((value >> (i * 8)) & 0xFF, f);
+  }
+}
+
+static int get(FILE *f, uint64_t *value, int size) {
+  *value = 0;
+
+  for (int i = 0; i < size; i++) {
+    int byte = fgetc(f);
+    if (byte == EOF)
+      return -1;
+    *value |= (uint64_t)byte << (i * 8);
+  }
+
+  return 0;
+}
+
+int movie_save(Movie *movie, const char *filename) {
+  FILE *f = fopen(filename, "wb");
+  if (f == NULL)
+    return -1;
+
+  fwrite(MOVIE_MAGIC, 1, 4, f);
+  put(f, MOVIE_VERSION, 2);
+  put(f, 0, 2);
+  put(f, movie->rom_hash, 8);
+  put(f, movie->input_count, 4);
+  put(f, movie->frame_count, 4);
+
+  for (size_t i = 0; i < movie->input_count; i++) {
+    put(f, movie->inputs[i].cycle, 8);
+    put(f, movie->inputs[i].mask, 1);
+  }
+
+  for (size_t i = 0; i < movie->frame_count; i++) {
+    put(f, movie->frames[i].cycle, 8);
+    put(f, movie->frames[i].hash, 8);
+  }
+
+  int failed = ferror(f);
+  if (fclose(f) != 0 || failed)
+    return -1;
+
+  return 0;
+}
+
+static int movie_read(Movie *movie, FILE *f) {
+  char magic[4];
+  uint64_t version, reserved, inputs, frames, value;
+
+  if (fread(magic, 1, 4, f) != 4 || memcmp(magic, MOVIE_MAGIC, 4) != 0 ||
+      get(f, &version, 2) || get(f, &reserved, 2) || version != MOVIE_VERSION ||
+      get(f, &value, 8) || value != movie->rom_hash ||
+      get(f, &inputs, 4) || get(f, &frames, 4)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  movie->inputs = malloc((inputs ? inputs : 1) * sizeof(MovieInput));
+  movie->frames = malloc((frames ? frames : 1) * sizeof(MovieFrame));
+  if (movie->inputs == NULL || movie->frames == NULL)
+    return -1;
+
+  movie->input_capacity = inputs;
+  movie->frame_capacity = frames;
+
+  for (size_t i = 0; i < inputs; i++) {
+    if (get(f, &movie->inputs[i].cycle, 8) || get(f, &value, 1) ||
+        (i > 0 && movie->inputs[i].cycle < movie->inputs[i - 1].cycle))
+      goto invalid;
+    movie->inputs[i].mask = value;
+    movie->input_count++;
+  }
+
+  for (size_t i = 0; i < frames; i++) {
+    if (get(f, &movie->frames[i].cycle, 8) || get(f, &movie->frames[i].hash, 8) ||
+        (i > 0 && movie->frames[i].cycle <= movie->frames[i - 1].cycle))
+      goto invalid;
+    movie->frame_count++;
+  }
+
+  return 0;
+
+invalid:
+  errno = EINVAL;
+  return -1;
+}
+
+/** loads a movie recorded on the ROM `emulator` runs, ready to play */
+int movie_load(Movie *movie, Emulator *emulator, const char *filename) {
+  movie_init(movie, emulator);
+
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL)
+    return -1;
+
+  int result = movie_read(movie, f);
+  fclose(f);
+
+  if (result != 0)
+    movie_free(movie);
+  return result;
+}
+
+/**
+ * Runs the emulator, which must be at power on or where the previous call
+ * left it, through the next recorded frame, applying inputs as they come due.
+ */
+MovieStatus movie_play_frame(Movie *movie, Emulator *emulator) {
+  if (movie->frame == movie->frame_count)
+    return MOVIE_END;
+
+  MovieFrame *frame = &movie->frames[movie->frame];
+
+  while (emulator->cycles < frame->cycle && !emulator->cpu.error) {
+    while (movie->next_input < movie->input_count &&
+           movie->inputs[movie->next_input].cycle <= emulator->cycles) {
+      emulator_set_input(emulator, movie->inputs[movie->next_input++].mask);
+    }
+
+    uint64_t target = frame->cycle;
+    if (movie->next_input < movie->input_count &&
+        movie->inputs[movie->next_input].cycle < target)
+      target = movie->inputs[movie->next_input].cycle;
+
+    uint64_t budget = target - emulator->cycles;
+    if (emulator_run_cycles(emulator, budget < FRAME_CYCLES ? budget : FRAME_CYCLES) == 0)
+      break;
+  }
+
+  if (emulator->cpu.error)
+    return MOVIE_ERROR;
+
+  // stopped by the debugger, the same frame carries on once it resumes
+  if (emulator->cycles < frame->cycle)
+    return MOVIE_STOPPED;
+
+  if (emulator->cycles != frame->cycle ||
+      emulator_state_hash(emulator) != frame->hash)
+    return MOVIE_DESYNC;
+
+  movie->frame++;
+  return MOVIE_OK;
+}
@@ -0,0 +1,360 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "instructions.h"
+#include "profiler.h"
+
+#define REPORT_TOP 32
+
+#define INITIAL_NODES 4096
+#define INITIAL_EDGES 4096
+#define EMPTY 0xFFFFFFFF
+
+static inline uint32_t hash(uint32_t a, uint32_t b) {
+  uint64_t x = (uint64_t)a << 32 | b;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static inline uint32_t linear(Profiler *profiler, CPU *cpu, uint16_t pc) {
+  if (pc < 0x4000)
+    return pc;
+  if (pc < 0x8000)
+    return (cpu->ram->rom_bank * 0x4000 + (pc - 0x4000)) % profiler->rom_size;
+  return profiler->rom_size + (pc - 0x8000);
+}
+
+int profiler_init(Profiler *profiler, const uint8_t *rom, size_t rom_size) {
+  memset(profiler, 0, sizeof(Profiler));
+
+  profiler->rom = rom;
+  profiler->rom_size = rom_size;
+
+  uint32_t slots = profiler->rom_size + 0x8000;
+  profiler->counts = calloc(slots, sizeof(uint64_t));
+  profiler->cycles = calloc(slots, sizeof(uint64_t));
+
+  profiler->node_capacity = INITIAL_NODES;
+  profiler->nodes = malloc(INITIAL_NODES * sizeof(ProfileNode));
+  profiler->node_table_size = INITIAL_NODES * 2;
+  profiler->node_table = malloc(profiler->node_table_size * sizeof(uint32_t));
+
+  profiler->edge_table_size = INITIAL_EDGES;
+  profiler->edges = malloc(INITIAL_EDGES * sizeof(ProfileEdge));
+
+  if (!profiler->counts || !profiler->cycles || !profiler->nodes ||
+      !profiler->node_table || !profiler->edges) {
+    profiler_free(profiler);
+    return -1;
+  }
+
+  memset(profiler->node_table, 0xFF, profiler->node_table_size * sizeof(uint32_t));
+  for (uint32_t i = 0; i < profiler->edge_table_size; i++) {
+    profiler->edges[i].count = 0;
+  }
+
+  profiler->nodes[0] = (ProfileNode){0, EMPTY, 0};
+  profiler->node_count = 1;
+
+  return 0;
+}
+
+void profiler_free(Profiler *profiler) {
+  free(profiler->counts);
+  free(profiler->cycles);
+  free(profiler->nodes);
+  free(profiler->node_table);
+  free(profiler->edges);
+  memset(profiler, 0, sizeof(Profiler));
+}
+
+static void node_table_insert(Profiler *profiler, uint32_t id) {
+  ProfileNode *node = &profiler->nodes[id];
+  uint32_t mask = profiler->node_table_size - 1;
+  uint32_t slot = hash(node->parent, node->function) & mask;
+
+  while (profiler->node_table[slot] != EMPTY)
+    slot = (slot + 1) & mask;
+
+  profiler->node_table[slot] = id;
+}
+
+static uint32_t profiler_child(Profiler *profiler, uint32_t parent, uint32_t function) {
+  uint32_t mask = profiler->node_table_size - 1;
+  uint32_t slot = hash(parent, function) & mask;
+
+  for (uint32_t id; (id = profiler->node_table[slot]) != EMPTY; slot = (slot + 1) & mask) {
+    if (profiler->nodes[id].parent == parent && profiler->nodes[id].function == function)
+      return id;
+  }
+
+  if (profiler->node_count == profiler->node_capacity) {
+    ProfileNode *nodes = realloc(profiler->nodes, profiler->node_capacity * 2 * sizeof(ProfileNode));
+    uint32_t *table = malloc(profiler->node_table_size * 2 * sizeof(uint32_t));
+    if (!nodes || !table) {
+      free(table);
+      if (nodes)
+        profiler->nodes = nodes;
+      return parent;
+    }
+
+    profiler->nodes = nodes;
+    profiler->node_capacity *= 2;
+
+    free(profiler->node_table);
+    profiler->node_table = table;
+    profiler->node_table_size *= 2;
+    memset(table, 0xFF, profiler->node_table_size * sizeof(uint32_t));
+
+    for (uint32_t i = 1; i < profiler->node_count; i++) {
+      node_table_insert(profiler, i);
+    }
+  }
+
+  uint32_t id = profiler->node_count++;
+  profiler->nodes[id] = (ProfileNode){parent, function, 0};
+  node_table_insert(profiler, id);
+
+  return id;
+}
+
+static void profiler_edge(Profiler *profiler, uint32_t from, uint32_t to) {
+  uint32_t mask = profiler->edge_table_size - 1;
+  uint32_t slot = hash(from, to) & mask;
+
+  for (; profiler->edges[slot].count; slot = (slot + 1) & mask) {
+    if (profiler->edges[slot].from == from && profiler->edges[slot].to == to) {
+      profiler->edges[slot].count++;
+      return;
+    }
+  }
+
+  // keep the table at most half full
+  if ((profiler->edge_count + 1) * 2 > profiler->edge_table_size) {
+    ProfileEdge *old = profiler->edges;
+    uint32_t old_size = profiler->edge_table_size;
+
+    ProfileEdge *edges = calloc(old_size * 2, sizeof(ProfileEdge));
+    if (edges == NULL)
+      return;
+
+    profiler->edges = edges;
+    profiler->edge_table_size = old_size * 2;
+    profiler->edge_count = 0;
+
+    for (uint32_t i = 0; i < old_size; i++) {
+      if (old[i].count) {
+        uint32_t s = hash(old[i].from, old[i].to) & (profiler->edge_table_size - 1);
+        while (profiler->edges[s].count)
+          s = (s + 1) & (profiler->edge_table_size - 1);
+        profiler->edges[s] = old[i];
+        profiler->edge_count++;
+      }
+    }
+    free(old);
+
+    mask = profiler->edge_table_size - 1;
+    slot = hash(from, to) & mask;
+    while (profiler->edges[slot].count)
+      slot = (slot + 1) & mask;
+  }
+
+  profiler->edges[slot] = (ProfileEdge){from, to, 1};
+  profiler->edge_count++;
+}
+
+static void profiler_call(Profiler *profiler, uint32_t from, uint32_t to) {
+  profiler_edge(profiler, from, to);
+
+  // past the depth limit, deeper frames are charged to the deepest one
+  if (profiler->depth == PROFILER_MAX_DEPTH)
+    return;
+
+  profiler->stack[profiler->depth++] = profiler->current;
+  profiler->current = profiler_child(profiler, profiler->current, to);
+}
+
+static void profiler_return(Profiler *profiler) {
+  // unbalanced returns (stack tricks) stay at the root
+  if (profiler->depth > 0)
+    profiler->current = profiler->stack[--profiler->depth];
+}
+
+/** called by cpu_step after each instruction, with pc and sp from before it */
+void profiler_record(Profiler *profiler, CPU *cpu, uint16_t pc, uint16_t sp,
+                     uint8_t opcode, int cycles) {
+  uint32_t address = linear(profiler, cpu, pc);
+
+  profiler->counts[address]++;
+  profiler->cycles[address] += cycles;
+  profiler->nodes[profiler->current].cycles += cycles;
+
+  if (opcode == 0xCB) {
+    profiler->opcodes[0x100 + ram_get(cpu->ram, pc + 1)]++;
+    return;
+  }
+  profiler->opcodes[opcode]++;
+
+  switch (opcode) {
+  case 0xC4: case 0xCC: case 0xD4: case 0xDC: case 0xCD: // CALL
+  case 0xC7: case 0xCF: case 0xD7: case 0xDF:            // RST
+  case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+    // conditional calls only count when taken
+    if ((uint16_t)(sp - 2) == cpu->sp)
+      profiler_call(profiler, address, linear(profiler, cpu, cpu->pc));
+    break;
+  case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xC9: case 0xD9: // RET, RETI
+    if ((uint16_t)(sp + 2) == cpu->sp)
+      profiler_return(profiler);
+    break;
+  }
+}
+
+void profiler_interrupt(Profiler *profiler, CPU *cpu, uint16_t pc, uint16_t vector) {
+  profiler_call(profiler, linear(profiler, cpu, pc), vector);
+}
+
+static void write_address(Profiler *profiler, FILE *file, uint32_t address) {
+  if (address < profiler->rom_size) {
+    fprintf(file, "%02X:%04X", address / 0x4000,
+            address < 0x4000 ? address : 0x4000 + address % 0x4000);
+  } else {
+    fprintf(file, "--:%04X", address - profiler->rom_size + 0x8000);
+  }
+}
+
+static void write_stack(Profiler *profiler, FILE *file, uint32_t id) {
+  if (id == 0) {
+    fprintf(file, "root");
+    return;
+  }
+
+  write_stack(profiler, file, profiler->nodes[id].parent);
+  fputc(';', file);
+  write_address(profiler, file, profiler->nodes[id].function);
+}
+
+/** one "root;caller;callee cycles" line per call stack, for flamegraph.pl */
+void profiler_write_folded(Profiler *profiler, FILE *file) {
+  for (uint32_t id = 0; id < profiler->node_count; id++) {
+    if (profiler->nodes[id].cycles == 0)
+      continue;
+
+    write_stack(profiler, file, id);
+    fprintf(file, " %llu\n", (unsigned long long)profiler->nodes[id].cycles);
+  }
+}
+
+typedef struct {
+  uint32_t index;
+  uint64_t value;
+} Ranked;
+
+static int compare_ranked(const void *a, const void *b) {
+  uint64_t x = ((const Ranked *)a)->value, y = ((const Ranked *)b)->value;
+  return (x < y) - (x > y);
+}
+
+static int compare_edges(const void *a, const void *b) {
+  uint64_t x = ((const ProfileEdge *)a)->count, y = ((const ProfileEdge *)b)->count;
+  return (x < y) - (x > y);
+}
+
+static Ranked *rank(const uint64_t *values, uint32_t size, uint32_t *count) {
+  Ranked *ranked = malloc(size * sizeof(Ranked));
+  *count = 0;
+
+  if (ranked == NULL)
+    return NULL;
+
+  for (uint32_t i = 0; i < size; i++) {
+    if (values[i])
+      ranked[(*count)++] = (Ranked){i, values[i]};
+  }
+
+  qsort(ranked, *count, sizeof(Ranked), compare_ranked);
+  return ranked;
+}
+
+/** hottest addresses, opcodes and call edges */
+void profiler_write_report(Profiler *profiler, FILE *file, int top) {
+  uint32_t slots = profiler->rom_size + 0x8000;
+  uint64_t total = 0;
+
+  for (uint32_t i = 0; i < slots; i++) {
+    total += profiler->cycles[i];
+  }
+
+  if (total == 0)
+    return;
+
+  uint32_t count;
+  Ranked *ranked = rank(profiler->cycles, slots, &count);
+
+  fprintf(file, "hottest addresses (%llu cycles total, %llu halted)\n",
+          (unsigned long long)total, (unsigned long long)profiler->halted);
+  fprintf(file, "  address   %12s %14s %7s  instruction\n", "count", "cycles", "%");
+  for (uint32_t i = 0; ranked && i < count && i < (uint32_t)top; i++) {
+    uint32_t address = ranked[i].index;
+
+    fprintf(file, "  ");
+    write_address(profiler, file, address);
+    fprintf(file, "   %12llu %14llu %6.2f%%  %s\n",
+            (unsigned long long)profiler->counts[address],
+            (unsigned long long)profiler->cycles[address],
+            100.0 * profiler->cycles[address] / total,
+            address < profiler->rom_size ? instructions[profiler->rom[address]].mnemonic : "(ram)");
+  }
+  free(ranked);
+
+  ranked = rank(profiler->opcodes, 0x200, &count);
+  fprintf(file, "\nhottest opcodes\n");
+  for (uint32_t i = 0; ranked && i < count && i < (uint32_t)top; i++) {
+    uint32_t opcode = ranked[i].index;
+    fprintf(file, "  %s%02X %12llu  %s\n", opcode >= 0x100 ? "CB " : "   ", opcode & 0xFF,
+            (unsigned long long)profiler->opcodes[opcode],
+            opcode >= 0x100 ? prefixed[opcode & 0xFF].mnemonic : instructions[opcode].mnemonic);
+  }
+  free(ranked);
+
+  ProfileEdge *edges = malloc(profiler->edge_count * sizeof(ProfileEdge));
+  uint32_t edge_count = 0;
+  for (uint32_t i = 0; edges && i < profiler->edge_table_size; i++) {
+    if (profiler->edges[i].count)
+      edges[edge_count++] = profiler->edges[i];
+  }
+  if (edges)
+    qsort(edges, edge_count, sizeof(ProfileEdge), compare_edges);
+
+  fprintf(file, "\nhottest calls\n");
+  for (uint32_t i = 0; i < edge_count && i < (uint32_t)top; i++) {
+    fprintf(file, "  ");
+    write_address(profiler, file, edges[i].from);
+    fprintf(file, " -> ");
+    write_address(profiler, file, edges[i].to);
+    fprintf(file, " %12llu\n", (unsigned long long)edges[i].count);
+  }
+  free(edges);
+}
+
+int profiler_save(Profiler *profiler, const char *name) {
+  char path[4096];
+
+  snprintf(path, sizeof(path), "%s.folded", name);
+  FILE *folded = fopen(path, "w");
+  if (folded == NULL)
+    return -1;
+  profiler_write_folded(profiler, folded);
+  fclose(folded);
+
+  snprintf(path, sizeof(path), "%s.txt", name);
+  FILE *report = fopen(path, "w");
+  if (report == NULL)
+    return -1;
+  profiler_write_report(profiler, report, REPORT_TOP);
+  fclose(report);
+
+  return 0;
+}
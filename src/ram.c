@@ -1,13 +1,19 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "apu.h"
+#include "cheats.h"
+#include "hash.h"
 #include "ram.h"
+#include "serial.h"
 
 #define MBC1 ram->mapper == MAP_MBC1
 #define MBC3 ram->mapper == MAP_MBC3
 
 uint8_t input_get(Input *input, RAM *ram) {
   /** raw get to prevent infinite recursion */
-  uint8_t joypad = ~ram->data[RAM_JOYP] & 0x30;
+  uint8_t joypad = ~ram->io[RAM_JOYP - RAM_IO] & 0x30;
 
   if ((joypad & 0x10)) {
     if (input->right)
@@ -33,9 +39,31 @@ uint8_t input_get(Input *input, RAM *ram) {
   return (~joypad & 0x3F) | 0xC0;
 }
 
-void ram_init(RAM *ram, Input *input, uint8_t *rom) {
+void input_set(Input *input, uint8_t mask) {
+  input->right = (mask & INPUT_RIGHT) != 0;
+  input->left = (mask & INPUT_LEFT) != 0;
+  input->up = (mask & INPUT_UP) != 0;
+  input->down = (mask & INPUT_DOWN) != 0;
+  input->a = (mask & INPUT_A) != 0;
+  input->b = (mask & INPUT_B) != 0;
+  input->select = (mask & INPUT_SELECT) != 0;
+  input->start = (mask & INPUT_START) != 0;
+}
+
+uint8_t input_mask(Input *input) {
+  return (input->right ? INPUT_RIGHT : 0) | (input->left ? INPUT_LEFT : 0) |
+         (input->up ? INPUT_UP : 0) | (input->down ? INPUT_DOWN : 0) |
+         (input->a ? INPUT_A : 0) | (input->b ? INPUT_B : 0) |
+         (input->select ? INPUT_SELECT : 0) | (input->start ? INPUT_START : 0);
+}
+
+static const uint32_t sram_sizes[] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+
+/** returns -1 when cartridge RAM can't be allocated */
+int ram_init(RAM *ram, Input *input, const uint8_t *rom, size_t rom_size) {
   ram->input = input;
   ram->rom = rom;
+  ram->rom_mask = rom_size - 1;
 
   ram->rom_bank = 1;
   ram->ram_bank = 0;
@@ -51,29 +79,135 @@ void ram_init(RAM *ram, Input *input, uint8_t *rom) {
     ram->mapper = MAP_MBC1;
     break;
   }
+
+  uint8_t ram_info = ram->rom[0x149];
+  ram->sram_size = ram_info < 6 ? sram_sizes[ram_info] : 0;
+  if (ram->sram_size > RAM_SRAM_MAX)
+    ram->sram_size = RAM_SRAM_MAX;
+
+  ram->sram = NULL;
+  if (ram->sram_size) {
+    ram->sram = calloc(1, ram->sram_size);
+    if (ram->sram == NULL)
+      return -1;
+  }
+
+  ram_map_banks(ram);
+  ram_dirty_all(ram);
+  return 0;
+}
+
+void ram_free(RAM *ram) {
+  free(ram->sram);
+  ram->sram = NULL;
+  ram->sram_size = 0;
+}
+
+/**
+ * Points rom0 and romx at the current banks, after a switch, a state load
+ * or a change of cheats.
+ */
+void ram_map_banks(RAM *ram) {
+  // banks past the end of the image wrap, as on a real cartridge
+  uint32_t offset = (ram->rom_bank * 0x4000) & ram->rom_mask;
+  ram->rom0 = ram->rom;
+  ram->romx = ram->rom + offset;
+
+  if (ram->cheats) {
+    const uint8_t *rom0 = cheats_bank(ram->cheats, ram, 0);
+    const uint8_t *romx = cheats_bank(ram->cheats, ram, offset / 0x4000);
+    if (rom0)
+      ram->rom0 = rom0;
+    if (romx)
+      ram->romx = romx;
+  }
+}
+
+static inline uint8_t *ram_sram(RAM *ram, uint16_t address) {
+  if (ram->sram == NULL || (MBC1 && !ram->ram_enable))
+    return NULL;
+
+  return &ram->sram[(ram->ram_bank * RAM_BANK_SIZE + (address - 0xA000)) & (ram->sram_size - 1)];
+}
+
+static inline uint8_t ram_read(RAM *ram, uint16_t address) {
+  switch (address >> 12) {
+  case 0x0 ... 0x3:
+    return ram->rom0[address];
+  case 0x4 ... 0x7:
+    return ram->romx[address - 0x4000];
+  case 0x8 ... 0x9:
+    return ram->vram[address & 0x1FFF];
+  case 0xA ... 0xB: {
+    uint8_t *sram = ram_sram(ram, address);
+    return sram ? *sram : 0xFF;
+  }
+  case 0xC ... 0xD:
+    return ram->wram[address & 0x1FFF];
+  default:
+    if (address <= 0xFDFF)
+      return ram->wram[address & 0x1FFF];
+    if (address <= 0xFE9F)
+      return ram->oam[address - RAM_OAM];
+    if (address < RAM_IO)
+      return 0xFF;
+    if (address == RAM_JOYP)
+      return input_get(ram->input, ram);
+    // NR52 shows which channels are still on
+    if (address == NR52 && ram->apu)
+      apu_sync(ram->apu);
+    if (address < 0xFF80)
+      return ram->io[address - RAM_IO];
+    if (address < 0xFFFF)
+      return ram->hram[address - 0xFF80];
+    return ram->ie;
+  }
+}
+
+static inline void ram_log_write(RAMWriteLog *log, uint16_t address) {
+  if (log->count < RAM_WRITE_LOG_SIZE)
+    log->addresses[log->count] = address;
+  log->count++;
 }
 
 void ram_set(RAM *ram, uint16_t address, uint8_t value) {
+  COUNT(ram, writes[counters_region(address)]);
+
+  if (ram->writes)
+    ram_log_write(ram->writes, address);
+
   switch (address >> 12) {
   case 0x0 ... 0x1:
     if (MBC1)
       ram->ram_enable = (value & 0x0A) == 0x0A;
     break;
   case 0x2 ... 0x3:
-    if (MBC1)
-      ram->rom_bank = (ram->rom_bank & 0x60) | (value & 0x1F);
+    if (MBC1) {
+      uint8_t bank = (ram->rom_bank & 0x60) | (value & 0x1F);
+      if (bank != ram->rom_bank)
+        COUNT(ram, bank_switches);
+      ram->rom_bank = bank;
+      ram_map_banks(ram);
+    }
     break;
   case 0x4 ... 0x5:
     if (MBC1) {
       value &= 0x03;
       switch (ram->bank_mode) {
       case BANK_RAM:
+        if (value != ram->ram_bank)
+          COUNT(ram, bank_switches);
         ram->ram_bank = value;
         break;
-      case BANK_ROM:
-        ram->rom_bank = (ram->rom_bank & 0x1F) | (value << 5);
+      case BANK_ROM: {
+        uint8_t bank = (ram->rom_bank & 0x1F) | (value << 5);
+        if (bank != ram->rom_bank)
+          COUNT(ram, bank_switches);
+        ram->rom_bank = bank;
+        ram_map_banks(ram);
         break;
       }
+      }
     }
     break;
   case 0x6 ... 0x7:
@@ -86,65 +220,147 @@ void ram_set(RAM *ram, uint16_t address, uint8_t value) {
       }
     }
     break;
-  case 0xA ... 0xB:
-    switch (ram->mapper) {
-    case MAP_NONE:
-      break;
-    case MAP_MBC1:
-      if (ram->ram_enable)
-        ram->banks[address - 0xA000 + ram->ram_bank * 0x2000] = value;
-      break;
+  case 0x8 ... 0x9:
+    ram->vram[address & 0x1FFF] = value;
+    ram->dirty[(address & 0x1FFF) / RAM_HASH_BLOCK] = 1;
+    break;
+  case 0xA ... 0xB: {
+    uint8_t *sram = ram_sram(ram, address);
+    if (sram) {
+      *sram = value;
+      ram_dirty_sram(ram, sram - ram->sram);
     }
+    break;
+  }
   case 0xC ... 0xD:
-    // work ram
+    ram->wram[address & 0x1FFF] = value;
+    ram->dirty[RAM_HASH_WRAM + (address & 0x1FFF) / RAM_HASH_BLOCK] = 1;
     break;
   case 0xE ... 0xF:
     if (address <= 0xFDFF) {
-      ram->data[address - 0x2000] = value;
-    } else if (address == RAM_DMA) {
-      uint16_t src = value << 8;
-      for (int i = 0; i < 0xA0; i++) {
-        ram->data[RAM_OAM + i] = ram->data[src + i];
+      // echo of work ram
+      ram->wram[address & 0x1FFF] = value;
+      ram->dirty[RAM_HASH_WRAM + (address & 0x1FFF) / RAM_HASH_BLOCK] = 1;
+    } else if (address <= 0xFE9F) {
+      ram->oam[address - RAM_OAM] = value;
+    } else if (address < RAM_IO) {
+      // unusable
+    } else if (address == SERIAL_SC && ram->serial) {
+      serial_control(ram->serial, value);
+    } else if (address >= NR10 && address <= APU_LAST && ram->apu) {
+      apu_write(ram->apu, address, value);
+    } else if (address < 0xFF80) {
+      ram->io[address - RAM_IO] = value;
+
+      if (address == RAM_DMA) {
+        COUNT(ram, dma_transfers);
+        uint16_t src = value << 8;
+        for (int i = 0; i < 0xA0; i++) {
+          ram->oam[i] = ram_read(ram, src + i);
+        }
       }
+    } else if (address < 0xFFFF) {
+      ram->hram[address - 0xFF80] = value;
+    } else {
+      ram->ie = value;
     }
     break;
   }
-
-  ram->data[address] = value;
 }
 
 uint8_t ram_get(RAM *ram, uint16_t address) {
-  switch (address >> 12) {
-  case 0x0 ... 0x3:
-    return ram->rom[address];
-    break;
-  case 0x4 ... 0x7:
-    return ram->rom[address - 0x4000 + ram->rom_bank * 0x4000];
-    break;
-  case 0x8 ... 0x9:
-    break;
-  case 0xA ... 0xB:
-    switch (ram->mapper) {
-    case MAP_NONE:
-      break;
-    case MAP_MBC1:
-      if (ram->ram_enable)
-        return ram->banks[address - 0xA000 + ram->ram_bank * 0x2000];
-      break;
-    }
-  case 0xC ... 0xD:
-    // work ram
-    break;
-  case 0xE ... 0xF:
-    if (address <= 0xFDFF) {
-      return ram->data[address - 0x2000];
-    } else if (address == RAM_JOYP) {
-      return input_get(ram->input, ram);
-    }
-    break;
+  COUNT(ram, reads[counters_region(address)]);
+  return ram_read(ram, address);
+}
+
+// VRAM, WRAM, OAM or HRAM: memory where a byte is just a byte
+static uint8_t *ram_plain_span(RAM *ram, uint16_t address, uint32_t size) {
+  uint32_t end = (uint32_t)address + size;
+
+  if (address >= RAM_VRAM && end <= 0xA000)
+    return &ram->vram[address - RAM_VRAM];
+  if (address >= 0xC000 && end <= 0xE000)
+    return &ram->wram[address - 0xC000];
+  if (address >= RAM_OAM && end <= 0xFEA0)
+    return &ram->oam[address - RAM_OAM];
+  if (address >= 0xFF80 && end <= 0xFFFF)
+    return &ram->hram[address - 0xFF80];
+
+  return NULL;
+}
+
+/**
+ * Host pointers to `size` bytes at `address`, for bulk access that must
+ * behave exactly like that many ram_get/ram_set calls. NULL unless the range
+ * stays within one region without side effects: never IO, echo, the mapper
+ * or cartridge RAM, and ROM only for reading.
+ */
+const uint8_t *ram_read_span(RAM *ram, uint16_t address, uint32_t size) {
+  uint32_t end = (uint32_t)address + size;
+
+  if (end <= 0x4000)
+    return &ram->rom0[address];
+  if (address >= 0x4000 && end <= 0x8000)
+    return &ram->romx[address - 0x4000];
+
+  return ram_plain_span(ram, address, size);
+}
+
+// the whole span counts as written
+uint8_t *ram_write_span(RAM *ram, uint16_t address, uint32_t size) {
+  uint8_t *span = ram_plain_span(ram, address, size);
+
+  if (span && ram->writes) {
+    for (uint32_t i = 0; i < size; i++)
+      ram_log_write(ram->writes, address + i);
+  }
+
+  // a span stays within VRAM or WRAM, both 8KB, or isn't hashed in blocks
+  if (span && size && (address >> 13 == 0x4 || address >> 13 == 0x6)) {
+    int base = address >= 0xC000 ? RAM_HASH_WRAM : 0;
+    uint32_t offset = address & 0x1FFF;
+    for (uint32_t block = offset / RAM_HASH_BLOCK; block <= (offset + size - 1) / RAM_HASH_BLOCK; block++)
+      ram->dirty[base + block] = 1;
   }
 
-  return ram->data[address];
+  return span;
+}
+
+/** after writes that bypass ram_set, e.g. loading a state */
+void ram_dirty_all(RAM *ram) {
+  memset(ram->dirty, 1, sizeof(ram->dirty));
+}
+
+static uint64_t ram_block_hash(RAM *ram, int block, const uint8_t *data) {
+  if (ram->dirty[block]) {
+    uint64_t hash = hash64(data, RAM_HASH_BLOCK, 0);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    // stored little-endian, so the hash of hashes matches across hosts
+    hash = __builtin_bswap64(hash);
+#endif
+    ram->block_hashes[block] = hash;
+    ram->dirty[block] = 0;
+  }
+  return ram->block_hashes[block];
+}
+
+/**
+ * hash64 of VRAM, WRAM and cartridge RAM, through the hashes of their
+ * 256-byte blocks: only blocks written since the last call are hashed
+ * again, the rest come from `block_hashes`. A function of the contents
+ * alone, however the blocks got dirty.
+ */
+uint64_t ram_hash(RAM *ram, uint64_t seed) {
+  int blocks = RAM_HASH_SRAM + ram->sram_size / RAM_HASH_BLOCK;
+
+  for (int block = 0; block < RAM_HASH_WRAM; block++)
+    ram_block_hash(ram, block, &ram->vram[block * RAM_HASH_BLOCK]);
+  for (int block = RAM_HASH_WRAM; block < RAM_HASH_SRAM; block++)
+    ram_block_hash(ram, block, &ram->wram[(block - RAM_HASH_WRAM) * RAM_HASH_BLOCK]);
+  for (int block = RAM_HASH_SRAM; block < blocks; block++)
+    ram_block_hash(ram, block, &ram->sram[(block - RAM_HASH_SRAM) * RAM_HASH_BLOCK]);
+
+  return hash64(ram->block_hashes, blocks * sizeof(uint64_t), seed);
 }
 
 // TODO: remove this
@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+
+/**
+ * Run-length encoding, one control byte per token:
+ *   0x00-0x7F  n + 1 literal bytes follow
+ *   0x80-0xBF  the next byte repeated (n & 0x3F) + 2 times
+ *   0xC0-0xFF  ((n & 0x3F) << 8 | next byte) + 1 zero bytes
+ * Zero runs get their own long form since XOR deltas are mostly zeros.
+ */
+#define RLE_LITERAL_MAX 0x80
+#define RLE_RUN_MAX 0x41
+#define RLE_ZEROS_MAX 0x4000
+
+#define ENCODED_MAX(size) ((size) + (size) / RLE_LITERAL_MAX + 16)
+
+static size_t rle_encode(const uint8_t *src, size_t size, uint8_t *dst) {
+  uint8_t *out = dst;
+  size_t i = 0;
+  size_t literal = 0; // start of pending literals
+
+  while (i < size) {
+    uint8_t value = src[i];
+    size_t run = 1;
+
+    if (value == 0) {
+      // skip zeros a word at a time
+      while (i + run + 8 <= size && run < RLE_ZEROS_MAX - 8) {
+        uint64_t word;
+        memcpy(&word, src + i + run, 8);
+        if (word)
+          break;
+        run += 8;
+      }
+    }
+
+    size_t max = value == 0 ? RLE_ZEROS_MAX : RLE_RUN_MAX;
+    while (i + run < size && run < max && src[i + run] == value)
+      run++;
+
+    if (run < 3) {
+      i += run;
+      continue;
+    }
+
+    // flush literals before the run
+    while (literal < i) {
+      size_t n = i - literal < RLE_LITERAL_MAX ? i - literal : RLE_LITERAL_MAX;
+      *out++ = n - 1;
+      memcpy(out, src + literal, n);
+      out += n;
+      literal += n;
+    }
+
+    if (value == 0) {
+      *out++ = 0xC0 | ((run - 1) >> 8);
+      *out++ = (run - 1) & 0xFF;
+    } else {
+      *out++ = 0x80 | (run - 2);
+      *out++ = value;
+    }
+
+    i += run;
+    literal = i;
+  }
+
+  while (literal < size) {
+    size_t n = size - literal < RLE_LITERAL_MAX ? size - literal : RLE_LITERAL_MAX;
+    *out++ = n - 1;
+    memcpy(out, src + literal, n);
+    out += n;
+    literal += n;
+  }
+
+  return out - dst;
+}
+
+static void rle_decode(const uint8_t *src, size_t size, uint8_t *dst) {
+  const uint8_t *end = src + size;
+
+  while (src < end) {
+    uint8_t control = *src++;
+
+    if (control < 0x80) {
+      memcpy(dst, src, control + 1);
+      dst += control + 1;
+      src += control + 1;
+    } else if (control < 0xC0) {
+      memset(dst, *src++, (control & 0x3F) + 2);
+      dst += (control & 0x3F) + 2;
+    } else {
+      size_t run = ((control & 0x3F) << 8 | *src++) + 1;
+      memset(dst, 0, run);
+      dst += run;
+    }
+  }
+}
+
+static void xor_buffer(uint8_t *dst, const uint8_t *src, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    dst[i] ^= src[i];
+  }
+}
+
+int rewind_init(Rewind *rewind, Emulator *emulator, size_t capacity,
+                int max_frames, int interval) {
+  rewind->state_size = emulator_state_size(emulator);
+  rewind->capacity = capacity;
+  rewind->max_entries = max_frames;
+  rewind->interval = interval > 0 ? interval : 1;
+
+  rewind->arena = malloc(capacity);
+  rewind->entries = malloc(max_frames * sizeof(RewindEntry));
+  rewind->key = malloc(rewind->state_size);
+  rewind->state = malloc(rewind->state_size);
+  rewind->encoded = malloc(ENCODED_MAX(rewind->state_size));
+
+  rewind->head = 0;
+  rewind->first = 0;
+  rewind->count = 0;
+  rewind->since_key = 0;
+
+  if (!rewind->arena || !rewind->entries || !rewind->key || !rewind->state ||
+      !rewind->encoded) {
+    rewind_free(rewind);
+    return -1;
+  }
+
+  return 0;
+}
+
+void rewind_free(Rewind *rewind) {
+  free(rewind->arena);
+  free(rewind->entries);
+  free(rewind->key);
+  free(rewind->state);
+  free(rewind->encoded);
+
+  rewind->arena = NULL;
+  rewind->entries = NULL;
+  rewind->key = NULL;
+  rewind->state = NULL;
+  rewind->encoded = NULL;
+  rewind->count = 0;
+}
+
+static inline RewindEntry *rewind_entry(Rewind *rewind, int index) {
+  return &rewind->entries[(rewind->first + index) % rewind->max_entries];
+}
+
+/** drops the oldest keyframe and every delta that depends on it */
+static void rewind_drop_oldest(Rewind *rewind) {
+  do {
+    rewind->first = (rewind->first + 1) % rewind->max_entries;
+    rewind->count--;
+  } while (rewind->count > 0 && !rewind_entry(rewind, 0)->keyframe);
+
+  if (rewind->count == 0) {
+    rewind->head = 0;
+    rewind->since_key = 0;
+  }
+}
+
+/** finds room for `size` contiguous bytes, evicting as needed */
+static size_t rewind_reserve(Rewind *rewind, size_t size) {
+  while (rewind->count > 0) {
+    size_t oldest = rewind_entry(rewind, 0)->offset;
+
+    if (oldest < rewind->head) {
+      if (rewind->head + size <= rewind->capacity)
+        return rewind->head;
+      if (size <= oldest)
+        return 0;
+    } else if (rewind->head + size <= oldest) {
+      return rewind->head;
+    }
+
+    rewind_drop_oldest(rewind);
+  }
+
+  return 0;
+}
+
+/** stores the emulator's current state as the newest frame */
+void rewind_push(Rewind *rewind, Emulator *emulator) {
+  if (rewind->count == rewind->max_entries)
+    rewind_drop_oldest(rewind);
+
+  uint8_t keyframe = rewind->count == 0 || rewind->since_key >= rewind->interval;
+
+  emulator_save_state(emulator, rewind->state);
+
+  if (keyframe) {
+    memcpy(rewind->key, rewind->state, rewind->state_size);
+  } else {
+    xor_buffer(rewind->state, rewind->key, rewind->state_size);
+  }
+
+  size_t size = rle_encode(rewind->state, rewind->state_size, rewind->encoded);
+  size_t offset = rewind_reserve(rewind, size);
+
+  if (!keyframe && rewind->count == 0) {
+    // making room evicted this delta's own keyframe, store a keyframe instead
+    xor_buffer(rewind->state, rewind->key, rewind->state_size);
+    memcpy(rewind->key, rewind->state, rewind->state_size);
+    size = rle_encode(rewind->state, rewind->state_size, rewind->encoded);
+    keyframe = 1;
+    offset = 0;
+  }
+
+  if (size > rewind->capacity)
+    return;
+
+  memcpy(rewind->arena + offset, rewind->encoded, size);
+
+  RewindEntry *entry = rewind_entry(rewind, rewind->count);
+  entry->offset = offset;
+  entry->size = size;
+  entry->keyframe = keyframe;
+
+  rewind->count++;
+  rewind->head = offset + size;
+  rewind->since_key = keyframe ? 1 : rewind->since_key + 1;
+}
+
+/**
+ * Loads the newest stored frame into the emulator and removes it.
+ * Returns -1 when there is nothing left to rewind to.
+ */
+int rewind_pop(Rewind *rewind, Emulator *emulator) {
+  if (rewind->count == 0)
+    return -1;
+
+  RewindEntry *entry = rewind_entry(rewind, rewind->count - 1);
+  rle_decode(rewind->arena + entry->offset, entry->size, rewind->state);
+
+  if (!entry->keyframe)
+    xor_buffer(rewind->state, rewind->key, rewind->state_size);
+
+  emulator_load_state(emulator, rewind->state, rewind->state_size);
+
+  rewind->count--;
+  rewind->since_key--;
+  rewind->head = entry->offset;
+
+  if (entry->keyframe && rewind->count > 0) {
+    // step back into the previous group: decode its keyframe
+    int index = rewind->count - 1;
+    while (!rewind_entry(rewind, index)->keyframe)
+      index--;
+
+    RewindEntry *key = rewind_entry(rewind, index);
+    rle_decode(rewind->arena + key->offset, key->size, rewind->key);
+    rewind->since_key = rewind->count - index;
+  }
+
+  if (rewind->count == 0) {
+    rewind->head = 0;
+    rewind->since_key = 0;
+  }
+
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+/** `frames` is rounded up to a power of two; returns -1 out of memory */
+int ring_init(AudioRing *ring, uint32_t frames) {
+  uint32_t capacity = 1;
+  while (capacity < frames)
+    capacity <<= 1;
+
+  ring->samples = calloc(capacity * 2, sizeof(int16_t));
+  if (ring->samples == NULL)
+    return -1;
+
+  ring->capacity = capacity;
+  ring->head = 0;
+  ring->tail = 0;
+  return 0;
+}
+
+void ring_free(AudioRing *ring) {
+  free(ring->samples);
+  ring->samples = NULL;
+}
+
+/** producer: copies as many frames as fit, the rest is dropped */
+size_t ring_write(AudioRing *ring, const int16_t *frames, size_t count) {
+  uint32_t head = ring->head;
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  size_t space = ring->capacity - (head - tail);
+  if (count > space)
+    count = space;
+
+  for (size_t done = 0; done < count;) {
+    uint32_t index = (head + done) & (ring->capacity - 1);
+    size_t run = ring->capacity - index < count - done ? ring->capacity - index : count - done;
+    memcpy(&ring->samples[index * 2], &frames[done * 2], run * 2 * sizeof(int16_t));
+    done += run;
+  }
+
+  __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+  return count;
+}
+
+/** consumer: takes up to `count` frames */
+size_t ring_read(AudioRing *ring, int16_t *frames, size_t count) {
+  uint32_t tail = ring->tail;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  size_t available = head - tail;
+  if (count > available)
+    count = available;
+
+  for (size_t done = 0; done < count;) {
+    uint32_t index = (tail + done) & (ring->capacity - 1);
+    size_t run = ring->capacity - index < count - done ? ring->capacity - index : count - done;
+    memcpy(&frames[done * 2], &ring->samples[index * 2], run * 2 * sizeof(int16_t));
+    done += run;
+  }
+
+  __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+  return count;
+}
+
+size_t ring_level(AudioRing *ring) {
+  return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+         __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,59 @@
+#include "serial.h"
+
+#define SB(serial) (serial)->io[SERIAL_SB - 0xFF00]
+#define SC(serial) (serial)->io[SERIAL_SC - 0xFF00]
+
+// unused SC bits read as 1
+#define SC_UNUSED 0x7E
+
+void serial_init(Serial *serial, uint8_t *io, CPU *cpu) {
+  serial->io = io;
+  serial->cpu = cpu;
+  serial->timer = 0;
+  serial->finished = 0;
+  serial->capture = NULL;
+  serial->link = NULL;
+
+  SB(serial) = 0x00;
+  SC(serial) = SC_UNUSED;
+}
+
+/** a CPU write to SC, starts or stops a transfer */
+void serial_control(Serial *serial, uint8_t value) {
+  SC(serial) = value | SC_UNUSED;
+  serial->timer = 0;
+  serial->finished = 0;
+
+  if ((value & (SERIAL_START | SERIAL_INTERNAL)) != (SERIAL_START | SERIAL_INTERNAL))
+    return;
+
+  serial->timer = SERIAL_BYTE_CYCLES;
+  if (serial->capture) {
+    fputc(SB(serial), serial->capture);
+    fflush(serial->capture);
+  }
+}
+
+/** only while an internal clock transfer runs */
+void serial_step(Serial *serial, int cycles) {
+  serial->timer -= cycles;
+  if (serial->timer > 0)
+    return;
+
+  serial->timer = 0;
+  if (serial->link)
+    serial->finished = 1;
+  else
+    serial_finish(serial, 0xFF);
+}
+
+void serial_finish(Serial *serial, uint8_t received) {
+  SB(serial) = received;
+  SC(serial) &= ~SERIAL_START;
+  serial->finished = 0;
+  cpu_interrupt(serial->cpu, INT_SERIAL);
+}
+
+int serial_listening(Serial *serial) {
+  return (SC(serial) & (SERIAL_START | SERIAL_INTERNAL)) == SERIAL_START;
+}
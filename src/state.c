@@ -0,0 +1,333 @@
+#include <string.h>
+
+#include "emulator.h"
+#include "hash.h"
+
+#define STATE_HEADER_SIZE 12
+// registers, sp, pc, ime, halted and cycles; the mapper byte follows
+#define STATE_CPU_SIZE (8 + 2 + 2 + 1 + 1 + 4)
+
+// vram, wram, oam, io, hram and ie
+#define STATE_MEMORY_SIZE (0x2000 + 0x2000 + 0xA0 + 0x80 + 0x7F + 1)
+
+static inline uint8_t *put8(uint8_t *p, uint8_t value) {
+  *p++ = value;
+  return p;
+}
+
+static inline uint8_t *put16(uint8_t *p, uint16_t value) {
+  *p++ = value & 0xFF;
+  *p++ = value >> 8;
+  return p;
+}
+
+static inline uint8_t *put32(uint8_t *p, uint32_t value) {
+  p = put16(p, value & 0xFFFF);
+  return put16(p, value >> 16);
+}
+
+static inline uint8_t *put64(uint8_t *p, uint64_t value) {
+  p = put32(p, value & 0xFFFFFFFF);
+  return put32(p, value >> 32);
+}
+
+static inline uint8_t *put_bytes(uint8_t *p, const uint8_t *bytes, size_t size) {
+  memcpy(p, bytes, size);
+  return p + size;
+}
+
+static inline const uint8_t *get8(const uint8_t *p, uint8_t *value) {
+  *value = *p++;
+  return p;
+}
+
+static inline const uint8_t *get16(const uint8_t *p, uint16_t *value) {
+  *value = p[0] | p[1] << 8;
+  return p + 2;
+}
+
+static inline const uint8_t *get32(const uint8_t *p, uint32_t *value) {
+  *value = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+  return p + 4;
+}
+
+static inline const uint8_t *get64(const uint8_t *p, uint64_t *value) {
+  uint32_t low, high;
+  p = get32(p, &low);
+  p = get32(p, &high);
+  *value = (uint64_t)high << 32 | low;
+  return p;
+}
+
+static inline const uint8_t *get_bytes(const uint8_t *p, uint8_t *bytes, size_t size) {
+  memcpy(bytes, p, size);
+  return p + size;
+}
+
+// lengths, envelopes, frequencies, sweep and the frame sequencer; the
+// waveforms only matter to the synth
+#define STATE_APU_SIZE (4 * 7 + 4 + 3)
+
+static uint8_t *put_apu(uint8_t *p, const APU *apu) {
+  for (int i = 0; i < 4; i++) {
+    const APUChannel *channel = &apu->channels[i];
+    p = put8(p, channel->enabled);
+    p = put16(p, channel->length);
+    p = put8(p, channel->volume);
+    p = put8(p, channel->envelope_timer);
+    p = put16(p, channel->frequency);
+  }
+
+  p = put8(p, apu->channels[0].sweep_enabled);
+  p = put8(p, apu->channels[0].sweep_timer);
+  p = put16(p, apu->channels[0].sweep_shadow);
+  p = put8(p, apu->sequencer_step);
+  return put16(p, apu->sequencer_timer);
+}
+
+static const uint8_t *get_apu(const uint8_t *p, APU *apu) {
+  for (int i = 0; i < 4; i++) {
+    APUChannel *channel = &apu->channels[i];
+    p = get8(p, &channel->enabled);
+    p = get16(p, &channel->length);
+    p = get8(p, &channel->volume);
+    p = get8(p, &channel->envelope_timer);
+    p = get16(p, &channel->frequency);
+  }
+
+  p = get8(p, &apu->channels[0].sweep_enabled);
+  p = get8(p, &apu->channels[0].sweep_timer);
+  p = get16(p, &apu->channels[0].sweep_shadow);
+  p = get8(p, &apu->sequencer_step);
+  p = get16(p, &apu->sequencer_timer);
+  // cycles the CPU ran before the load never reach the loaded state
+  apu->pending = 0;
+  return p;
+}
+
+// the transfer timer and a transfer waiting for the link
+#define STATE_SERIAL_SIZE (2 + 1)
+
+size_t emulator_state_size(Emulator *emulator) {
+  size_t size = STATE_HEADER_SIZE;
+
+  size += STATE_CPU_SIZE;
+  size += 5 + 1;                      // mapper, input
+  size += STATE_MEMORY_SIZE;
+  size += emulator->ram.sram_size;
+  size += 1 + 4 + 4;                  // gpu
+  size += 4 + 4 + 8;                  // timers, cycles
+  size += STATE_APU_SIZE;
+  size += STATE_SERIAL_SIZE;
+
+  return size;
+}
+
+/**
+ * Serialises the emulator into `buffer`, which must hold at least
+ * emulator_state_size() bytes (STATE_MAX_SIZE always does).
+ * Returns the number of bytes written.
+ */
+size_t emulator_save_state(Emulator *emulator, uint8_t *buffer) {
+  CPU *cpu = &emulator->cpu;
+  RAM *ram = &emulator->ram;
+  GPU *gpu = &emulator->gpu;
+  size_t size = emulator_state_size(emulator);
+
+  uint8_t *p = buffer;
+  memcpy(p, STATE_MAGIC, 4);
+  p = put16(p + 4, STATE_VERSION);
+  p = put16(p, 0);
+  p = put32(p, size);
+
+  p = put8(p, cpu->a);
+  p = put8(p, cpu->f);
+  p = put8(p, cpu->b);
+  p = put8(p, cpu->c);
+  p = put8(p, cpu->d);
+  p = put8(p, cpu->e);
+  p = put8(p, cpu->h);
+  p = put8(p, cpu->l);
+  p = put16(p, cpu->sp);
+  p = put16(p, cpu->pc);
+  p = put8(p, cpu->ime);
+  p = put8(p, cpu->halted);
+  p = put32(p, cpu->cycles);
+
+  p = put8(p, ram->mapper);
+  p = put8(p, ram->rom_bank);
+  p = put8(p, ram->ram_bank);
+  p = put8(p, ram->ram_enable);
+  p = put8(p, ram->bank_mode);
+  p = put8(p, input_mask(&emulator->input));
+
+  p = put_bytes(p, ram->vram, sizeof(ram->vram));
+  p = put_bytes(p, ram->wram, sizeof(ram->wram));
+  p = put_bytes(p, ram->oam, sizeof(ram->oam));
+  p = put_bytes(p, ram->io, sizeof(ram->io));
+  p = put_bytes(p, ram->hram, sizeof(ram->hram));
+  p = put8(p, ram->ie);
+  p = put_bytes(p, ram->sram, ram->sram_size);
+
+  p = put8(p, gpu->mode);
+  p = put32(p, gpu->cycles);
+  p = put32(p, gpu->scanline);
+
+  p = put32(p, emulator->div);
+  p = put32(p, emulator->tima);
+  p = put64(p, emulator->cycles);
+  p = put_apu(p, &emulator->apu);
+  p = put16(p, emulator->serial.timer);
+  p = put8(p, emulator->serial.finished);
+
+  return p - buffer;
+}
+
+/**
+ * Restores a state written by emulator_save_state into an emulator that was
+ * initialised with the same ROM. Pointers between components are left as
+ * they are. Returns 0 on success, -1 if the buffer is not a state of this
+ * version or doesn't match this cartridge.
+ */
+int emulator_load_state(Emulator *emulator, const uint8_t *buffer, size_t size) {
+  CPU *cpu = &emulator->cpu;
+  RAM *ram = &emulator->ram;
+  GPU *gpu = &emulator->gpu;
+
+  uint16_t version, reserved;
+  uint32_t total;
+  uint8_t value;
+  uint16_t word;
+  uint32_t dword;
+
+  if (size < STATE_HEADER_SIZE || memcmp(buffer, STATE_MAGIC, 4) != 0)
+    return -1;
+
+  const uint8_t *p = get16(buffer + 4, &version);
+  p = get16(p, &reserved);
+  p = get32(p, &total);
+
+  if (version != STATE_VERSION || total != size ||
+      total != emulator_state_size(emulator))
+    return -1;
+
+  // every check comes before the first field is written, so a state that
+  // is refused leaves the emulator as it was
+  if (p[STATE_CPU_SIZE] != ram->mapper)
+    return -1;
+
+  p = get8(p, &cpu->a);
+  p = get8(p, &cpu->f);
+  p = get8(p, &cpu->b);
+  p = get8(p, &cpu->c);
+  p = get8(p, &cpu->d);
+  p = get8(p, &cpu->e);
+  p = get8(p, &cpu->h);
+  p = get8(p, &cpu->l);
+  p = get16(p, &cpu->sp);
+  p = get16(p, &cpu->pc);
+  p = get8(p, &cpu->ime);
+  p = get8(p, &cpu->halted);
+  p = get32(p, &dword);
+  cpu->cycles = dword;
+  // states are only ever saved from a running CPU
+  cpu->error = CPU_OK;
+
+  p = get8(p, &value); // the mapper, checked above
+  p = get8(p, &ram->rom_bank);
+  p = get8(p, &ram->ram_bank);
+  p = get8(p, &ram->ram_enable);
+  p = get8(p, &value);
+  ram->bank_mode = value;
+  p = get8(p, &value);
+  input_set(&emulator->input, value);
+
+  ram_map_banks(ram);
+
+  p = get_bytes(p, ram->vram, sizeof(ram->vram));
+  p = get_bytes(p, ram->wram, sizeof(ram->wram));
+  p = get_bytes(p, ram->oam, sizeof(ram->oam));
+  p = get_bytes(p, ram->io, sizeof(ram->io));
+  p = get_bytes(p, ram->hram, sizeof(ram->hram));
+  p = get8(p, &ram->ie);
+  p = get_bytes(p, ram->sram, ram->sram_size);
+  ram_dirty_all(ram);
+
+  p = get8(p, &value);
+  gpu->mode = value;
+  p = get32(p, &dword);
+  gpu->cycles = dword;
+  p = get32(p, &dword);
+  gpu->scanline = dword;
+
+  p = get32(p, &dword);
+  emulator->div = dword;
+  p = get32(p, &dword);
+  emulator->tima = dword;
+  p = get64(p, &emulator->cycles);
+  p = get_apu(p, &emulator->apu);
+  p = get16(p, &word);
+  emulator->serial.timer = word;
+  p = get8(p, &emulator->serial.finished);
+
+  // a byte saved waiting for its partner, loaded with none: the line is high
+  if (emulator->serial.finished && emulator->serial.link == NULL)
+    serial_finish(&emulator->serial, 0xFF);
+
+  return 0;
+}
+
+/**
+ * Hashes everything a save state holds, without serialising it: two
+ * emulators with equal hashes are, for all practical purposes, in the same
+ * state. Used to catch a replay or another build drifting off. VRAM, WRAM
+ * and cartridge RAM come from ram_hash, which only rehashes the 256-byte
+ * blocks written since the last call. Only OAM, IO, HRAM and the
+ * scalars, under 500 bytes, are hashed in full every time.
+ */
+uint64_t emulator_state_hash(Emulator *emulator) {
+  CPU *cpu = &emulator->cpu;
+  RAM *ram = &emulator->ram;
+  GPU *gpu = &emulator->gpu;
+
+  // scalars packed first, so struct padding never reaches the hash
+  uint8_t scalars[64 + STATE_APU_SIZE + STATE_SERIAL_SIZE];
+  uint8_t *p = scalars;
+  p = put8(p, cpu->a);
+  p = put8(p, cpu->f);
+  p = put8(p, cpu->b);
+  p = put8(p, cpu->c);
+  p = put8(p, cpu->d);
+  p = put8(p, cpu->e);
+  p = put8(p, cpu->h);
+  p = put8(p, cpu->l);
+  p = put16(p, cpu->sp);
+  p = put16(p, cpu->pc);
+  p = put8(p, cpu->ime);
+  p = put8(p, cpu->halted);
+  p = put32(p, cpu->cycles);
+  p = put8(p, ram->mapper);
+  p = put8(p, ram->rom_bank);
+  p = put8(p, ram->ram_bank);
+  p = put8(p, ram->ram_enable);
+  p = put8(p, ram->bank_mode);
+  p = put8(p, input_mask(&emulator->input));
+  p = put8(p, ram->ie);
+  p = put8(p, gpu->mode);
+  p = put32(p, gpu->cycles);
+  p = put32(p, gpu->scanline);
+  p = put32(p, emulator->div);
+  p = put32(p, emulator->tima);
+  p = put64(p, emulator->cycles);
+  p = put_apu(p, &emulator->apu);
+  p = put16(p, emulator->serial.timer);
+  p = put8(p, emulator->serial.finished);
+
+  // each block seeds the next
+  uint64_t hash = hash64(scalars, p - scalars, 0);
+  hash = ram_hash(ram, hash);
+  hash = hash64(ram->oam, sizeof(ram->oam), hash);
+  hash = hash64(ram->io, sizeof(ram->io), hash);
+  return hash64(ram->hram, sizeof(ram->hram), hash);
+}
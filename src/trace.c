@@ -0,0 +1,109 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ram.h"
+#include "trace.h"
+
+static int trace_mmap(Trace *trace, int fd, size_t size, int prot) {
+  void *map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+    return -1;
+
+  trace->header = map;
+  trace->records = (TraceRecord *)((uint8_t *)map + sizeof(TraceHeader));
+  trace->size = size;
+
+  return 0;
+}
+
+/** creates (or truncates) a ring file for `capacity` records */
+int trace_open(Trace *trace, const char *path, uint32_t capacity) {
+  size_t size = sizeof(TraceHeader) + (size_t)capacity * sizeof(TraceRecord);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return -1;
+
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  if (trace_mmap(trace, fd, size, PROT_READ | PROT_WRITE) != 0)
+    return -1;
+
+  memcpy(trace->header->magic, TRACE_MAGIC, 4);
+  trace->header->version = TRACE_VERSION;
+  trace->header->record_size = sizeof(TraceRecord);
+  trace->header->capacity = capacity;
+  trace->header->count = 0;
+
+  return 0;
+}
+
+/** maps an existing ring file read-only, for decoding */
+int trace_map(Trace *trace, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size < (off_t)sizeof(TraceHeader)) {
+    close(fd);
+    return -1;
+  }
+
+  if (trace_mmap(trace, fd, size, PROT_READ) != 0)
+    return -1;
+
+  TraceHeader *header = trace->header;
+  if (memcmp(header->magic, TRACE_MAGIC, 4) != 0 ||
+      header->version != TRACE_VERSION ||
+      header->record_size != sizeof(TraceRecord) ||
+      sizeof(TraceHeader) + (size_t)header->capacity * sizeof(TraceRecord) > (size_t)size) {
+    trace_close(trace);
+    return -1;
+  }
+
+  return 0;
+}
+
+void trace_close(Trace *trace) {
+  if (trace->header)
+    munmap(trace->header, trace->size);
+
+  trace->header = NULL;
+  trace->records = NULL;
+}
+
+/** state before the instruction at cpu->pc runs */
+void trace_record(Trace *trace, CPU *cpu) {
+  TraceHeader *header = trace->header;
+  TraceRecord *record = &trace->records[header->count % header->capacity];
+
+  record->a = cpu->a;
+  record->f = cpu->f;
+  record->b = cpu->b;
+  record->c = cpu->c;
+  record->d = cpu->d;
+  record->e = cpu->e;
+  record->h = cpu->h;
+  record->l = cpu->l;
+  record->sp = cpu->sp;
+  record->pc = cpu->pc;
+
+  for (int i = 0; i < 4; i++) {
+    record->pcmem[i] = ram_get(cpu->ram, cpu->pc + i);
+  }
+
+  record->bank = cpu->ram->rom_bank;
+  record->cycles = cpu->cycles;
+
+  header->count++;
+}
@@ -0,0 +1,158 @@
+#include <string.h>
+
+#include "gpu.h"
+#include "viewer.h"
+
+#define BACKGROUND 0xFF303040
+#define SCROLL 0xFFE04040
+#define TEXT 0xFFE0E0E0
+
+// panel origins
+#define TILES_X 0
+#define TILES_Y 0
+#define MAP0_X 136
+#define MAP1_X 400
+#define MAPS_Y 0
+#define OAM_X 136
+#define OAM_Y 264
+
+// an OAM entry: the sprite, then two lines of text
+#define OAM_CELL_WIDTH 32
+#define OAM_CELL_HEIGHT 18
+#define OAM_COLUMNS 8
+
+// 3x5 hex digits, a row of three bits per byte
+static const uint8_t font[16][5] = {
+  {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 7, 1, 7},
+  {5, 5, 7, 1, 1}, {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 1, 1},
+  {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7}, {7, 5, 7, 5, 5}, {6, 5, 6, 5, 6},
+  {7, 4, 4, 4, 7}, {6, 5, 5, 5, 6}, {7, 4, 7, 4, 7}, {7, 4, 7, 4, 4},
+};
+
+typedef struct {
+  uint32_t *pixels;
+  int stride;
+} Canvas;
+
+static inline void viewer_plot(Canvas *canvas, int x, int y, uint32_t color) {
+  canvas->pixels[y * canvas->stride + x] = color;
+}
+
+static inline uint32_t viewer_shade(uint8_t shade) {
+  return 0xFF000000 | gpu_colors[shade];
+}
+
+// colour number of pixel x, y of a tile, from its 16 bytes
+static inline uint8_t viewer_color(const uint8_t *tile, int x, int y) {
+  uint8_t low = tile[y * 2], high = tile[y * 2 + 1];
+  int bit = 7 - x;
+  return ((high >> bit) & 1) << 1 | ((low >> bit) & 1);
+}
+
+static void viewer_hex(Canvas *canvas, int x, int y, uint8_t value) {
+  for (int digit = 0; digit < 2; digit++) {
+    const uint8_t *glyph = font[digit ? value & 0x0F : value >> 4];
+
+    for (int row = 0; row < 5; row++)
+      for (int col = 0; col < 3; col++)
+        if (glyph[row] & (4 >> col))
+          viewer_plot(canvas, x + digit * 4 + col, y + row, TEXT);
+  }
+}
+
+static void viewer_tiles(const ViewerMemory *memory, Canvas *canvas) {
+  for (int tile = 0; tile < 384; tile++) {
+    const uint8_t *data = &memory->vram[tile * 16];
+    int left = TILES_X + tile % 16 * 8, top = TILES_Y + tile / 16 * 8;
+
+    for (int y = 0; y < 8; y++)
+      for (int x = 0; x < 8; x++)
+        viewer_plot(canvas, left + x, top + y, viewer_shade(viewer_color(data, x, y)));
+  }
+}
+
+static void viewer_map(const ViewerMemory *memory, Canvas *canvas, int map, int left) {
+  uint8_t lcdc = memory->io[LCDC - RAM_IO];
+  uint8_t bgp = memory->io[PAL_BGP - RAM_IO];
+  const uint8_t *indices = &memory->vram[map ? 0x1C00 : 0x1800];
+
+  for (int i = 0; i < 32 * 32; i++) {
+    uint8_t index = indices[i];
+    // 8000 addressing, or 8800 with a signed index around 9000
+    int offset = lcdc & LCDC_TILE_DATA_AREA ? index * 16 : 0x1000 + (int8_t)index * 16;
+    const uint8_t *data = &memory->vram[offset];
+
+    for (int y = 0; y < 8; y++)
+      for (int x = 0; x < 8; x++) {
+        uint8_t shade = (bgp >> (viewer_color(data, x, y) << 1)) & 0x03;
+        viewer_plot(canvas, left + i % 32 * 8 + x, MAPS_Y + i / 32 * 8 + y, viewer_shade(shade));
+      }
+  }
+
+  if (!!(lcdc & LCDC_BG_TILEMAP_AREA) != map)
+    return;
+
+  // the visible 160x144, wrapping around the map
+  uint8_t scx = memory->io[SCX - RAM_IO], scy = memory->io[SCY - RAM_IO];
+  for (int x = 0; x < 160; x++) {
+    viewer_plot(canvas, left + (uint8_t)(scx + x), MAPS_Y + scy, SCROLL);
+    viewer_plot(canvas, left + (uint8_t)(scx + x), MAPS_Y + (uint8_t)(scy + 143), SCROLL);
+  }
+  for (int y = 0; y < 144; y++) {
+    viewer_plot(canvas, left + scx, MAPS_Y + (uint8_t)(scy + y), SCROLL);
+    viewer_plot(canvas, left + (uint8_t)(scx + 159), MAPS_Y + (uint8_t)(scy + y), SCROLL);
+  }
+}
+
+static void viewer_oam(const ViewerMemory *memory, Canvas *canvas) {
+  uint8_t lcdc = memory->io[LCDC - RAM_IO];
+  int height = lcdc & LCDC_OBJ_SIZE ? 16 : 8;
+
+  for (int sprite = 0; sprite < 40; sprite++) {
+    const uint8_t *entry = &memory->oam[sprite * 4];
+    uint8_t attributes = entry[3];
+    uint8_t tile = height == 16 ? entry[2] & 0xFE : entry[2];
+    uint16_t palette = attributes & OBJ_PALETTE_NUMBER ? 0xFF49 : 0xFF48;
+    uint8_t obp = memory->io[palette - RAM_IO];
+
+    int left = OAM_X + sprite % OAM_COLUMNS * OAM_CELL_WIDTH;
+    int top = OAM_Y + sprite / OAM_COLUMNS * OAM_CELL_HEIGHT + 1;
+
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < 8; x++) {
+        int row = attributes & OBJ_Y_FLIP ? height - 1 - y : y;
+        int col = attributes & OBJ_X_FLIP ? 7 - x : x;
+        uint8_t color = viewer_color(&memory->vram[tile * 16], col, row);
+
+        // colour 0 is transparent, left as background
+        if (color)
+          viewer_plot(canvas, left + x, top + y, viewer_shade((obp >> (color << 1)) & 0x03));
+      }
+
+    viewer_hex(canvas, left + 10, top + 1, entry[0]);
+    viewer_hex(canvas, left + 21, top + 1, entry[1]);
+    viewer_hex(canvas, left + 10, top + 9, entry[2]);
+    viewer_hex(canvas, left + 21, top + 9, attributes);
+  }
+}
+
+/** copies what the viewers show, on the emulation thread */
+void viewer_capture(ViewerMemory *memory, const RAM *ram) {
+  memcpy(memory->vram, ram->vram, sizeof(memory->vram));
+  memcpy(memory->oam, ram->oam, sizeof(memory->oam));
+  memcpy(memory->io, ram->io, sizeof(memory->io));
+}
+
+/** draws all panels into a VIEWER_WIDTH x VIEWER_HEIGHT image */
+void viewer_draw(const ViewerMemory *memory, uint32_t *pixels, int stride) {
+  Canvas canvas = {pixels, stride};
+
+  for (int y = 0; y < VIEWER_HEIGHT; y++)
+    for (int x = 0; x < VIEWER_WIDTH; x++)
+      viewer_plot(&canvas, x, y, BACKGROUND);
+
+  viewer_tiles(memory, &canvas);
+  viewer_map(memory, &canvas, 0, MAP0_X);
+  viewer_map(memory, &canvas, 1, MAP1_X);
+  viewer_oam(memory, &canvas);
+}
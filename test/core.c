@@ -0,0 +1,466 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cheats.h"
+#include "debugger.h"
+#include "emulator.h"
+#include "leekboy.h"
+#include "movie.h"
+#include "../bench/roms.h"
+
+/**
+ * Core regression tests
+ *
+ * Whole-emulator checks on the synthetic ROMs (see roms.h), for behaviour
+ * the opcode runner can't see because it needs memory, the GPU or the
+ * scheduling between them. Each test returns 0 or fails with a message.
+ */
+
+typedef struct {
+  const char *name;
+  int (*run)(void);
+} Test;
+
+static char failure[512];
+
+static int fail(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(failure, sizeof(failure), format, args);
+  va_end(args);
+  return -1;
+}
+
+static uint8_t rom[SYNTHETIC_ROM_SIZE];
+
+static const SyntheticRom *find_rom(const char *name) {
+  for (int i = 0; i < synthetic_rom_count; i++) {
+    if (strcmp(synthetic_roms[i].name, name) == 0)
+      return &synthetic_roms[i];
+  }
+  return NULL;
+}
+
+/* idioms */
+
+// budgets that end inside copy and fill loops as well as on frame edges
+static const int idiom_budgets[] = {FRAME_CYCLES, 1000, 333, 52, 1};
+
+/**
+ * The fast core against the reference core (no idioms) in the same cycle
+ * budgets: both must stop at the same instruction with the same state.
+ */
+static int test_idiom_budgets(void) {
+  static Emulator fast, reference;
+
+  for (int i = 0; i < synthetic_rom_count; i++) {
+    for (int b = 0; b < (int)(sizeof(idiom_budgets) / sizeof(idiom_budgets[0])); b++) {
+      int budget = idiom_budgets[b];
+
+      synthetic_rom_build(&synthetic_roms[i], rom);
+      emulator_init_rom(&fast, rom, sizeof(rom));
+      emulator_init_rom(&reference, rom, sizeof(rom));
+      reference.reference_core = 1;
+
+      for (long cycles = 0; cycles < 10L * FRAME_CYCLES; cycles += budget) {
+        emulator_run_cycles(&fast, budget);
+        emulator_run_cycles(&reference, budget);
+
+        if (fast.cycles != reference.cycles ||
+            emulator_state_hash(&fast) != emulator_state_hash(&reference)) {
+          int result = fail("%s, budget %d: cycle %lu against %lu", synthetic_roms[i].name,
+                            budget, (unsigned long)fast.cycles,
+                            (unsigned long)reference.cycles);
+          emulator_free(&fast);
+          emulator_free(&reference);
+          return result;
+        }
+      }
+
+      emulator_free(&fast);
+      emulator_free(&reference);
+    }
+  }
+
+  return 0;
+}
+
+/** memcpy.gb must actually take idiom blocks, or the test above proves nothing */
+static int test_idiom_blocks(void) {
+  static Emulator fast, reference;
+
+  synthetic_rom_build(find_rom("memcpy"), rom);
+  emulator_init_rom(&fast, rom, sizeof(rom));
+  emulator_init_rom(&reference, rom, sizeof(rom));
+  reference.reference_core = 1;
+
+  emulator_step(&fast);
+  emulator_step(&reference);
+
+  int result = fast.instructions < reference.instructions
+                   ? 0
+                   : fail("%lu steps, no fewer than the reference core",
+                          (unsigned long)fast.instructions);
+
+  emulator_free(&fast);
+  emulator_free(&reference);
+  return result;
+}
+
+/* debugger */
+
+static LeekBoy *create_lb(const char *name) {
+  synthetic_rom_build(find_rom(name), rom);
+  return lb_create(rom, sizeof(rom), NULL);
+}
+
+/** a breakpoint holds every run until resumed, a step runs one instruction */
+static int test_debugger_break_step(void) {
+  LeekBoy *lb = create_lb("alu");
+  LBStop stop;
+  int result = 0;
+
+  lb_break(lb, 0x0155);
+
+  if (lb_run_frames(lb, 3) != LB_STOPPED || lb_stopped(lb, &stop) != LB_STOP_BREAKPOINT ||
+      stop.pc != 0x0155) {
+    result = fail("no breakpoint at 0155");
+    goto done;
+  }
+
+  // stopped: nothing runs, and nothing spins
+  uint64_t cycles = lb_cycles(lb);
+  if (lb_run_cycles(lb, 10 * LB_FRAME_CYCLES) != LB_STOPPED ||
+      lb_run_frames(lb, 3) != LB_STOPPED || lb_cycles(lb) != cycles) {
+    result = fail("ran %lu cycles while stopped", (unsigned long)(lb_cycles(lb) - cycles));
+    goto done;
+  }
+
+  // ADC A, B: one instruction of 4 cycles
+  lb_step(lb);
+  if (lb_run_cycles(lb, LB_FRAME_CYCLES) != LB_STOPPED ||
+      lb_stopped(lb, &stop) != LB_STOP_STEPPED || stop.pc != 0x0156 ||
+      lb_cycles(lb) != cycles + 4) {
+    result = fail("step stopped at %04x after %lu cycles", stop.pc,
+                  (unsigned long)(lb_cycles(lb) - cycles));
+    goto done;
+  }
+
+  // back round the loop to the breakpoint, then free running without it
+  lb_continue(lb);
+  if (lb_run_frames(lb, 1) != LB_STOPPED || lb_stopped(lb, &stop) != LB_STOP_BREAKPOINT) {
+    result = fail("breakpoint not hit again after continuing");
+    goto done;
+  }
+
+  lb_clear_break(lb, 0x0155);
+  lb_continue(lb);
+  if (lb_run_frames(lb, 3) != LB_OK || lb_stopped(lb, NULL) != LB_STOP_NONE)
+    result = fail("still stopped after clearing the breakpoint");
+
+done:
+  lb_destroy(lb);
+  return result;
+}
+
+/** a write watchpoint stops after the instruction and reports the access */
+static int test_debugger_watch(void) {
+  LeekBoy *lb = create_lb("memcpy");
+  LBStop stop;
+  int result = 0;
+
+  lb_watch(lb, 0xD000, 0xD000, LB_WATCH_WRITE);
+
+  // LD (DE), A copying the fill value, INC E of the initial 0xD8
+  if (lb_run_frames(lb, 3) != LB_STOPPED || lb_stopped(lb, &stop) != LB_STOP_WATCHPOINT ||
+      stop.pc != 0x0168 || stop.address != 0xD000 || stop.value != 0xD9 ||
+      stop.access != LB_WATCH_WRITE) {
+    result = fail("stop %d at %04x, %02x to %04x", stop.reason, stop.pc, stop.value,
+                  stop.address);
+    goto done;
+  }
+
+  lb_unwatch(lb, 0xD000, 0xD000);
+  lb_continue(lb);
+  if (lb_run_frames(lb, 3) != LB_OK)
+    result = fail("still stopped after unwatching");
+
+done:
+  lb_destroy(lb);
+  return result;
+}
+
+/** movie playback gives up the frame when the debugger stops, and carries on after */
+static int test_debugger_movie(void) {
+  static Emulator emulator;
+  static Debugger debugger;
+  Movie movie;
+  int result = 0;
+
+  synthetic_rom_build(find_rom("alu"), rom);
+  emulator_init_rom(&emulator, rom, sizeof(rom));
+  movie_init(&movie, &emulator);
+  for (int i = 0; i < 3; i++) {
+    emulator_step(&emulator);
+    movie_record_frame(&movie, &emulator);
+  }
+  emulator_free(&emulator);
+
+  emulator_init_rom(&emulator, rom, sizeof(rom));
+  debugger_init(&debugger);
+  debugger_break(&debugger, 0x0155);
+  emulator.cpu.debugger = &debugger;
+
+  if (movie_play_frame(&movie, &emulator) != MOVIE_STOPPED) {
+    result = fail("breakpoint not reported");
+    goto done;
+  }
+
+  debugger_clear_break(&debugger, 0x0155);
+  debugger_continue(&debugger);
+  for (int i = 0; i < 3; i++) {
+    MovieStatus status = movie_play_frame(&movie, &emulator);
+    if (status != MOVIE_OK) {
+      result = fail("frame %d: status %d after continuing", i, status);
+      break;
+    }
+  }
+
+done:
+  movie_free(&movie);
+  emulator_free(&emulator);
+  return result;
+}
+
+/* cheats */
+
+typedef struct {
+  const char *code;
+  int valid;
+  Cheat cheat;
+} CheatCase;
+
+static const CheatCase cheat_cases[] = {
+    // ABC-DEF: AB data, FCDE address with F inverted
+    {"051-51F", 1, {CHEAT_GAME_GENIE, 0x0151, 0x05}},
+    {"990-00B", 1, {CHEAT_GAME_GENIE, 0x4000, 0x99}},
+    // GI compare byte: rotated right by 2 and XORed with BA, H is ignored
+    {"051-51F-E0E", 1, {CHEAT_GAME_GENIE, 0x0151, 0x05, 0x01, 1}},
+    {"051-51f-e7e", 1, {CHEAT_GAME_GENIE, 0x0151, 0x05, 0x01, 1}},
+    {"051-51F-E02", 1, {CHEAT_GAME_GENIE, 0x0151, 0x05, 0x02, 1}},
+    // ttvvaaaa, address low byte first
+    {"01421AC1", 1, {CHEAT_GAMESHARK, 0xC11A, 0x42, 0, 0, 0x01}},
+    {"8107FFA0", 1, {CHEAT_GAMESHARK, 0xA0FF, 0x07, 0, 0, 0x81}},
+    {"3E1-507", 0},  // 8150 isn't ROM
+    {"01420040", 0}, // 4000 isn't RAM
+    {"0142C0C", 0},
+    {"051-51G", 0},
+    {"", 0},
+};
+
+static int test_cheats_parse(void) {
+  for (int i = 0; i < (int)(sizeof(cheat_cases) / sizeof(cheat_cases[0])); i++) {
+    const CheatCase *test = &cheat_cases[i];
+    Cheat cheat;
+
+    int valid = cheats_parse(&cheat, test->code) == 0;
+    if (valid != test->valid)
+      return fail("%s: %s", test->code, valid ? "parsed" : "rejected");
+
+    const Cheat *expected = &test->cheat;
+    if (valid && (cheat.type != expected->type || cheat.address != expected->address ||
+                  cheat.value != expected->value || cheat.compare != expected->compare ||
+                  cheat.has_compare != expected->has_compare ||
+                  cheat.bank != expected->bank))
+      return fail("%s: %04x = %02x (compare %d %02x, bank %02x)", test->code, cheat.address,
+                  cheat.value, cheat.has_compare, cheat.compare, cheat.bank);
+  }
+
+  return 0;
+}
+
+/** Game Genie codes patch the fixed bank, with and without a matching compare byte */
+static int test_cheats_game_genie(void) {
+  static Emulator emulator;
+  static Cheats cheats;
+  int result = 0;
+
+  // alu.gb: 0150 LD A, 1
+  synthetic_rom_build(find_rom("alu"), rom);
+  emulator_init_rom(&emulator, rom, sizeof(rom));
+  RAM *ram = &emulator.ram;
+
+  const struct {
+    const char *code;
+    uint8_t expected;
+  } steps[] = {{"051-51F-E02", 0x01}, {"051-51F-E0E", 0x05}, {"051-51F", 0x05}};
+
+  for (int i = 0; i < 3; i++) {
+    cheats_clear(&cheats, ram);
+    if (cheats_add(&cheats, ram, steps[i].code) != 0 ||
+        ram_get(ram, 0x0151) != steps[i].expected || rom[0x0151] != 0x01) {
+      result = fail("%s: 0151 = %02x", steps[i].code, ram_get(ram, 0x0151));
+      goto done;
+    }
+  }
+
+  // LD A, 5 as the program sees it, after the jump from 0100
+  for (int i = 0; i < 4 && emulator.cpu.pc != 0x0152; i++)
+    emulator_run_instruction(&emulator);
+  if (emulator.cpu.a != 0x05) {
+    result = fail("A = %02x after the patched load", emulator.cpu.a);
+    goto done;
+  }
+
+  if (cheats_remove(&cheats, ram, "051-51F") != 0 || ram_get(ram, 0x0151) != 0x01 ||
+      cheats_remove(&cheats, ram, "051-51F") == 0)
+    result = fail("removing the code left 0151 = %02x", ram_get(ram, 0x0151));
+
+done:
+  cheats_clear(&cheats, ram);
+  emulator_free(&emulator);
+  return result;
+}
+
+/** a switchable bank code copies only the banks that are mapped in */
+static int test_cheats_banks(void) {
+  static Emulator emulator;
+  static Cheats cheats;
+  static uint8_t banked[0x20000];
+  int result = 0;
+
+  // 128KB MBC1, each bank starting with its number
+  synthetic_rom_build(find_rom("alu"), banked);
+  banked[0x147] = 0x01;
+  banked[0x148] = 0x02;
+  for (int bank = 1; bank < 8; bank++)
+    banked[bank * 0x4000] = bank;
+
+  emulator_init_rom(&emulator, banked, sizeof(banked));
+  RAM *ram = &emulator.ram;
+
+  if (cheats_add(&cheats, ram, "990-00B") != 0 || ram_get(ram, 0x4000) != 0x99 ||
+      cheats.banks[1] == NULL || cheats.banks[0] != NULL) {
+    result = fail("bank 1 not patched on adding the code");
+    goto done;
+  }
+
+  for (int bank = 2; bank < 8; bank++) {
+    if (cheats.banks[bank]) {
+      result = fail("bank %d copied before it was mapped", bank);
+      goto done;
+    }
+  }
+
+  ram_set(ram, 0x2000, 5);
+  if (ram_get(ram, 0x4000) != 0x99 || cheats.banks[5] == NULL || cheats.banks[3] != NULL ||
+      banked[5 * 0x4000] != 5) {
+    result = fail("bank 5 reads %02x after switching", ram_get(ram, 0x4000));
+    goto done;
+  }
+
+  cheats_clear(&cheats, ram);
+  if (ram_get(ram, 0x4000) != 5)
+    result = fail("bank 5 reads %02x after clearing", ram_get(ram, 0x4000));
+
+done:
+  cheats_clear(&cheats, ram);
+  emulator_free(&emulator);
+  return result;
+}
+
+/** GameShark codes write RAM at every VBlank */
+static int test_cheats_gameshark(void) {
+  static Emulator emulator;
+  static Cheats cheats;
+  int result = 0;
+
+  synthetic_rom_build(find_rom("memcpy"), rom);
+  emulator_init_rom(&emulator, rom, sizeof(rom));
+  RAM *ram = &emulator.ram;
+
+  // memcpy.gb keeps copying C000-CFFF over D000-DFFF
+  if (cheats_add(&cheats, ram, "01421AD1") != 0) {
+    result = fail("code rejected");
+    goto done;
+  }
+
+  for (int frame = 0; frame < 3; frame++) {
+    emulator_step(&emulator);
+    if (ram_get(ram, 0xD11A) != 0x42) {
+      result = fail("frame %d: D11A = %02x", frame, ram_get(ram, 0xD11A));
+      goto done;
+    }
+  }
+
+done:
+  cheats_clear(&cheats, ram);
+  emulator_free(&emulator);
+  return result;
+}
+
+/* save states */
+
+/** a transfer saved waiting on a link cable completes as unplugged when loaded alone */
+static int test_state_serial_unlinked(void) {
+  static Emulator linked, alone;
+  static uint8_t state[STATE_MAX_SIZE];
+  int result = 0;
+
+  synthetic_rom_build(find_rom("alu"), rom);
+  emulator_init_rom(&linked, rom, sizeof(rom));
+  emulator_init_rom(&alone, rom, sizeof(rom));
+
+  // as serial_step leaves it when its linked transfer has run its course
+  ram_set(&linked.ram, SERIAL_SB, 0x5A);
+  ram_set(&linked.ram, SERIAL_SC, SERIAL_START | SERIAL_INTERNAL);
+  linked.serial.timer = 0;
+  linked.serial.finished = 1;
+
+  size_t size = emulator_save_state(&linked, state);
+  if (emulator_load_state(&alone, state, size) != 0) {
+    result = fail("state not loaded");
+    goto done;
+  }
+
+  if (alone.serial.finished || ram_get(&alone.ram, SERIAL_SB) != 0xFF ||
+      (ram_get(&alone.ram, SERIAL_SC) & SERIAL_START) || !(ram_get(&alone.ram, IF) & INT_SERIAL))
+    result = fail("transfer left pending: SB %02x SC %02x", ram_get(&alone.ram, SERIAL_SB),
+                  ram_get(&alone.ram, SERIAL_SC));
+
+done:
+  emulator_free(&linked);
+  emulator_free(&alone);
+  return result;
+}
+
+static const Test tests[] = {
+    {"idiom/budgets", test_idiom_budgets},
+    {"idiom/blocks", test_idiom_blocks},
+    {"debugger/break_step", test_debugger_break_step},
+    {"debugger/watch", test_debugger_watch},
+    {"debugger/movie", test_debugger_movie},
+    {"cheats/parse", test_cheats_parse},
+    {"cheats/game_genie", test_cheats_game_genie},
+    {"cheats/banks", test_cheats_banks},
+    {"cheats/gameshark", test_cheats_gameshark},
+    {"state/serial_unlinked", test_state_serial_unlinked},
+};
+
+int main(int argc, char **argv) {
+  int count = sizeof(tests) / sizeof(tests[0]);
+  int passed = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (tests[i].run() == 0) {
+      passed++;
+    } else {
+      printf("%s: %s\n", tests[i].name, failure);
+    }
+  }
+
+  printf("Passing: %d/%d\n", passed, count);
+  return passed != count;
+}
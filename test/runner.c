@@ -0,0 +1,574 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "ram.h"
+
+/**
+ * Opcode conformance runner
+ *
+ * Streams per-opcode JSON test files (one array of test cases per file) and
+ * runs every case through cpu_step against flat 64K memory. Files are shared
+ * out to one worker thread per core. Both the SingleStepTests layout
+ * (registers and "ram" directly in "initial"/"final", decimal numbers) and
+ * the older one (registers under "cpu", hex strings) are accepted.
+ *
+ * This file replaces ram.c: cpu.c is linked against the flat memory below.
+ */
+
+#define MAX_RAM_ENTRIES 64
+#define MAX_REPORTED 5
+#define READ_CHUNK 0x10000
+
+/* flat memory, IF and IE stay in RAM where cpu_step reads them */
+
+typedef struct {
+  RAM ram;
+  uint8_t data[0x10000];
+} TestRAM;
+
+int ram_init(RAM *ram, Input *input, const uint8_t *rom, size_t rom_size) {
+  ram->input = input;
+  ram->rom = rom;
+  ram->rom_mask = rom_size - 1;
+  return 0;
+}
+
+uint8_t ram_get(RAM *ram, uint16_t address) {
+  if (address == IF)
+    return ram->io[IF - RAM_IO];
+  if (address == IE)
+    return ram->ie;
+  return ((TestRAM *)ram)->data[address];
+}
+
+void ram_set(RAM *ram, uint16_t address, uint8_t value) {
+  if (address == IF)
+    ram->io[IF - RAM_IO] = value;
+  else if (address == IE)
+    ram->ie = value;
+  else
+    ((TestRAM *)ram)->data[address] = value;
+}
+
+void ram_set_word(RAM *ram, uint16_t address, uint16_t value) {
+  ram_set(ram, address, value & 0xFF);
+  ram_set(ram, address + 1, value >> 8);
+}
+
+// no bulk access: every case is a single instruction, never an idiom block
+const uint8_t *ram_read_span(RAM *ram, uint16_t address, uint32_t size) {
+  return NULL;
+}
+
+uint8_t *ram_write_span(RAM *ram, uint16_t address, uint32_t size) {
+  return NULL;
+}
+
+/* streaming JSON */
+
+typedef struct {
+  FILE *file;
+  char buffer[READ_CHUNK];
+  size_t size;
+  size_t pos;
+  int error;
+} Reader;
+
+static inline int reader_peek(Reader *reader) {
+  if (reader->pos == reader->size) {
+    reader->size = fread(reader->buffer, 1, READ_CHUNK, reader->file);
+    reader->pos = 0;
+    if (reader->size == 0)
+      return EOF;
+  }
+  return (unsigned char)reader->buffer[reader->pos];
+}
+
+static inline int reader_next(Reader *reader) {
+  int c = reader_peek(reader);
+  if (c != EOF)
+    reader->pos++;
+  return c;
+}
+
+static int reader_skip_space(Reader *reader) {
+  int c;
+  while ((c = reader_peek(reader)) == ' ' || c == '\n' || c == '\r' || c == '\t')
+    reader->pos++;
+  return c;
+}
+
+static int reader_expect(Reader *reader, char expected) {
+  if (reader_skip_space(reader) != expected) {
+    reader->error = 1;
+    return 0;
+  }
+  reader->pos++;
+  return 1;
+}
+
+/** reads a string into `out` (truncated to `size`), escapes kept as is */
+static void read_string(Reader *reader, char *out, size_t size) {
+  size_t length = 0;
+  int c;
+
+  if (!reader_expect(reader, '"'))
+    return;
+
+  while ((c = reader_next(reader)) != '"') {
+    if (c == EOF) {
+      reader->error = 1;
+      break;
+    }
+    if (c == '\\')
+      c = reader_next(reader);
+    if (length + 1 < size)
+      out[length++] = c;
+  }
+
+  if (size > 0)
+    out[length] = '\0';
+}
+
+/** reads a number or a numeric string ("0x1f", "31") */
+static long read_number(Reader *reader) {
+  char text[32];
+  size_t length = 0;
+  int c = reader_skip_space(reader);
+
+  if (c == '"') {
+    read_string(reader, text, sizeof(text));
+    return strtol(text, NULL, 0);
+  }
+
+  while ((c = reader_peek(reader)) == '-' || (c >= '0' && c <= '9')) {
+    if (length + 1 < sizeof(text))
+      text[length++] = c;
+    reader->pos++;
+  }
+  text[length] = '\0';
+
+  if (length == 0)
+    reader->error = 1;
+
+  return strtol(text, NULL, 10);
+}
+
+static void skip_value(Reader *reader) {
+  int c = reader_skip_space(reader);
+
+  if (c == '"') {
+    read_string(reader, NULL, 0);
+  } else if (c == '{' || c == '[') {
+    char close = c == '{' ? '}' : ']';
+    reader->pos++;
+
+    if (reader_skip_space(reader) == close) {
+      reader->pos++;
+      return;
+    }
+
+    do {
+      if (close == '}') {
+        read_string(reader, NULL, 0);
+        reader_expect(reader, ':');
+      }
+      skip_value(reader);
+    } while (!reader->error && reader_skip_space(reader) == ',' && reader_next(reader));
+
+    reader_expect(reader, close);
+  } else {
+    // number, true, false, null
+    while ((c = reader_peek(reader)) != EOF && c != ',' && c != '}' && c != ']' &&
+           c != ' ' && c != '\n' && c != '\r' && c != '\t')
+      reader->pos++;
+  }
+}
+
+/* test cases */
+
+typedef struct {
+  uint8_t a, f, b, c, d, e, h, l;
+  uint16_t sp, pc;
+  uint8_t ime;
+  int ram_count;
+  uint16_t ram[MAX_RAM_ENTRIES][2];
+} State;
+
+typedef struct {
+  char name[64];
+  State initial;
+  State final;
+} Test;
+
+static void read_state(Reader *reader, State *state);
+
+static void read_state_field(Reader *reader, State *state, const char *key) {
+  if (strcmp(key, "cpu") == 0) {
+    read_state(reader, state);
+  } else if (strcmp(key, "ram") == 0) {
+    reader_expect(reader, '[');
+    if (reader_skip_space(reader) == ']') {
+      reader->pos++;
+      return;
+    }
+
+    do {
+      reader_expect(reader, '[');
+      long address = read_number(reader);
+      reader_expect(reader, ',');
+      long value = read_number(reader);
+      reader_expect(reader, ']');
+
+      if (state->ram_count < MAX_RAM_ENTRIES) {
+        state->ram[state->ram_count][0] = address;
+        state->ram[state->ram_count][1] = value;
+        state->ram_count++;
+      }
+    } while (!reader->error && reader_skip_space(reader) == ',' && reader_next(reader));
+
+    reader_expect(reader, ']');
+  } else if (strcmp(key, "a") == 0) {
+    state->a = read_number(reader);
+  } else if (strcmp(key, "f") == 0) {
+    state->f = read_number(reader);
+  } else if (strcmp(key, "b") == 0) {
+    state->b = read_number(reader);
+  } else if (strcmp(key, "c") == 0) {
+    state->c = read_number(reader);
+  } else if (strcmp(key, "d") == 0) {
+    state->d = read_number(reader);
+  } else if (strcmp(key, "e") == 0) {
+    state->e = read_number(reader);
+  } else if (strcmp(key, "h") == 0) {
+    state->h = read_number(reader);
+  } else if (strcmp(key, "l") == 0) {
+    state->l = read_number(reader);
+  } else if (strcmp(key, "sp") == 0) {
+    state->sp = read_number(reader);
+  } else if (strcmp(key, "pc") == 0) {
+    state->pc = read_number(reader);
+  } else if (strcmp(key, "ime") == 0) {
+    state->ime = read_number(reader);
+  } else {
+    skip_value(reader);
+  }
+}
+
+static void read_state(Reader *reader, State *state) {
+  char key[16];
+
+  reader_expect(reader, '{');
+  if (reader_skip_space(reader) == '}') {
+    reader->pos++;
+    return;
+  }
+
+  do {
+    read_string(reader, key, sizeof(key));
+    reader_expect(reader, ':');
+    read_state_field(reader, state, key);
+  } while (!reader->error && reader_skip_space(reader) == ',' && reader_next(reader));
+
+  reader_expect(reader, '}');
+}
+
+static void read_test(Reader *reader, Test *test) {
+  char key[16];
+
+  memset(test, 0, sizeof(Test));
+
+  reader_expect(reader, '{');
+  do {
+    read_string(reader, key, sizeof(key));
+    reader_expect(reader, ':');
+
+    if (strcmp(key, "name") == 0) {
+      read_string(reader, test->name, sizeof(test->name));
+    } else if (strcmp(key, "initial") == 0) {
+      read_state(reader, &test->initial);
+    } else if (strcmp(key, "final") == 0) {
+      read_state(reader, &test->final);
+    } else {
+      skip_value(reader);
+    }
+  } while (!reader->error && reader_skip_space(reader) == ',' && reader_next(reader));
+
+  reader_expect(reader, '}');
+}
+
+/* running */
+
+typedef struct {
+  const char *path;
+  int passed;
+  int total;
+  int error;
+  char report[MAX_REPORTED * 160];
+} FileResult;
+
+/** appends to the file's report, for the first few failing cases only */
+static void report(FileResult *result, int failures, const char *format, ...) {
+  if (failures >= MAX_REPORTED)
+    return;
+
+  size_t used = strlen(result->report);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(result->report + used, sizeof(result->report) - used, format, args);
+  va_end(args);
+}
+
+/** returns 1 if the test passed, reports the first mismatch otherwise */
+static int run_test(CPU *cpu, Test *test, FileResult *result, int failures) {
+  State *initial = &test->initial;
+  State *final = &test->final;
+
+  for (int i = 0; i < initial->ram_count; i++) {
+    cpu_memory_set(cpu, initial->ram[i][0], initial->ram[i][1]);
+  }
+
+  cpu->a = initial->a;
+  cpu->f = initial->f;
+  cpu->b = initial->b;
+  cpu->c = initial->c;
+  cpu->d = initial->d;
+  cpu->e = initial->e;
+  cpu->h = initial->h;
+  cpu->l = initial->l;
+  cpu->sp = initial->sp;
+  cpu->pc = initial->pc;
+  cpu->ime = initial->ime;
+  cpu->halted = 0;
+  cpu->error = CPU_OK;
+
+  cpu_step(cpu, INT_MAX);
+
+  int passed = 1;
+
+#define CHECK(field, actual, expected)                                         \
+  if (passed && (actual) != (expected)) {                                      \
+    report(result, failures, "  %s: %s expected 0x%04x actual 0x%04x\n",       \
+           test->name, field, (expected), (actual));                           \
+    passed = 0;                                                                \
+  }
+
+  CHECK("a", cpu->a, final->a);
+  CHECK("b", cpu->b, final->b);
+  CHECK("c", cpu->c, final->c);
+  CHECK("d", cpu->d, final->d);
+  CHECK("e", cpu->e, final->e);
+  CHECK("h", cpu->h, final->h);
+  CHECK("l", cpu->l, final->l);
+  CHECK("sp", cpu->sp, final->sp);
+  CHECK("pc", cpu->pc, final->pc);
+  CHECK("zero flag", cpu->f & 0x80, final->f & 0x80);
+  CHECK("sub flag", cpu->f & 0x40, final->f & 0x40);
+  CHECK("half flag", cpu->f & 0x20, final->f & 0x20);
+  CHECK("carry flag", cpu->f & 0x10, final->f & 0x10);
+
+  for (int i = 0; i < final->ram_count; i++) {
+    uint16_t address = final->ram[i][0];
+    uint8_t actual = cpu_memory_get(cpu, address);
+
+    if (passed && actual != final->ram[i][1]) {
+      report(result, failures, "  %s: address 0x%04x expected 0x%04x actual 0x%04x\n",
+             test->name, address, final->ram[i][1], actual);
+      passed = 0;
+    }
+  }
+
+#undef CHECK
+
+  // leave memory clean for the next case
+  for (int i = 0; i < initial->ram_count; i++) {
+    ram_set(cpu->ram, initial->ram[i][0], 0);
+  }
+  for (int i = 0; i < final->ram_count; i++) {
+    ram_set(cpu->ram, final->ram[i][0], 0);
+  }
+
+  return passed;
+}
+
+static void run_file(CPU *cpu, FileResult *result) {
+  static __thread Reader reader;
+  Test test;
+
+  reader.file = fopen(result->path, "rb");
+  reader.size = 0;
+  reader.pos = 0;
+  reader.error = 0;
+
+  if (reader.file == NULL) {
+    result->error = 1;
+    snprintf(result->report, sizeof(result->report), "  could not open file\n");
+    return;
+  }
+
+  if (reader_expect(&reader, '[') && reader_skip_space(&reader) != ']') {
+    do {
+      read_test(&reader, &test);
+      if (reader.error)
+        break;
+
+      int failures = result->total - result->passed;
+      result->passed += run_test(cpu, &test, result, failures);
+      result->total++;
+    } while (reader_skip_space(&reader) == ',' && reader_next(&reader));
+  }
+
+  if (reader.error) {
+    result->error = 1;
+    size_t used = strlen(result->report);
+    snprintf(result->report + used, sizeof(result->report) - used,
+             "  malformed JSON after %d tests\n", result->total);
+  }
+
+  fclose(reader.file);
+}
+
+typedef struct {
+  FileResult *results;
+  int count;
+  int next;
+} Queue;
+
+static void *worker(void *data) {
+  Queue *queue = data;
+
+  // each worker has its own CPU and flat memory
+  TestRAM *ram = calloc(1, sizeof(TestRAM));
+  CPU cpu;
+  memset(&cpu, 0, sizeof(cpu));
+  cpu.ram = &ram->ram;
+
+  int index;
+  while ((index = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count) {
+    run_file(&cpu, &queue->results[index]);
+  }
+
+  free(ram);
+  return NULL;
+}
+
+static int compare_results(const void *a, const void *b) {
+  return strcmp(((const FileResult *)a)->path, ((const FileResult *)b)->path);
+}
+
+static void add_path(Queue *queue, int *capacity, const char *path) {
+  if (queue->count == *capacity) {
+    *capacity = *capacity ? *capacity * 2 : 512;
+    FileResult *results = realloc(queue->results, *capacity * sizeof(FileResult));
+    if (results == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+    queue->results = results;
+  }
+
+  FileResult *result = &queue->results[queue->count++];
+  memset(result, 0, sizeof(FileResult));
+  result->path = path;
+}
+
+/** adds a file, or every .json file in a directory */
+static void add_argument(Queue *queue, int *capacity, const char *path) {
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    add_path(queue, capacity, path);
+    return;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    size_t length = strlen(entry->d_name);
+    if (length < 5 || strcmp(entry->d_name + length - 5, ".json") != 0)
+      continue;
+
+    char *file = malloc(strlen(path) + length + 2);
+    sprintf(file, "%s/%s", path, entry->d_name);
+    add_path(queue, capacity, file);
+  }
+
+  closedir(dir);
+}
+
+int main(int argc, char **argv) {
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int quiet = 0, opt;
+
+  while ((opt = getopt(argc, argv, "j:q")) != -1) {
+    switch (opt) {
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-j threads] [-q] file.json|directory...\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Queue queue = {NULL, 0, 0};
+  int capacity = 0;
+
+  for (int i = optind; i < argc; i++) {
+    add_argument(&queue, &capacity, argv[i]);
+  }
+
+  if (queue.count == 0) {
+    fprintf(stderr, "no test files\n");
+    return 1;
+  }
+
+  // sorted by path, so the report comes out in the same order every run
+  qsort(queue.results, queue.count, sizeof(FileResult), compare_results);
+
+  if (threads < 1)
+    threads = 1;
+  if (threads > queue.count)
+    threads = queue.count;
+
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&workers[i], NULL, worker, &queue);
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  int passed = 0, total = 0, failed_files = 0;
+
+  for (int i = 0; i < queue.count; i++) {
+    FileResult *result = &queue.results[i];
+    int failed = result->error || result->passed != result->total;
+
+    passed += result->passed;
+    total += result->total;
+    failed_files += failed;
+
+    if (failed || !quiet) {
+      printf("%s: %d/%d\n%s", result->path, result->passed, result->total,
+             failed ? result->report : "");
+    }
+  }
+
+  printf("Passing: %d/%d (%d/%d files)\n", passed, total,
+         queue.count - failed_files, queue.count);
+
+  free(workers);
+  return failed_files != 0;
+}
@@ -0,0 +1,120 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "emulator.h"
+#include "lockstep.h"
+
+/**
+ * Runs a ROM on the fast and the reference CPU cores in lockstep (see
+ * lockstep.h) and stops at the first divergence, writing a save state one
+ * step before it. Feeding that state back with -l diverges on the first
+ * step, which is the smallest case to debug.
+ *
+ *   lockstep [-f frames] [-l state] [-o reproducer] rom.gb
+ */
+
+static Lockstep lockstep;
+
+static void usage(char *name) {
+  fprintf(stderr, "usage: %s [-f frames] [-l state] [-o reproducer] rom.gb\n", name);
+  exit(1);
+}
+
+static int load_state(const char *filename) {
+  static uint8_t state[STATE_MAX_SIZE];
+
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL)
+    return -1;
+
+  size_t size = fread(state, 1, sizeof(state), f);
+  fclose(f);
+
+  return lockstep_load_state(&lockstep, state, size);
+}
+
+static int save_state(const char *filename) {
+  static uint8_t state[STATE_MAX_SIZE];
+  size_t size = lockstep_reproduce(&lockstep, state);
+
+  FILE *f = fopen(filename, "wb");
+  if (f == NULL)
+    return -1;
+
+  size_t written = fwrite(state, 1, size, f);
+  if (fclose(f) != 0 || written != size)
+    return -1;
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int frames = 3600, opt;
+  char *state_file = NULL, *output_file = "lockstep.state";
+
+  while ((opt = getopt(argc, argv, "f:l:o:")) != -1) {
+    switch (opt) {
+    case 'f':
+      frames = atoi(optarg);
+      break;
+    case 'l':
+      state_file = optarg;
+      break;
+    case 'o':
+      output_file = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (optind >= argc || frames <= 0)
+    usage(argv[0]);
+
+  size_t size;
+  uint8_t *image = emulator_rom_load(argv[optind], &size);
+  if (image == NULL || lockstep_init(&lockstep, image, size) != 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  if (state_file && load_state(state_file) != 0) {
+    fprintf(stderr, "%s: not a save state for this ROM\n", state_file);
+    return 1;
+  }
+
+  LockstepStatus status = LOCKSTEP_OK;
+  int frame;
+  for (frame = 0; frame < frames && status == LOCKSTEP_OK; frame++) {
+    status = lockstep_run_frame(&lockstep);
+  }
+
+  int result = 0;
+  switch (status) {
+  case LOCKSTEP_OK:
+    printf("%d frames, %llu cycles in lockstep\n", frames,
+           (unsigned long long)lockstep.fast.cycles);
+    break;
+  case LOCKSTEP_ERROR:
+    printf("Both cores hit unknown opcode 0x%02X at 0x%04X in frame %d\n",
+           lockstep.fast.cpu.error_opcode, lockstep.fast.cpu.error_pc, frame - 1);
+    break;
+  case LOCKSTEP_DIVERGED:
+    printf("Frame %d: ", frame - 1);
+    lockstep_report(&lockstep, stdout);
+
+    if (save_state(output_file) != 0)
+      perror(output_file);
+    else
+      printf("Reproducer written to %s\n", output_file);
+    result = 1;
+    break;
+  }
+
+  lockstep_free(&lockstep);
+  free(image);
+  return result;
+}
@@ -0,0 +1,224 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/**
+ * Offline tools for binary traces:
+ *
+ *   trace decode [-v] file.trace        Gameboy Doctor text, oldest first
+ *   trace compare file.trace ref.log    first divergence from a reference
+ *
+ * -v appends the ROM bank and cycle count to each decoded line.
+ */
+
+static void format_record(const TraceRecord *r, char *out, size_t size, int verbose) {
+  int n = snprintf(out, size,
+                   "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X",
+                   r->a, r->f, r->b, r->c, r->d, r->e, r->h, r->l, r->sp, r->pc,
+                   r->pcmem[0], r->pcmem[1], r->pcmem[2], r->pcmem[3]);
+
+  if (verbose && n > 0 && (size_t)n < size)
+    snprintf(out + n, size - n, " BANK:%02X CY:%u", r->bank, r->cycles);
+}
+
+static inline int hex_digit(int c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+static const char *parse_hex(const char *p, unsigned int *value) {
+  *value = 0;
+  int digit;
+  while ((digit = hex_digit(*p)) >= 0) {
+    *value = *value << 4 | digit;
+    p++;
+  }
+  return p;
+}
+
+/** parses a Gameboy Doctor line, returns 0 if every field was found */
+static int parse_line(const char *line, TraceRecord *r) {
+  unsigned int value;
+  int found = 0;
+
+  memset(r, 0, sizeof(TraceRecord));
+
+  for (const char *p = line; *p;) {
+    const char *colon = strchr(p, ':');
+    if (colon == NULL)
+      break;
+
+    size_t length = colon - p;
+    const char *next = parse_hex(colon + 1, &value);
+
+#define FIELD(name, target)                                                    \
+  if (length == strlen(name) && strncmp(p, name, length) == 0) {               \
+    target = value;                                                            \
+    found++;                                                                   \
+  }
+
+    FIELD("A", r->a)
+    else FIELD("F", r->f)
+    else FIELD("B", r->b)
+    else FIELD("C", r->c)
+    else FIELD("D", r->d)
+    else FIELD("E", r->e)
+    else FIELD("H", r->h)
+    else FIELD("L", r->l)
+    else FIELD("SP", r->sp)
+    else FIELD("PC", r->pc)
+    else if (length == 5 && strncmp(p, "PCMEM", 5) == 0) {
+      r->pcmem[0] = value;
+      for (int i = 1; i < 4 && *next == ','; i++) {
+        next = parse_hex(next + 1, &value);
+        r->pcmem[i] = value;
+      }
+      found++;
+    }
+
+#undef FIELD
+
+    while (*next == ' ')
+      next++;
+    p = next;
+  }
+
+  return found == 11 ? 0 : -1;
+}
+
+static int same_state(const TraceRecord *a, const TraceRecord *b) {
+  return a->a == b->a && a->f == b->f && a->b == b->b && a->c == b->c &&
+         a->d == b->d && a->e == b->e && a->h == b->h && a->l == b->l &&
+         a->sp == b->sp && a->pc == b->pc &&
+         memcmp(a->pcmem, b->pcmem, sizeof(a->pcmem)) == 0;
+}
+
+static uint64_t trace_first(Trace *trace) {
+  TraceHeader *header = trace->header;
+  return header->count > header->capacity ? header->count - header->capacity : 0;
+}
+
+static const TraceRecord *trace_at(Trace *trace, uint64_t index) {
+  return &trace->records[index % trace->header->capacity];
+}
+
+static int decode(Trace *trace, int verbose) {
+  char line[128];
+
+  for (uint64_t i = trace_first(trace); i < trace->header->count; i++) {
+    format_record(trace_at(trace, i), line, sizeof(line), verbose);
+    puts(line);
+  }
+
+  return 0;
+}
+
+static int compare(Trace *trace, const char *reference) {
+  FILE *f = fopen(reference, "r");
+  if (f == NULL) {
+    perror(reference);
+    return 2;
+  }
+
+  char *line = NULL;
+  size_t capacity = 0;
+  uint64_t index = 0, line_number = 0;
+  uint64_t first = trace_first(trace), count = trace->header->count;
+  int result = 0;
+
+  while (index < count && getline(&line, &capacity, f) > 0) {
+    line_number++;
+    if (line[0] != 'A')
+      continue;
+
+    // the ring only holds the newest records
+    if (index < first) {
+      index++;
+      continue;
+    }
+
+    TraceRecord expected;
+    const TraceRecord *actual = trace_at(trace, index);
+
+    if (parse_line(line, &expected) != 0) {
+      fprintf(stderr, "%s:%llu: unrecognised line\n", reference,
+              (unsigned long long)line_number);
+      result = 2;
+      break;
+    }
+
+    if (!same_state(&expected, actual)) {
+      char text[128];
+
+      printf("Divergence at instruction %llu (reference line %llu):\n",
+             (unsigned long long)index, (unsigned long long)line_number);
+      format_record(&expected, text, sizeof(text), 0);
+      printf("Expected: %s\n", text);
+      format_record(actual, text, sizeof(text), 1);
+      printf("Actual:   %s\n", text);
+
+      if (index > first) {
+        format_record(trace_at(trace, index - 1), text, sizeof(text), 1);
+        printf("Previous: %s\n", text);
+      }
+
+      result = 1;
+      break;
+    }
+
+    index++;
+  }
+
+  if (result == 0)
+    printf("No divergence in %llu instructions\n",
+           (unsigned long long)(index - first));
+
+  free(line);
+  fclose(f);
+  return result;
+}
+
+static void usage(char *name) {
+  fprintf(stderr, "usage: %s decode [-v] file.trace\n", name);
+  fprintf(stderr, "       %s compare file.trace reference.log\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3)
+    usage(argv[0]);
+
+  int verbose = strcmp(argv[2], "-v") == 0;
+  const char *path = argv[2 + verbose];
+
+  if (path == NULL)
+    usage(argv[0]);
+
+  Trace trace;
+  if (trace_map(&trace, path) != 0) {
+    fprintf(stderr, "%s: not a trace file\n", path);
+    return 2;
+  }
+
+  int result;
+  if (strcmp(argv[1], "decode") == 0) {
+    result = decode(&trace, verbose);
+  } else if (strcmp(argv[1], "compare") == 0 && argc >= 4) {
+    result = compare(&trace, argv[3]);
+  } else {
+    usage(argv[0]);
+    result = 2;
+  }
+
+  trace_close(&trace);
+  return result;
+}